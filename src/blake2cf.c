@@ -16,31 +16,15 @@
 
 #define _DEFAULT_SOURCE /* activates  htole64  and  le64toh  from endian.h */
 #include <stdint.h>
+#include <string.h>
 #include <endian.h>
 #include "blake2cf.h"
+#include "blake2cf_impl.h"
 
 #define assert(C) do { ; } while (! (C)) /* poor man's assert */
 
 _Static_assert(sizeof(uint64_t[8]) == BLAKE2CF_MEMSTATESIZE, "BLAKE2CF_MEMSTATESIZE has wrong value!");
 
-static const uint64_t iv[8] = {
-  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
-  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
-};
-
-static const uint8_t sigma[10 * 16] = {
-   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
-  14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3,
-  11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4,
-   7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8,
-   9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13,
-   2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9,
-  12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11,
-  13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10,
-   6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5,
-  10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0,
-};
-
 void blake2cf_init(void * _st, int klen, int mdlen) {
   uint64_t *st = _st;
   int i;
@@ -49,7 +33,7 @@ void blake2cf_init(void * _st, int klen, int mdlen) {
   assert(mdlen >= 1 && mdlen <= 64);
 
   for (i = 0; i < 8; i++) {
-    st[i] = iv[i];
+    st[i] = blake2cf_iv[i];
   }
   st[0] ^= 0x01010000 | (klen << 8) | (mdlen);
 }
@@ -73,59 +57,375 @@ void blake2cf_export(const void * _st, void * _out) {
 
 #define ROR64(a, n) (((uint64_t)(a) << (64 - n)) | (((uint64_t)(a) >> n)))
 
-#define G(a, b, c, d) do {                          \
-    a = a + b + m[*s++];                            \
+/*
+  Fully unrolled: with round number r and G index i being literals, blake2cf_sigma[r][...] is a compile-time
+  constant, so every message word is addressed directly and the compiler can keep m[] and v[] in registers.
+*/
+
+#define G(r, i, a, b, c, d) do {                    \
+    a = a + b + m[blake2cf_sigma[r][2 * (i) + 0]];  \
     d = ROR64(d ^ a, 32);                           \
     c = c + d;                                      \
     b = ROR64(b ^ c, 24);                           \
-    a = a + b + m[*s++];                            \
+    a = a + b + m[blake2cf_sigma[r][2 * (i) + 1]];  \
     d = ROR64(d ^ a, 16);                           \
     c = c + d;                                      \
     b = ROR64(b ^ c, 63);                           \
   } while(0)
 
-#define ROUND do {                                  \
-    G(v[ 0], v[ 4], v[ 8], v[12]);                  \
-    G(v[ 1], v[ 5], v[ 9], v[13]);                  \
-    G(v[ 2], v[ 6], v[10], v[14]);                  \
-    G(v[ 3], v[ 7], v[11], v[15]);                  \
-    G(v[ 0], v[ 5], v[10], v[15]);                  \
-    G(v[ 1], v[ 6], v[11], v[12]);                  \
-    G(v[ 2], v[ 7], v[ 8], v[13]);                  \
-    G(v[ 3], v[ 4], v[ 9], v[14]);                  \
+#define ROUND(r) do {                               \
+    G(r, 0, v[ 0], v[ 4], v[ 8], v[12]);            \
+    G(r, 1, v[ 1], v[ 5], v[ 9], v[13]);            \
+    G(r, 2, v[ 2], v[ 6], v[10], v[14]);            \
+    G(r, 3, v[ 3], v[ 7], v[11], v[15]);            \
+    G(r, 4, v[ 0], v[ 5], v[10], v[15]);            \
+    G(r, 5, v[ 1], v[ 6], v[11], v[12]);            \
+    G(r, 6, v[ 2], v[ 7], v[ 8], v[13]);            \
+    G(r, 7, v[ 3], v[ 4], v[ 9], v[14]);            \
   } while(0)
 
-void blake2cf_update(void * _st, const void * _block, unsigned long long int t, int final) {
-  uint64_t *st = _st;
-  const uint64_t *block = _block;
-  uint64_t m[16];
+/* the compression proper, on chaining value h and message words m (host byte order) */
+static inline void blake2cf_compress(uint64_t h[8], const uint64_t m[16], unsigned long long int t, int final) {
   uint64_t v[16];
-  const uint8_t *s;
   int i;
 
-  for (i = 0; i < 16; i++) {
-    m[i] = le64toh(*block++);
-  }
-
   for (i = 0; i < 8; i++) {
-    v[i] = st[i];
-    v[8 + i] = iv[i];
+    v[i] = h[i];
+    v[8 + i] = blake2cf_iv[i];
   }
   v[12] ^= t;
   if (final) {
     v[14] ^= ~0ULL;
   }
 
-  s = sigma;
-  ROUND; ROUND;
-  ROUND; ROUND;
-  ROUND; ROUND;
-  ROUND; ROUND;
-  ROUND; ROUND;
-  s = sigma;
-  ROUND; ROUND;
+  ROUND(0); ROUND(1);
+  ROUND(2); ROUND(3);
+  ROUND(4); ROUND(5);
+  ROUND(6); ROUND(7);
+  ROUND(8); ROUND(9);
+  ROUND(10); ROUND(11);
+
+  for (i = 0; i < 8; i++) {
+    h[i] ^= v[i] ^ v[8 + i];
+  }
+}
+
+static void blake2cf_update_ref(void * _st, const void * _block, unsigned long long int t, int final) {
+  uint64_t *st = _st;
+  const uint8_t *block = _block;
+  uint64_t m[16], x;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    memcpy(&x, block + 8 * i, 8); /* the block may be unaligned */
+    m[i] = le64toh(x);
+  }
+
+  blake2cf_compress(st, m, t, final);
+}
+
+static void blake2cf_update_xor_ref(void * _st, const void *block, unsigned long long int t, int final, void * _out, const void * _in, size_t len) {
+  const uint64_t *st = _st;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t w;
+  int i;
+
+  blake2cf_update_ref(_st, block, t, final);
+
+  if (len == BLAKE2CF_STATESIZE) {
+    for (i = 0; i < 8; i++) {
+      memcpy(&w, in + 8 * i, 8);
+      w ^= htole64(st[i]);
+      memcpy(out + 8 * i, &w, 8);
+    }
+  }
+  else {
+    blake2cf_xor_state(st, out, in, len);
+  }
+}
+
+static void blake2cf_update_split_ref(void * _st, const void * _ad, const void * _key, const void * _msg, unsigned long long int t, void * _out, const void * _in) {
+  uint64_t *st = _st;
+  const uint8_t *ad = _ad;
+  const uint8_t *key = _key;
+  const uint8_t *msg = _msg;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t m[16];
+  uint64_t x, y;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    memcpy(&x, ad + 8 * i, 8);
+    memcpy(&y, key + 8 * i, 8);
+    m[i] = le64toh(x ^ y);
+    memcpy(&x, msg + 8 * i, 8);
+    m[8 + i] = le64toh(x);
+  }
+
+  blake2cf_compress(st, m, t, 0);
+
+  for (i = 0; i < 8; i++) {
+    memcpy(&x, in + 8 * i, 8);
+    x ^= htole64(st[i]);
+    memcpy(out + 8 * i, &x, 8);
+  }
+}
+
+static void blake2cf_ets_bulk_ref(void * _st, void * _block, unsigned long long int t, void * _out, const void * _in, size_t nblocks, int decrypt) {
+  uint64_t *st = _st;
+  uint8_t *block = _block;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t h[8], m[16];
+  uint64_t x, y;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    h[i] = st[i];
+  }
+  for (i = 0; i < 16; i++) {
+    memcpy(&x, block + 8 * i, 8);
+    m[i] = le64toh(x);
+  }
+
+  for ( ; nblocks > 0; nblocks--) {
+    blake2cf_compress(h, m, t++, 0);
+    for (i = 0; i < 8; i++) {
+      memcpy(&x, in + 8 * i, 8);
+      y = x ^ htole64(h[i]);
+      memcpy(out + 8 * i, &y, 8);
+      m[8 + i] = le64toh(decrypt ? y : x); /* the plaintext, read before (encryption) or after (decryption) the store */
+    }
+    in += BLAKE2CF_STATESIZE, out += BLAKE2CF_STATESIZE;
+  }
 
   for (i = 0; i < 8; i++) {
-    st[i] ^= v[i] ^ v[8 + i];
+    st[i] = h[i];
+    x = htole64(m[8 + i]);
+    memcpy(block + 64 + 8 * i, &x, 8);
+  }
+}
+
+static void blake2cf_update_x4_ref(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]) {
+  int j;
+
+  for (j = 0; j < 4; j++) {
+    blake2cf_update_ref(st[j], block[j], t[j], final[j]);
+  }
+}
+
+static void blake2cf_update_x8_ref(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]) {
+  int j;
+
+  for (j = 0; j < 8; j++) {
+    blake2cf_update_ref(st[j], block[j], t[j], final[j]);
+  }
+}
+
+/*
+  Several states compressed statement by statement in lockstep: the dependency chains of the records are
+  independent, so an out-of-order core can overlap them (and the compiler may pair lanes up in vector registers).
+*/
+
+#define G_N(n, r, i, a, b, c, d) do {                                      \
+    int j_;                                                                 \
+    for (j_ = 0; j_ < (n); j_++) v[a][j_] += v[b][j_] + m[blake2cf_sigma[r][2 * (i) + 0]][j_]; \
+    for (j_ = 0; j_ < (n); j_++) v[d][j_] = ROR64(v[d][j_] ^ v[a][j_], 32); \
+    for (j_ = 0; j_ < (n); j_++) v[c][j_] += v[d][j_];                      \
+    for (j_ = 0; j_ < (n); j_++) v[b][j_] = ROR64(v[b][j_] ^ v[c][j_], 24); \
+    for (j_ = 0; j_ < (n); j_++) v[a][j_] += v[b][j_] + m[blake2cf_sigma[r][2 * (i) + 1]][j_]; \
+    for (j_ = 0; j_ < (n); j_++) v[d][j_] = ROR64(v[d][j_] ^ v[a][j_], 16); \
+    for (j_ = 0; j_ < (n); j_++) v[c][j_] += v[d][j_];                      \
+    for (j_ = 0; j_ < (n); j_++) v[b][j_] = ROR64(v[b][j_] ^ v[c][j_], 63); \
+  } while(0)
+
+#define ROUND_N(n, r) do {                          \
+    G_N(n, r, 0,  0,  4,  8, 12);                   \
+    G_N(n, r, 1,  1,  5,  9, 13);                   \
+    G_N(n, r, 2,  2,  6, 10, 14);                   \
+    G_N(n, r, 3,  3,  7, 11, 15);                   \
+    G_N(n, r, 4,  0,  5, 10, 15);                   \
+    G_N(n, r, 5,  1,  6, 11, 12);                   \
+    G_N(n, r, 6,  2,  7,  8, 13);                   \
+    G_N(n, r, 7,  3,  4,  9, 14);                   \
+  } while(0)
+
+#define UPDATE_N(n) do {                                                \
+    uint64_t v[16][n], m[16][n], w;                                     \
+    uint64_t *h;                                                        \
+    int i, j;                                                           \
+                                                                        \
+    for (j = 0; j < (n); j++) {                                         \
+      h = st[j];                                                        \
+      for (i = 0; i < 16; i++) {                                        \
+        memcpy(&w, (const uint8_t *)block[j] + 8 * i, 8);               \
+        m[i][j] = le64toh(w);                                           \
+      }                                                                 \
+      for (i = 0; i < 8; i++) {                                         \
+        v[i][j] = h[i];                                                 \
+        v[8 + i][j] = blake2cf_iv[i];                                   \
+      }                                                                 \
+      v[12][j] ^= t[j];                                                 \
+      if (final[j]) {                                                   \
+        v[14][j] ^= ~0ULL;                                              \
+      }                                                                 \
+    }                                                                   \
+                                                                        \
+    ROUND_N(n, 0); ROUND_N(n, 1);                                       \
+    ROUND_N(n, 2); ROUND_N(n, 3);                                       \
+    ROUND_N(n, 4); ROUND_N(n, 5);                                       \
+    ROUND_N(n, 6); ROUND_N(n, 7);                                       \
+    ROUND_N(n, 8); ROUND_N(n, 9);                                       \
+    ROUND_N(n, 10); ROUND_N(n, 11);                                     \
+                                                                        \
+    for (j = 0; j < (n); j++) {                                         \
+      h = st[j];                                                        \
+      for (i = 0; i < 8; i++) {                                         \
+        h[i] ^= v[i][j] ^ v[8 + i][j];                                  \
+      }                                                                 \
+    }                                                                   \
+  } while (0)
+
+/* two interleaved states spill so much that they lose against two plain calls, so the x2 lanes go one after the other */
+static void blake2cf_update_x2_ref(void *const st[2], const void *const block[2], const unsigned long long int t[2], const int final[2]) {
+  blake2cf_update_ref(st[0], block[0], t[0], final[0]);
+  blake2cf_update_ref(st[1], block[1], t[1], final[1]);
+}
+
+static void blake2cf_update_x3_ref(void *const st[3], const void *const block[3], const unsigned long long int t[3], const int final[3]) {
+  UPDATE_N(3);
+}
+
+const struct blake2cf_kernel blake2cf_kernels[] = {
+#if HAVE_X86_SIMD
+  /* the vector lanes are ahead of the single-record code at all record lengths, from SSSE3 on */
+  { "avx512", CPU_AVX512, blake2cf_update_avx512, blake2cf_update_xor_avx512, blake2cf_update_split_avx512, blake2cf_ets_bulk_avx512, blake2cf_update_x2_ssse3, blake2cf_update_x3_ssse3, blake2cf_update_x4_avx2, blake2cf_update_x8_avx512, SIZE_MAX },
+  { "avx2", CPU_AVX2, blake2cf_update_avx2, blake2cf_update_xor_avx2, blake2cf_update_split_avx2, blake2cf_ets_bulk_avx2, blake2cf_update_x2_ssse3, blake2cf_update_x3_ssse3, blake2cf_update_x4_avx2, blake2cf_update_x8_avx2, SIZE_MAX },
+  { "ssse3", CPU_SSSE3, blake2cf_update_ssse3, blake2cf_update_xor_ssse3, blake2cf_update_split_ssse3, blake2cf_ets_bulk_ssse3, blake2cf_update_x2_ssse3, blake2cf_update_x3_ssse3, blake2cf_update_x4_ssse3, blake2cf_update_x8_ssse3, SIZE_MAX },
+#endif
+  /* the reference lanes run one after the other, and lose to the single-record code at all lengths */
+  { "ref", 0, blake2cf_update_ref, blake2cf_update_xor_ref, blake2cf_update_split_ref, blake2cf_ets_bulk_ref, blake2cf_update_x2_ref, blake2cf_update_x3_ref, blake2cf_update_x4_ref, blake2cf_update_x8_ref, 0 },
+};
+
+static const struct blake2cf_kernel *blake2cf_select(void) {
+  const struct blake2cf_kernel *kernel = blake2cf_kernels;
+  unsigned int features = cpu_features();
+
+  while ((kernel->features & features) != kernel->features) {
+    kernel++;
   }
+  return kernel;
+}
+
+static void blake2cf_update_bind(void *st, const void *block, unsigned long long int t, int final);
+static void blake2cf_update_xor_bind(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len);
+static void blake2cf_update_split_bind(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in);
+static void blake2cf_ets_bulk_bind(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt);
+static void blake2cf_update_x2_bind(void *const st[2], const void *const block[2], const unsigned long long int t[2], const int final[2]);
+static void blake2cf_update_x3_bind(void *const st[3], const void *const block[3], const unsigned long long int t[3], const int final[3]);
+static void blake2cf_update_x4_bind(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]);
+static void blake2cf_update_x8_bind(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]);
+
+static blake2cf_update_fn blake2cf_update_impl = blake2cf_update_bind;
+static blake2cf_update_xor_fn blake2cf_update_xor_impl = blake2cf_update_xor_bind;
+static blake2cf_update_split_fn blake2cf_update_split_impl = blake2cf_update_split_bind;
+static blake2cf_ets_bulk_fn blake2cf_ets_bulk_impl = blake2cf_ets_bulk_bind;
+static blake2cf_update_xn_fn blake2cf_update_x2_impl = blake2cf_update_x2_bind;
+static blake2cf_update_xn_fn blake2cf_update_x3_impl = blake2cf_update_x3_bind;
+static blake2cf_update_xn_fn blake2cf_update_x4_impl = blake2cf_update_x4_bind;
+static blake2cf_update_xn_fn blake2cf_update_x8_impl = blake2cf_update_x8_bind;
+
+static void blake2cf_bind(void) {
+  const struct blake2cf_kernel *kernel = blake2cf_select();
+  ATOMIC_STORE_RELEASE(&blake2cf_update_impl, kernel->update);
+  ATOMIC_STORE_RELEASE(&blake2cf_update_xor_impl, kernel->update_xor);
+  ATOMIC_STORE_RELEASE(&blake2cf_update_split_impl, kernel->update_split);
+  ATOMIC_STORE_RELEASE(&blake2cf_ets_bulk_impl, kernel->ets_bulk);
+  ATOMIC_STORE_RELEASE(&blake2cf_update_x2_impl, kernel->update_x2);
+  ATOMIC_STORE_RELEASE(&blake2cf_update_x3_impl, kernel->update_x3);
+  ATOMIC_STORE_RELEASE(&blake2cf_update_x4_impl, kernel->update_x4);
+  ATOMIC_STORE_RELEASE(&blake2cf_update_x8_impl, kernel->update_x8);
+}
+
+/* first call only: bind blake2cf_update(_xor/_split/_x2/_x3/_x4/_x8) and blake2cf_ets_bulk to the best kernel, then forward */
+static void blake2cf_update_bind(void *st, const void *block, unsigned long long int t, int final) {
+  blake2cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_impl))(st, block, t, final);
+}
+
+static void blake2cf_update_xor_bind(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len) {
+  blake2cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_xor_impl))(st, block, t, final, out, in, len);
+}
+
+static void blake2cf_update_split_bind(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in) {
+  blake2cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_split_impl))(st, ad, key, msg, t, out, in);
+}
+
+static void blake2cf_ets_bulk_bind(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt) {
+  blake2cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_ets_bulk_impl))(st, block, t, out, in, nblocks, decrypt);
+}
+
+static void blake2cf_update_x2_bind(void *const st[2], const void *const block[2], const unsigned long long int t[2], const int final[2]) {
+  blake2cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_x2_impl))(st, block, t, final);
+}
+
+static void blake2cf_update_x3_bind(void *const st[3], const void *const block[3], const unsigned long long int t[3], const int final[3]) {
+  blake2cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_x3_impl))(st, block, t, final);
+}
+
+static void blake2cf_update_x4_bind(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]) {
+  blake2cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_x4_impl))(st, block, t, final);
+}
+
+static void blake2cf_update_x8_bind(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]) {
+  blake2cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_x8_impl))(st, block, t, final);
+}
+
+void blake2cf_update(void *st, const void *block, unsigned long long int t, int final) {
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_impl))(st, block, t, final);
+}
+
+void blake2cf_update_xor(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len) {
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_xor_impl))(st, block, t, final, out, in, len);
+}
+
+void blake2cf_update_split(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in) {
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_split_impl))(st, ad, key, msg, t, out, in);
+}
+
+void blake2cf_ets_bulk(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt) {
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_ets_bulk_impl))(st, block, t, out, in, nblocks, decrypt);
+}
+
+void blake2cf_update_x2(void *const st[2], const void *const block[2], const unsigned long long int t[2], const int final[2]) {
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_x2_impl))(st, block, t, final);
+}
+
+void blake2cf_update_x3(void *const st[3], const void *const block[3], const unsigned long long int t[3], const int final[3]) {
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_x3_impl))(st, block, t, final);
+}
+
+void blake2cf_update_x4(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]) {
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_x4_impl))(st, block, t, final);
+}
+
+void blake2cf_update_x8(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]) {
+  (*ATOMIC_LOAD_ACQUIRE(&blake2cf_update_x8_impl))(st, block, t, final);
+}
+
+const char *blake2cf_backend(void) {
+  return blake2cf_select()->name;
+}
+
+size_t blake2cf_lanes_maxlen(void) {
+  return blake2cf_select()->lanes_maxlen;
 }
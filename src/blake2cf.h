@@ -17,6 +17,8 @@
 #ifndef BLAKE2CF_H
 #define BLAKE2CF_H
 
+#include <stddef.h>
+
 #define BLAKE2CF_BLOCKSIZE 128
 #define BLAKE2CF_STATESIZE 64
 
@@ -27,4 +29,30 @@ void blake2cf_clear(void *st);
 void blake2cf_export(const void *st, void *out);
 void blake2cf_update(void *st, const void *block, unsigned long long int t, int final);
 
+/* blake2cf_update, then out = in XOR (first len <= BLAKE2CF_STATESIZE bytes of the exported state); out == in is allowed */
+void blake2cf_update_xor(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len);
+
+/*
+  Compress the block (ad XOR key) || msg, with BLAKE2CF_BLOCKSIZE - BLAKE2CF_STATESIZE bytes of ad and key and
+  BLAKE2CF_STATESIZE bytes of msg, at counter t (not final), without staging it in a buffer;
+  then out = in XOR (exported state), over BLAKE2CF_STATESIZE bytes; out == in is allowed.
+*/
+void blake2cf_update_split(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in);
+
+/*
+  Steady-state bulk phase of the encrypt-to-self mode, with the chaining value kept in registers throughout:
+  for each of the nblocks blocks, compress block (counter t++, not final), XOR the exported state into the next
+  BLAKE2CF_STATESIZE bytes of in to give out, and replace the last BLAKE2CF_STATESIZE bytes of block by the
+  plaintext of this step (in if decrypt == 0, out otherwise). The first bytes of block are the same for all blocks.
+*/
+void blake2cf_ets_bulk(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt);
+
+/* four, resp. eight, independent blake2cf_update calls, lane j on st[j] with block[j], t[j], final[j], computed side by side in SIMD lanes */
+void blake2cf_update_x4(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]);
+void blake2cf_update_x8(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]);
+
+/* two, resp. three, independent blake2cf_update calls as above, interleaved to overlap their dependency chains (also without SIMD) */
+void blake2cf_update_x2(void *const st[2], const void *const block[2], const unsigned long long int t[2], const int final[2]);
+void blake2cf_update_x3(void *const st[3], const void *const block[3], const unsigned long long int t[3], const int final[3]);
+
 #endif /* BLAKE2CF_H */
@@ -0,0 +1,262 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "blake2cf.h"
+#include "blake2cf_impl.h"
+
+#if HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+  BLAKE2b compression with the four rows of the 4x4 state matrix held in one 256-bit register each;
+  the diagonal step is reduced to a column step by rotating rows 2, 3, 4 by one, two, three lanes.
+*/
+
+#define ROT32(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define ROT24(x) _mm256_shuffle_epi8((x), r24)
+#define ROT16(x) _mm256_shuffle_epi8((x), r16)
+#define ROT63(x) _mm256_xor_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define LOAD_MSG(r, i) _mm256_set_epi64x(m[blake2cf_sigma[r][(i) + 6]], m[blake2cf_sigma[r][(i) + 4]], \
+                                         m[blake2cf_sigma[r][(i) + 2]], m[blake2cf_sigma[r][(i) + 0]])
+
+#define G(a, b, c, d, mx, my) do {                                      \
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), mx);                   \
+    d = ROT32(_mm256_xor_si256(d, a));                                  \
+    c = _mm256_add_epi64(c, d);                                         \
+    b = ROT24(_mm256_xor_si256(b, c));                                  \
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), my);                   \
+    d = ROT16(_mm256_xor_si256(d, a));                                  \
+    c = _mm256_add_epi64(c, d);                                         \
+    b = ROT63(_mm256_xor_si256(b, c));                                  \
+  } while (0)
+
+#define DIAGONALIZE(b, c, d) do {                                       \
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));           \
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));           \
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));           \
+  } while (0)
+
+#define UNDIAGONALIZE(b, c, d) do {                                     \
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));           \
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));           \
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));           \
+  } while (0)
+
+#define ROUND(r) do {                                                   \
+    G(a, b, c, d, LOAD_MSG(r, 0), LOAD_MSG(r, 1));                      \
+    DIAGONALIZE(b, c, d);                                               \
+    G(a, b, c, d, LOAD_MSG(r, 8), LOAD_MSG(r, 9));                      \
+    UNDIAGONALIZE(b, c, d);                                             \
+  } while (0)
+
+TARGET("avx2")
+static inline void blake2cf_rounds(const long long int *m, unsigned long long int t, int final, __m256i *lo, __m256i *hi) {
+  const __m256i r24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                       3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+  const __m256i r16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                       2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+  __m256i a, b, c, d;
+
+  a = *lo;
+  b = *hi;
+  c = _mm256_loadu_si256((const __m256i *)(blake2cf_iv + 0));
+  d = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(blake2cf_iv + 4)),
+                       _mm256_set_epi64x(0, final ? -1LL : 0, 0, (long long int)t));
+
+  ROUND(0); ROUND(1); ROUND(2); ROUND(3);
+  ROUND(4); ROUND(5); ROUND(6); ROUND(7);
+  ROUND(8); ROUND(9); ROUND(10); ROUND(11);
+
+  *lo = _mm256_xor_si256(*lo, _mm256_xor_si256(a, c));
+  *hi = _mm256_xor_si256(*hi, _mm256_xor_si256(b, d));
+}
+
+TARGET("avx2")
+static inline void blake2cf_compress(uint64_t *st, const void *block, unsigned long long int t, int final, __m256i *lo, __m256i *hi) {
+  long long int m[16];
+
+  memcpy(m, block, sizeof(m));
+
+  *lo = _mm256_loadu_si256((const __m256i *)(st + 0));
+  *hi = _mm256_loadu_si256((const __m256i *)(st + 4));
+  blake2cf_rounds(m, t, final, lo, hi);
+  _mm256_storeu_si256((__m256i *)(st + 0), *lo);
+  _mm256_storeu_si256((__m256i *)(st + 4), *hi);
+}
+
+TARGET("avx2")
+void blake2cf_update_avx2(void *st, const void *block, unsigned long long int t, int final) {
+  __m256i lo, hi;
+
+  blake2cf_compress(st, block, t, final, &lo, &hi);
+}
+
+TARGET("avx2")
+void blake2cf_update_xor_avx2(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len) {
+  __m256i lo, hi;
+
+  blake2cf_compress(st, block, t, final, &lo, &hi);
+  if (len == BLAKE2CF_STATESIZE) {
+    _mm256_storeu_si256((__m256i *)out + 0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)in + 0), lo));
+    _mm256_storeu_si256((__m256i *)out + 1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)in + 1), hi));
+  }
+  else {
+    blake2cf_xor_state(st, out, in, len);
+  }
+}
+
+TARGET("avx2")
+void blake2cf_update_split_avx2(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in) {
+  long long int m[16];
+  __m256i lo, hi;
+
+  _mm256_storeu_si256((__m256i *)m + 0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)ad + 0), _mm256_loadu_si256((const __m256i *)key + 0)));
+  _mm256_storeu_si256((__m256i *)m + 1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)ad + 1), _mm256_loadu_si256((const __m256i *)key + 1)));
+  memcpy(m + 8, msg, BLAKE2CF_STATESIZE);
+
+  lo = _mm256_loadu_si256((const __m256i *)st + 0);
+  hi = _mm256_loadu_si256((const __m256i *)st + 1);
+  blake2cf_rounds(m, t, 0, &lo, &hi);
+  _mm256_storeu_si256((__m256i *)st + 0, lo);
+  _mm256_storeu_si256((__m256i *)st + 1, hi);
+
+  _mm256_storeu_si256((__m256i *)out + 0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)in + 0), lo));
+  _mm256_storeu_si256((__m256i *)out + 1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)in + 1), hi));
+}
+
+TARGET("avx2")
+void blake2cf_ets_bulk_avx2(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt) {
+  long long int m[16];
+  __m256i lo, hi, x0, x1, y0, y1;
+
+  memcpy(m, block, sizeof(m));
+  lo = _mm256_loadu_si256((const __m256i *)st + 0);
+  hi = _mm256_loadu_si256((const __m256i *)st + 1);
+
+  for ( ; nblocks > 0; nblocks--) {
+    blake2cf_rounds(m, t++, 0, &lo, &hi);
+    x0 = _mm256_loadu_si256((const __m256i *)in + 0);
+    x1 = _mm256_loadu_si256((const __m256i *)in + 1);
+    y0 = _mm256_xor_si256(x0, lo);
+    y1 = _mm256_xor_si256(x1, hi);
+    _mm256_storeu_si256((__m256i *)out + 0, y0);
+    _mm256_storeu_si256((__m256i *)out + 1, y1);
+    _mm256_storeu_si256((__m256i *)(m + 8) + 0, decrypt ? y0 : x0);
+    _mm256_storeu_si256((__m256i *)(m + 8) + 1, decrypt ? y1 : x1);
+    in = (const uint8_t *)in + BLAKE2CF_STATESIZE;
+    out = (uint8_t *)out + BLAKE2CF_STATESIZE;
+  }
+
+  _mm256_storeu_si256((__m256i *)st + 0, lo);
+  _mm256_storeu_si256((__m256i *)st + 1, hi);
+  memcpy((uint8_t *)block + BLAKE2CF_BLOCKSIZE - BLAKE2CF_STATESIZE, m + 8, BLAKE2CF_STATESIZE);
+}
+
+/*
+  Multi-buffer compression of four independent blocks, one per 64-bit lane: v[i] holds word i of the working
+  state of all four lanes, so that the G function works on whole registers and needs no diagonalization.
+  State and message words are brought into this layout by 4x4 transposes.
+*/
+
+#define TRANSPOSE4(r0, r1, r2, r3) do {                                 \
+    __m256i t0 = _mm256_unpacklo_epi64(r0, r1);                         \
+    __m256i t1 = _mm256_unpackhi_epi64(r0, r1);                         \
+    __m256i t2 = _mm256_unpacklo_epi64(r2, r3);                         \
+    __m256i t3 = _mm256_unpackhi_epi64(r2, r3);                         \
+    r0 = _mm256_permute2x128_si256(t0, t2, 0x20);                       \
+    r1 = _mm256_permute2x128_si256(t1, t3, 0x20);                       \
+    r2 = _mm256_permute2x128_si256(t0, t2, 0x31);                       \
+    r3 = _mm256_permute2x128_si256(t1, t3, 0x31);                       \
+  } while (0)
+
+#define GV(a, b, c, d, x, y) do {                                       \
+    v[a] = _mm256_add_epi64(_mm256_add_epi64(v[a], v[b]), mv[x]);       \
+    v[d] = ROT32(_mm256_xor_si256(v[d], v[a]));                         \
+    v[c] = _mm256_add_epi64(v[c], v[d]);                                \
+    v[b] = ROT24(_mm256_xor_si256(v[b], v[c]));                         \
+    v[a] = _mm256_add_epi64(_mm256_add_epi64(v[a], v[b]), mv[y]);       \
+    v[d] = ROT16(_mm256_xor_si256(v[d], v[a]));                         \
+    v[c] = _mm256_add_epi64(v[c], v[d]);                                \
+    v[b] = ROT63(_mm256_xor_si256(v[b], v[c]));                         \
+  } while (0)
+
+#define ROUND_X(r) do {                                                 \
+    GV(0, 4,  8, 12, blake2cf_sigma[r][ 0], blake2cf_sigma[r][ 1]);     \
+    GV(1, 5,  9, 13, blake2cf_sigma[r][ 2], blake2cf_sigma[r][ 3]);     \
+    GV(2, 6, 10, 14, blake2cf_sigma[r][ 4], blake2cf_sigma[r][ 5]);     \
+    GV(3, 7, 11, 15, blake2cf_sigma[r][ 6], blake2cf_sigma[r][ 7]);     \
+    GV(0, 5, 10, 15, blake2cf_sigma[r][ 8], blake2cf_sigma[r][ 9]);     \
+    GV(1, 6, 11, 12, blake2cf_sigma[r][10], blake2cf_sigma[r][11]);     \
+    GV(2, 7,  8, 13, blake2cf_sigma[r][12], blake2cf_sigma[r][13]);     \
+    GV(3, 4,  9, 14, blake2cf_sigma[r][14], blake2cf_sigma[r][15]);     \
+  } while (0)
+
+TARGET("avx2")
+void blake2cf_update_x4_avx2(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]) {
+  const __m256i r24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                       3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+  const __m256i r16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                       2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+  __m256i h[8], v[16], mv[16];
+  int i, j;
+
+  for (i = 0; i < 16; i += 4) {
+    for (j = 0; j < 4; j++) {
+      mv[i + j] = _mm256_loadu_si256((const __m256i *)((const uint64_t *)block[j] + i));
+    }
+    TRANSPOSE4(mv[i + 0], mv[i + 1], mv[i + 2], mv[i + 3]);
+  }
+  for (i = 0; i < 8; i += 4) {
+    for (j = 0; j < 4; j++) {
+      h[i + j] = _mm256_loadu_si256((const __m256i *)((const uint64_t *)st[j] + i));
+    }
+    TRANSPOSE4(h[i + 0], h[i + 1], h[i + 2], h[i + 3]);
+  }
+
+  for (i = 0; i < 8; i++) {
+    v[i] = h[i];
+    v[8 + i] = _mm256_set1_epi64x((long long int)blake2cf_iv[i]);
+  }
+  v[12] = _mm256_xor_si256(v[12], _mm256_set_epi64x((long long int)t[3], (long long int)t[2], (long long int)t[1], (long long int)t[0]));
+  v[14] = _mm256_xor_si256(v[14], _mm256_set_epi64x(final[3] ? -1LL : 0, final[2] ? -1LL : 0, final[1] ? -1LL : 0, final[0] ? -1LL : 0));
+
+  ROUND_X(0); ROUND_X(1); ROUND_X(2); ROUND_X(3);
+  ROUND_X(4); ROUND_X(5); ROUND_X(6); ROUND_X(7);
+  ROUND_X(8); ROUND_X(9); ROUND_X(10); ROUND_X(11);
+
+  for (i = 0; i < 8; i++) {
+    h[i] = _mm256_xor_si256(h[i], _mm256_xor_si256(v[i], v[8 + i]));
+  }
+  for (i = 0; i < 8; i += 4) {
+    TRANSPOSE4(h[i + 0], h[i + 1], h[i + 2], h[i + 3]);
+    for (j = 0; j < 4; j++) {
+      _mm256_storeu_si256((__m256i *)((uint64_t *)st[j] + i), h[i + j]);
+    }
+  }
+}
+
+/* eight lanes as two halves of four */
+TARGET("avx2")
+void blake2cf_update_x8_avx2(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]) {
+  blake2cf_update_x4_avx2(st + 0, block + 0, t + 0, final + 0);
+  blake2cf_update_x4_avx2(st + 4, block + 4, t + 4, final + 4);
+}
+
+#endif /* HAVE_X86_SIMD */
@@ -0,0 +1,262 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "blake2cf.h"
+#include "blake2cf_impl.h"
+
+#if HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+  same structure as blake2cf_avx2.c; AVX-512VL adds native 64-bit rotations (vprorq),
+  which replace the shuffle and shift/add emulations of the AVX2 kernel.
+*/
+
+#define ROT32(x) _mm256_ror_epi64((x), 32)
+#define ROT24(x) _mm256_ror_epi64((x), 24)
+#define ROT16(x) _mm256_ror_epi64((x), 16)
+#define ROT63(x) _mm256_ror_epi64((x), 63)
+
+#define LOAD_MSG(r, i) _mm256_set_epi64x(m[blake2cf_sigma[r][(i) + 6]], m[blake2cf_sigma[r][(i) + 4]], \
+                                         m[blake2cf_sigma[r][(i) + 2]], m[blake2cf_sigma[r][(i) + 0]])
+
+#define G(a, b, c, d, mx, my) do {                                      \
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), mx);                   \
+    d = ROT32(_mm256_xor_si256(d, a));                                  \
+    c = _mm256_add_epi64(c, d);                                         \
+    b = ROT24(_mm256_xor_si256(b, c));                                  \
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), my);                   \
+    d = ROT16(_mm256_xor_si256(d, a));                                  \
+    c = _mm256_add_epi64(c, d);                                         \
+    b = ROT63(_mm256_xor_si256(b, c));                                  \
+  } while (0)
+
+#define DIAGONALIZE(b, c, d) do {                                       \
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));           \
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));           \
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));           \
+  } while (0)
+
+#define UNDIAGONALIZE(b, c, d) do {                                     \
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));           \
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));           \
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));           \
+  } while (0)
+
+#define ROUND(r) do {                                                   \
+    G(a, b, c, d, LOAD_MSG(r, 0), LOAD_MSG(r, 1));                      \
+    DIAGONALIZE(b, c, d);                                               \
+    G(a, b, c, d, LOAD_MSG(r, 8), LOAD_MSG(r, 9));                      \
+    UNDIAGONALIZE(b, c, d);                                             \
+  } while (0)
+
+TARGET("avx2,avx512f,avx512vl")
+static inline void blake2cf_rounds(const long long int *m, unsigned long long int t, int final, __m256i *lo, __m256i *hi) {
+  __m256i a, b, c, d;
+
+  a = *lo;
+  b = *hi;
+  c = _mm256_loadu_si256((const __m256i *)(blake2cf_iv + 0));
+  d = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(blake2cf_iv + 4)),
+                       _mm256_set_epi64x(0, final ? -1LL : 0, 0, (long long int)t));
+
+  ROUND(0); ROUND(1); ROUND(2); ROUND(3);
+  ROUND(4); ROUND(5); ROUND(6); ROUND(7);
+  ROUND(8); ROUND(9); ROUND(10); ROUND(11);
+
+  *lo = _mm256_xor_si256(*lo, _mm256_xor_si256(a, c));
+  *hi = _mm256_xor_si256(*hi, _mm256_xor_si256(b, d));
+}
+
+TARGET("avx2,avx512f,avx512vl")
+static inline void blake2cf_compress(uint64_t *st, const void *block, unsigned long long int t, int final, __m256i *lo, __m256i *hi) {
+  long long int m[16];
+
+  memcpy(m, block, sizeof(m));
+
+  *lo = _mm256_loadu_si256((const __m256i *)(st + 0));
+  *hi = _mm256_loadu_si256((const __m256i *)(st + 4));
+  blake2cf_rounds(m, t, final, lo, hi);
+  _mm256_storeu_si256((__m256i *)(st + 0), *lo);
+  _mm256_storeu_si256((__m256i *)(st + 4), *hi);
+}
+
+TARGET("avx2,avx512f,avx512vl")
+void blake2cf_update_avx512(void *st, const void *block, unsigned long long int t, int final) {
+  __m256i lo, hi;
+
+  blake2cf_compress(st, block, t, final, &lo, &hi);
+}
+
+TARGET("avx2,avx512f,avx512vl")
+void blake2cf_update_xor_avx512(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len) {
+  __m256i lo, hi;
+
+  blake2cf_compress(st, block, t, final, &lo, &hi);
+  if (len == BLAKE2CF_STATESIZE) {
+    _mm256_storeu_si256((__m256i *)out + 0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)in + 0), lo));
+    _mm256_storeu_si256((__m256i *)out + 1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)in + 1), hi));
+  }
+  else {
+    blake2cf_xor_state(st, out, in, len);
+  }
+}
+
+TARGET("avx2,avx512f,avx512vl")
+void blake2cf_update_split_avx512(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in) {
+  long long int m[16];
+  __m256i lo, hi;
+
+  _mm256_storeu_si256((__m256i *)m + 0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)ad + 0), _mm256_loadu_si256((const __m256i *)key + 0)));
+  _mm256_storeu_si256((__m256i *)m + 1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)ad + 1), _mm256_loadu_si256((const __m256i *)key + 1)));
+  memcpy(m + 8, msg, BLAKE2CF_STATESIZE);
+
+  lo = _mm256_loadu_si256((const __m256i *)st + 0);
+  hi = _mm256_loadu_si256((const __m256i *)st + 1);
+  blake2cf_rounds(m, t, 0, &lo, &hi);
+  _mm256_storeu_si256((__m256i *)st + 0, lo);
+  _mm256_storeu_si256((__m256i *)st + 1, hi);
+
+  _mm256_storeu_si256((__m256i *)out + 0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)in + 0), lo));
+  _mm256_storeu_si256((__m256i *)out + 1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)in + 1), hi));
+}
+
+TARGET("avx2,avx512f,avx512vl")
+void blake2cf_ets_bulk_avx512(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt) {
+  long long int m[16];
+  __m256i lo, hi, x0, x1, y0, y1;
+
+  memcpy(m, block, sizeof(m));
+  lo = _mm256_loadu_si256((const __m256i *)st + 0);
+  hi = _mm256_loadu_si256((const __m256i *)st + 1);
+
+  for ( ; nblocks > 0; nblocks--) {
+    blake2cf_rounds(m, t++, 0, &lo, &hi);
+    x0 = _mm256_loadu_si256((const __m256i *)in + 0);
+    x1 = _mm256_loadu_si256((const __m256i *)in + 1);
+    y0 = _mm256_xor_si256(x0, lo);
+    y1 = _mm256_xor_si256(x1, hi);
+    _mm256_storeu_si256((__m256i *)out + 0, y0);
+    _mm256_storeu_si256((__m256i *)out + 1, y1);
+    _mm256_storeu_si256((__m256i *)(m + 8) + 0, decrypt ? y0 : x0);
+    _mm256_storeu_si256((__m256i *)(m + 8) + 1, decrypt ? y1 : x1);
+    in = (const uint8_t *)in + BLAKE2CF_STATESIZE;
+    out = (uint8_t *)out + BLAKE2CF_STATESIZE;
+  }
+
+  _mm256_storeu_si256((__m256i *)st + 0, lo);
+  _mm256_storeu_si256((__m256i *)st + 1, hi);
+  memcpy((uint8_t *)block + BLAKE2CF_BLOCKSIZE - BLAKE2CF_STATESIZE, m + 8, BLAKE2CF_STATESIZE);
+}
+
+/*
+  Multi-buffer compression of eight independent blocks, one per 64-bit lane of the 512-bit registers
+  (see blake2cf_update_x4_avx2); with 32 registers the whole working state stays in registers.
+*/
+
+#define ROTZ(x, n) _mm512_ror_epi64((x), (n))
+
+#define TRANSPOSE8(r0, r1, r2, r3, r4, r5, r6, r7) do {                 \
+    __m512i t0 = _mm512_unpacklo_epi64(r0, r1);                         \
+    __m512i t1 = _mm512_unpackhi_epi64(r0, r1);                         \
+    __m512i t2 = _mm512_unpacklo_epi64(r2, r3);                         \
+    __m512i t3 = _mm512_unpackhi_epi64(r2, r3);                         \
+    __m512i t4 = _mm512_unpacklo_epi64(r4, r5);                         \
+    __m512i t5 = _mm512_unpackhi_epi64(r4, r5);                         \
+    __m512i t6 = _mm512_unpacklo_epi64(r6, r7);                         \
+    __m512i t7 = _mm512_unpackhi_epi64(r6, r7);                         \
+    __m512i u0 = _mm512_shuffle_i64x2(t0, t2, 0x88);                    \
+    __m512i u1 = _mm512_shuffle_i64x2(t0, t2, 0xdd);                    \
+    __m512i u2 = _mm512_shuffle_i64x2(t1, t3, 0x88);                    \
+    __m512i u3 = _mm512_shuffle_i64x2(t1, t3, 0xdd);                    \
+    __m512i u4 = _mm512_shuffle_i64x2(t4, t6, 0x88);                    \
+    __m512i u5 = _mm512_shuffle_i64x2(t4, t6, 0xdd);                    \
+    __m512i u6 = _mm512_shuffle_i64x2(t5, t7, 0x88);                    \
+    __m512i u7 = _mm512_shuffle_i64x2(t5, t7, 0xdd);                    \
+    r0 = _mm512_shuffle_i64x2(u0, u4, 0x88);                            \
+    r4 = _mm512_shuffle_i64x2(u0, u4, 0xdd);                            \
+    r2 = _mm512_shuffle_i64x2(u1, u5, 0x88);                            \
+    r6 = _mm512_shuffle_i64x2(u1, u5, 0xdd);                            \
+    r1 = _mm512_shuffle_i64x2(u2, u6, 0x88);                            \
+    r5 = _mm512_shuffle_i64x2(u2, u6, 0xdd);                            \
+    r3 = _mm512_shuffle_i64x2(u3, u7, 0x88);                            \
+    r7 = _mm512_shuffle_i64x2(u3, u7, 0xdd);                            \
+  } while (0)
+
+#define GZ(a, b, c, d, x, y) do {                                       \
+    v[a] = _mm512_add_epi64(_mm512_add_epi64(v[a], v[b]), mv[x]);       \
+    v[d] = ROTZ(_mm512_xor_si512(v[d], v[a]), 32);                      \
+    v[c] = _mm512_add_epi64(v[c], v[d]);                                \
+    v[b] = ROTZ(_mm512_xor_si512(v[b], v[c]), 24);                      \
+    v[a] = _mm512_add_epi64(_mm512_add_epi64(v[a], v[b]), mv[y]);       \
+    v[d] = ROTZ(_mm512_xor_si512(v[d], v[a]), 16);                      \
+    v[c] = _mm512_add_epi64(v[c], v[d]);                                \
+    v[b] = ROTZ(_mm512_xor_si512(v[b], v[c]), 63);                      \
+  } while (0)
+
+#define ROUND_Z(r) do {                                                 \
+    GZ(0, 4,  8, 12, blake2cf_sigma[r][ 0], blake2cf_sigma[r][ 1]);     \
+    GZ(1, 5,  9, 13, blake2cf_sigma[r][ 2], blake2cf_sigma[r][ 3]);     \
+    GZ(2, 6, 10, 14, blake2cf_sigma[r][ 4], blake2cf_sigma[r][ 5]);     \
+    GZ(3, 7, 11, 15, blake2cf_sigma[r][ 6], blake2cf_sigma[r][ 7]);     \
+    GZ(0, 5, 10, 15, blake2cf_sigma[r][ 8], blake2cf_sigma[r][ 9]);     \
+    GZ(1, 6, 11, 12, blake2cf_sigma[r][10], blake2cf_sigma[r][11]);     \
+    GZ(2, 7,  8, 13, blake2cf_sigma[r][12], blake2cf_sigma[r][13]);     \
+    GZ(3, 4,  9, 14, blake2cf_sigma[r][14], blake2cf_sigma[r][15]);     \
+  } while (0)
+
+TARGET("avx2,avx512f,avx512vl")
+void blake2cf_update_x8_avx512(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]) {
+  __m512i h[8], v[16], mv[16], x;
+  int i, j;
+
+  for (i = 0; i < 16; i += 8) {
+    for (j = 0; j < 8; j++) {
+      mv[i + j] = _mm512_loadu_si512((const uint64_t *)block[j] + i);
+    }
+    TRANSPOSE8(mv[i + 0], mv[i + 1], mv[i + 2], mv[i + 3], mv[i + 4], mv[i + 5], mv[i + 6], mv[i + 7]);
+  }
+  for (j = 0; j < 8; j++) {
+    h[j] = _mm512_loadu_si512(st[j]);
+  }
+  TRANSPOSE8(h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7]);
+
+  for (i = 0; i < 8; i++) {
+    v[i] = h[i];
+    v[8 + i] = _mm512_set1_epi64((long long int)blake2cf_iv[i]);
+  }
+  v[12] = _mm512_xor_si512(v[12], _mm512_loadu_si512(t));
+  x = _mm512_set_epi64(final[7] ? -1LL : 0, final[6] ? -1LL : 0, final[5] ? -1LL : 0, final[4] ? -1LL : 0,
+                       final[3] ? -1LL : 0, final[2] ? -1LL : 0, final[1] ? -1LL : 0, final[0] ? -1LL : 0);
+  v[14] = _mm512_xor_si512(v[14], x);
+
+  ROUND_Z(0); ROUND_Z(1); ROUND_Z(2); ROUND_Z(3);
+  ROUND_Z(4); ROUND_Z(5); ROUND_Z(6); ROUND_Z(7);
+  ROUND_Z(8); ROUND_Z(9); ROUND_Z(10); ROUND_Z(11);
+
+  for (i = 0; i < 8; i++) {
+    h[i] = _mm512_xor_si512(h[i], _mm512_xor_si512(v[i], v[8 + i]));
+  }
+  TRANSPOSE8(h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7]);
+  for (j = 0; j < 8; j++) {
+    _mm512_storeu_si512(st[j], h[j]);
+  }
+}
+
+#endif /* HAVE_X86_SIMD */
@@ -0,0 +1,107 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef BLAKE2CF_IMPL_H
+#define BLAKE2CF_IMPL_H
+
+/* internal header, shared by the scalar and the vectorized implementations of blake2cf_update */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+static const uint64_t blake2cf_iv[8] = {
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+/* all 12 rounds spelled out (rounds 11 and 12 repeat rounds 1 and 2), so that kernels can index by round number */
+static const uint8_t blake2cf_sigma[12][16] = {
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+  { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+  {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+  {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+  {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+  { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+  { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+  {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+  { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+};
+
+typedef void (*blake2cf_update_fn)(void *st, const void *block, unsigned long long int t, int final);
+typedef void (*blake2cf_update_xor_fn)(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len);
+typedef void (*blake2cf_update_split_fn)(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in);
+typedef void (*blake2cf_ets_bulk_fn)(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt);
+typedef void (*blake2cf_update_xn_fn)(void *const *st, const void *const *block, const unsigned long long int *t, const int *final);
+
+struct blake2cf_kernel {
+  const char *name;
+  unsigned int features; /* required CPU features, see cpu.h */
+  blake2cf_update_fn update;
+  blake2cf_update_xor_fn update_xor;
+  blake2cf_update_split_fn update_split;
+  blake2cf_ets_bulk_fn ets_bulk;
+  blake2cf_update_xn_fn update_x2;
+  blake2cf_update_xn_fn update_x3;
+  blake2cf_update_xn_fn update_x4;
+  blake2cf_update_xn_fn update_x8;
+  size_t lanes_maxlen; /* longest ETS record (AD and message) on which the multi-buffer kernels beat the single-record code, SIZE_MAX: all, 0: none */
+};
+
+/* best kernel first, terminated by the portable reference code (features == 0) */
+extern const struct blake2cf_kernel blake2cf_kernels[];
+
+/* name of the kernel blake2cf_update is bound to, for display only */
+const char *blake2cf_backend(void);
+
+/* lanes_maxlen of that kernel, by which the batch functions decide between the lanes and the single-record code */
+size_t blake2cf_lanes_maxlen(void);
+
+/* out = in XOR (first len bytes of the little-endian encoding of st); the partial-block tail of the fused kernels */
+static inline void blake2cf_xor_state(const uint64_t *st, uint8_t *out, const uint8_t *in, size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    out[i] = in[i] ^ (uint8_t)(st[i / 8] >> (8 * (i % 8)));
+  }
+}
+
+#if HAVE_X86_SIMD
+/* same contracts as blake2cf_update(_xor/_split/_x2/_x3/_x4/_x8) and blake2cf_ets_bulk; callers have to make sure the CPU supports the respective instruction set */
+void blake2cf_update_ssse3(void *st, const void *block, unsigned long long int t, int final);
+void blake2cf_update_xor_ssse3(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len);
+void blake2cf_update_split_ssse3(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in);
+void blake2cf_ets_bulk_ssse3(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt);
+void blake2cf_update_x2_ssse3(void *const st[2], const void *const block[2], const unsigned long long int t[2], const int final[2]);
+void blake2cf_update_x3_ssse3(void *const st[3], const void *const block[3], const unsigned long long int t[3], const int final[3]);
+void blake2cf_update_x4_ssse3(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]);
+void blake2cf_update_x8_ssse3(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]);
+void blake2cf_update_avx2(void *st, const void *block, unsigned long long int t, int final);
+void blake2cf_update_xor_avx2(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len);
+void blake2cf_update_split_avx2(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in);
+void blake2cf_ets_bulk_avx2(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt);
+void blake2cf_update_x4_avx2(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]);
+void blake2cf_update_x8_avx2(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]);
+void blake2cf_update_avx512(void *st, const void *block, unsigned long long int t, int final);
+void blake2cf_update_xor_avx512(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len);
+void blake2cf_update_split_avx512(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in);
+void blake2cf_ets_bulk_avx512(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt);
+void blake2cf_update_x8_avx512(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]);
+#endif
+
+#endif /* BLAKE2CF_IMPL_H */
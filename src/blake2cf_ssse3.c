@@ -0,0 +1,277 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "blake2cf.h"
+#include "blake2cf_impl.h"
+
+#if HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+  BLAKE2b compression with each row of the 4x4 state matrix split into a low and a high 128-bit half;
+  the diagonal step is reduced to a column step by rotating rows 2, 3, 4 with palignr.
+*/
+
+#define ROT32(x) _mm_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define ROT24(x) _mm_shuffle_epi8((x), r24)
+#define ROT16(x) _mm_shuffle_epi8((x), r16)
+#define ROT63(x) _mm_xor_si128(_mm_srli_epi64((x), 63), _mm_add_epi64((x), (x)))
+
+#define LOAD_MSG(r, i) _mm_set_epi64x(m[blake2cf_sigma[r][(i) + 2]], m[blake2cf_sigma[r][(i) + 0]])
+
+#define G_HALF(a, b, c, d, mx, my) do {                                 \
+    a = _mm_add_epi64(_mm_add_epi64(a, b), mx);                         \
+    d = ROT32(_mm_xor_si128(d, a));                                     \
+    c = _mm_add_epi64(c, d);                                            \
+    b = ROT24(_mm_xor_si128(b, c));                                     \
+    a = _mm_add_epi64(_mm_add_epi64(a, b), my);                         \
+    d = ROT16(_mm_xor_si128(d, a));                                     \
+    c = _mm_add_epi64(c, d);                                            \
+    b = ROT63(_mm_xor_si128(b, c));                                     \
+  } while (0)
+
+#define DIAGONALIZE do {                                                \
+    t0 = _mm_alignr_epi8(bh, bl, 8);                                    \
+    t1 = _mm_alignr_epi8(bl, bh, 8);                                    \
+    bl = t0, bh = t1;                                                   \
+    t0 = cl, cl = ch, ch = t0;                                          \
+    t0 = _mm_alignr_epi8(dh, dl, 8);                                    \
+    t1 = _mm_alignr_epi8(dl, dh, 8);                                    \
+    dl = t1, dh = t0;                                                   \
+  } while (0)
+
+#define UNDIAGONALIZE do {                                              \
+    t0 = _mm_alignr_epi8(bl, bh, 8);                                    \
+    t1 = _mm_alignr_epi8(bh, bl, 8);                                    \
+    bl = t0, bh = t1;                                                   \
+    t0 = cl, cl = ch, ch = t0;                                          \
+    t0 = _mm_alignr_epi8(dl, dh, 8);                                    \
+    t1 = _mm_alignr_epi8(dh, dl, 8);                                    \
+    dl = t1, dh = t0;                                                   \
+  } while (0)
+
+#define ROUND(r) do {                                                   \
+    G_HALF(al, bl, cl, dl, LOAD_MSG(r, 0), LOAD_MSG(r, 1));             \
+    G_HALF(ah, bh, ch, dh, LOAD_MSG(r, 4), LOAD_MSG(r, 5));             \
+    DIAGONALIZE;                                                        \
+    G_HALF(al, bl, cl, dl, LOAD_MSG(r, 8), LOAD_MSG(r, 9));             \
+    G_HALF(ah, bh, ch, dh, LOAD_MSG(r, 12), LOAD_MSG(r, 13));           \
+    UNDIAGONALIZE;                                                      \
+  } while (0)
+
+TARGET("ssse3")
+static inline void blake2cf_rounds(const long long int *m, unsigned long long int t, int final, __m128i s[4]) {
+  const __m128i r24 = _mm_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+  const __m128i r16 = _mm_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+  __m128i al, ah, bl, bh, cl, ch, dl, dh, t0, t1;
+
+  al = s[0];
+  ah = s[1];
+  bl = s[2];
+  bh = s[3];
+  cl = _mm_loadu_si128((const __m128i *)(blake2cf_iv + 0));
+  ch = _mm_loadu_si128((const __m128i *)(blake2cf_iv + 2));
+  dl = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(blake2cf_iv + 4)), _mm_set_epi64x(0, (long long int)t));
+  dh = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(blake2cf_iv + 6)), _mm_set_epi64x(0, final ? -1LL : 0));
+
+  ROUND(0); ROUND(1); ROUND(2); ROUND(3);
+  ROUND(4); ROUND(5); ROUND(6); ROUND(7);
+  ROUND(8); ROUND(9); ROUND(10); ROUND(11);
+
+  s[0] = _mm_xor_si128(s[0], _mm_xor_si128(al, cl));
+  s[1] = _mm_xor_si128(s[1], _mm_xor_si128(ah, ch));
+  s[2] = _mm_xor_si128(s[2], _mm_xor_si128(bl, dl));
+  s[3] = _mm_xor_si128(s[3], _mm_xor_si128(bh, dh));
+}
+
+TARGET("ssse3")
+static inline void blake2cf_compress(uint64_t *st, const void *block, unsigned long long int t, int final, __m128i s[4]) {
+  long long int m[16];
+  int i;
+
+  memcpy(m, block, sizeof(m));
+
+  for (i = 0; i < 4; i++) {
+    s[i] = _mm_loadu_si128((const __m128i *)st + i);
+  }
+  blake2cf_rounds(m, t, final, s);
+  for (i = 0; i < 4; i++) {
+    _mm_storeu_si128((__m128i *)st + i, s[i]);
+  }
+}
+
+TARGET("ssse3")
+void blake2cf_update_ssse3(void *st, const void *block, unsigned long long int t, int final) {
+  __m128i s[4];
+
+  blake2cf_compress(st, block, t, final, s);
+}
+
+TARGET("ssse3")
+void blake2cf_update_xor_ssse3(void *st, const void *block, unsigned long long int t, int final, void *out, const void *in, size_t len) {
+  __m128i s[4];
+  int i;
+
+  blake2cf_compress(st, block, t, final, s);
+  if (len == BLAKE2CF_STATESIZE) {
+    for (i = 0; i < 4; i++) {
+      _mm_storeu_si128((__m128i *)out + i, _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + i), s[i]));
+    }
+  }
+  else {
+    blake2cf_xor_state(st, out, in, len);
+  }
+}
+
+TARGET("ssse3")
+void blake2cf_update_split_ssse3(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in) {
+  long long int m[16];
+  __m128i s[4];
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    _mm_storeu_si128((__m128i *)m + i, _mm_xor_si128(_mm_loadu_si128((const __m128i *)ad + i), _mm_loadu_si128((const __m128i *)key + i)));
+  }
+  memcpy(m + 8, msg, BLAKE2CF_STATESIZE);
+
+  for (i = 0; i < 4; i++) {
+    s[i] = _mm_loadu_si128((const __m128i *)st + i);
+  }
+  blake2cf_rounds(m, t, 0, s);
+  for (i = 0; i < 4; i++) {
+    _mm_storeu_si128((__m128i *)st + i, s[i]);
+    _mm_storeu_si128((__m128i *)out + i, _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + i), s[i]));
+  }
+}
+
+TARGET("ssse3")
+void blake2cf_ets_bulk_ssse3(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt) {
+  long long int m[16];
+  __m128i s[4], x, y;
+  int i;
+
+  memcpy(m, block, sizeof(m));
+  for (i = 0; i < 4; i++) {
+    s[i] = _mm_loadu_si128((const __m128i *)st + i);
+  }
+
+  for ( ; nblocks > 0; nblocks--) {
+    blake2cf_rounds(m, t++, 0, s);
+    for (i = 0; i < 4; i++) {
+      x = _mm_loadu_si128((const __m128i *)in + i);
+      y = _mm_xor_si128(x, s[i]);
+      _mm_storeu_si128((__m128i *)out + i, y);
+      _mm_storeu_si128((__m128i *)(m + 8) + i, decrypt ? y : x);
+    }
+    in = (const uint8_t *)in + BLAKE2CF_STATESIZE;
+    out = (uint8_t *)out + BLAKE2CF_STATESIZE;
+  }
+
+  for (i = 0; i < 4; i++) {
+    _mm_storeu_si128((__m128i *)st + i, s[i]);
+  }
+  memcpy((uint8_t *)block + BLAKE2CF_BLOCKSIZE - BLAKE2CF_STATESIZE, m + 8, BLAKE2CF_STATESIZE);
+}
+
+/*
+  Two records side by side, one per 64-bit lane: v[i] holds word i of both states, so each instruction advances
+  both records and the diagonal step needs no shuffles.
+*/
+
+#define G_X2(r, i, a, b, c, d) do {                                     \
+    v[a] = _mm_add_epi64(_mm_add_epi64(v[a], v[b]), mv[blake2cf_sigma[r][2 * (i) + 0]]); \
+    v[d] = ROT32(_mm_xor_si128(v[d], v[a]));                            \
+    v[c] = _mm_add_epi64(v[c], v[d]);                                   \
+    v[b] = ROT24(_mm_xor_si128(v[b], v[c]));                            \
+    v[a] = _mm_add_epi64(_mm_add_epi64(v[a], v[b]), mv[blake2cf_sigma[r][2 * (i) + 1]]); \
+    v[d] = ROT16(_mm_xor_si128(v[d], v[a]));                            \
+    v[c] = _mm_add_epi64(v[c], v[d]);                                   \
+    v[b] = ROT63(_mm_xor_si128(v[b], v[c]));                            \
+  } while (0)
+
+#define ROUND_X2(r) do {                                                \
+    G_X2(r, 0,  0,  4,  8, 12);                                         \
+    G_X2(r, 1,  1,  5,  9, 13);                                         \
+    G_X2(r, 2,  2,  6, 10, 14);                                         \
+    G_X2(r, 3,  3,  7, 11, 15);                                         \
+    G_X2(r, 4,  0,  5, 10, 15);                                         \
+    G_X2(r, 5,  1,  6, 11, 12);                                         \
+    G_X2(r, 6,  2,  7,  8, 13);                                         \
+    G_X2(r, 7,  3,  4,  9, 14);                                         \
+  } while (0)
+
+TARGET("ssse3")
+void blake2cf_update_x2_ssse3(void *const st[2], const void *const block[2], const unsigned long long int t[2], const int final[2]) {
+  const __m128i r24 = _mm_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+  const __m128i r16 = _mm_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+  __m128i v[16], mv[16], x, y;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    x = _mm_loadu_si128((const __m128i *)block[0] + i);
+    y = _mm_loadu_si128((const __m128i *)block[1] + i);
+    mv[2 * i + 0] = _mm_unpacklo_epi64(x, y);
+    mv[2 * i + 1] = _mm_unpackhi_epi64(x, y);
+  }
+  for (i = 0; i < 4; i++) {
+    x = _mm_loadu_si128((const __m128i *)st[0] + i);
+    y = _mm_loadu_si128((const __m128i *)st[1] + i);
+    v[2 * i + 0] = _mm_unpacklo_epi64(x, y);
+    v[2 * i + 1] = _mm_unpackhi_epi64(x, y);
+  }
+  for (i = 0; i < 8; i++) {
+    v[8 + i] = _mm_set1_epi64x((long long int)blake2cf_iv[i]);
+  }
+  v[12] = _mm_xor_si128(v[12], _mm_set_epi64x((long long int)t[1], (long long int)t[0]));
+  v[14] = _mm_xor_si128(v[14], _mm_set_epi64x(final[1] ? -1LL : 0, final[0] ? -1LL : 0));
+
+  ROUND_X2(0); ROUND_X2(1); ROUND_X2(2); ROUND_X2(3);
+  ROUND_X2(4); ROUND_X2(5); ROUND_X2(6); ROUND_X2(7);
+  ROUND_X2(8); ROUND_X2(9); ROUND_X2(10); ROUND_X2(11);
+
+  for (i = 0; i < 4; i++) {
+    x = _mm_xor_si128(v[2 * i + 0], v[8 + 2 * i + 0]);
+    y = _mm_xor_si128(v[2 * i + 1], v[8 + 2 * i + 1]);
+    _mm_storeu_si128((__m128i *)st[0] + i, _mm_xor_si128(_mm_loadu_si128((const __m128i *)st[0] + i), _mm_unpacklo_epi64(x, y)));
+    _mm_storeu_si128((__m128i *)st[1] + i, _mm_xor_si128(_mm_loadu_si128((const __m128i *)st[1] + i), _mm_unpackhi_epi64(x, y)));
+  }
+}
+
+TARGET("ssse3")
+void blake2cf_update_x3_ssse3(void *const st[3], const void *const block[3], const unsigned long long int t[3], const int final[3]) {
+  blake2cf_update_x2_ssse3(st, block, t, final);
+  blake2cf_update_ssse3(st[2], block[2], t[2], final[2]);
+}
+
+TARGET("ssse3")
+void blake2cf_update_x4_ssse3(void *const st[4], const void *const block[4], const unsigned long long int t[4], const int final[4]) {
+  blake2cf_update_x2_ssse3(st, block, t, final);
+  blake2cf_update_x2_ssse3(st + 2, block + 2, t + 2, final + 2);
+}
+
+TARGET("ssse3")
+void blake2cf_update_x8_ssse3(void *const st[8], const void *const block[8], const unsigned long long int t[8], const int final[8]) {
+  int j;
+
+  for (j = 0; j < 8; j += 2) {
+    blake2cf_update_x2_ssse3(st + j, block + j, t + j, final + j);
+  }
+}
+
+#endif /* HAVE_X86_SIMD */
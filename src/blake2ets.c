@@ -15,294 +15,252 @@
 */
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "blake2cf.h"
+#include "blake2cf_impl.h"
 #include "blake2ets.h"
+#include "ets.h"
 #include "memxor.h"
 
 #define C BLAKE2CF_STATESIZE /* 64 */
 #define D BLAKE2CF_BLOCKSIZE /* 128 */
+#define CF_MEMSTATESIZE BLAKE2CF_MEMSTATESIZE
+#define CF_KLEN_MAX 64 /* maximum blake2cf key length */
+#define ETS_LANES_MAX 8
+#define ETS(name) blake2ets_##name
+#define CF_ID 3
 
-#define assert(C) do { ; } while (! (C)) /* poor man's assert */
-
-_Static_assert(C <= D && C <= 256, "required by mode");
-
-/* round up to next multiple of 8 (for copy efficiency on 64-bit machines) */
-#define RUP_8(x) (((x) + 7) & ~0x07)
-
-#define MAV 16 /* memory alignment value (for even faster copies) */
-_Static_assert((MAV & (MAV - 1)) == 0, "memory alignment value not a power of two");
-
-#define RUP_MAV(x) (((x) + MAV - 1) & ~(MAV - 1)) /* round up to next multiple of MAV */
-
-_Static_assert(C == RUP_MAV(C) && D == RUP_MAV(D), "compression function shall work well with memory-aligned data");
-
-#define CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)            \
-  (                                                                     \
-   ((klen) >= 128 / 8 && (klen) <= (D - C) && (klen) == RUP_8(klen))    \
-   &&                                                                   \
-   ((klen) <= 64) /* maximum blake2cf key length */                     \
-   &&                                                                   \
-   ((clen) == (mlen))                                                   \
-   &&                                                                   \
-   ((taglen) >= 80 / 8 && (taglen) <= C)                                \
-  )
-
-#define AD_FINALIZER 0x80
-
-#define LOAD_AD_INTO_BLOCK(_len) do {                                   \
-    /* assert(! ad_padded); */                                          \
-    size_t len = (_len);                                                \
-    if (adlen >= len) {                                                 \
-      memcpy(block, ad, len);                                           \
-      ad += len, adlen -= len;                                          \
-    }                                                                   \
-    else /* if (0 <= adlen < len) */ {                                  \
-      memcpy(block, ad, adlen);                                         \
-      block[adlen] = AD_FINALIZER;                                      \
-      memset(block + adlen + 1, 0, len - adlen - 1);                    \
-      /* ad += adlen, adlen = 0; */                                     \
-      ad_padded = 1;                                                    \
-    }                                                                   \
-  } while (0)
-
-int blake2ets_enc(size_t klen, const void *k, size_t adlen, const void * _ad, size_t mlen, const void * _m, size_t clen, void * _c, size_t taglen, void *tag) {
-  const uint8_t *ad = _ad;
-  const uint8_t *m = _m;
-  uint8_t *c = _c;
-  uint8_t st[BLAKE2CF_MEMSTATESIZE];
-  uint8_t block[D], buf[C];
-  unsigned long long int t = 0;
-  int ad_padded = 0;
-  int m_padded = 0;
-  int default_ad_block = 0; /* (default_ad_block == 1) ==> (block[0..D-C-1] == zero-padded key) */
-  size_t mlen_rup;
-
-  if (! CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)) {
-    return -1;
-  }
+static inline void cf_init(void *st, size_t klen, size_t taglen) {
+  blake2cf_init(st, klen, taglen);
+}
 
-  if (mlen == 0) {
-    m_padded = 1;
-  }
+static inline void cf_update(void *st, const void *block, unsigned long long int t, int final) {
+  blake2cf_update(st, block, t, final);
+}
 
-  /* first block */
-  LOAD_AD_INTO_BLOCK(D);
-  memxor2(block, k, klen);
+static inline void cf_update_xor(void *st, const void *block, unsigned long long int t, void *out, const void *in, size_t len) {
+  blake2cf_update_xor(st, block, t, 0, out, in, len);
+}
 
-  blake2cf_init(st, klen, taglen);
+static inline void cf_update_split(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in) {
+  blake2cf_update_split(st, ad, key, msg, t, out, in);
+}
 
-  /* bulk message processing */
-  while (mlen >= C) {
-    blake2cf_update(st, block, t++, 0);
+static inline void cf_ets_bulk(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt) {
+  blake2cf_ets_bulk(st, block, t, out, in, nblocks, decrypt);
+}
 
-    if (! ad_padded) {
-      LOAD_AD_INTO_BLOCK(D - C);
-      memxor2(block, k, klen);
-    }
-    else /* if (ad_padded) */ {
-      if (! default_ad_block) {
-        memcpy(block, k, klen);
-        memset(block + klen, 0, D - C - klen);
-        default_ad_block = 1;
-      }
-    }
+static inline void cf_export(const void *st, void *out) {
+  blake2cf_export(st, out);
+}
 
-    blake2cf_export(st, buf);
-    memxor3(c, m, buf, C);
-    memcpy(block + D - C, m, C);
-    c += C, m += C, mlen -= C;
-  }
+static void cf_update_x2(void *const *st, const void *const *block, const unsigned long long int *t, const int *final) {
+  blake2cf_update_x2(st, block, t, final);
+}
 
-  /* in case a partial message block remains */
-  if (0 < mlen /* && mlen < C */) {
-    blake2cf_update(st, block, t++, 0);
+#include "ets_impl.h"
 
-    mlen_rup = RUP_MAV(mlen + 1); /* by mlen < C and C == RUP_MAV(C): mlen_rup <= C */
+int blake2ets_enc_x2(const size_t klen[2], const void *const k[2], const size_t adlen[2], const void *const ad[2], const size_t mlen[2], const void *const m[2], const size_t clen[2], void *const c[2], const size_t taglen[2], void *const tag[2]) {
+  return ets_enc_xn(2, blake2cf_update_x2, klen, k, adlen, ad, mlen, m, clen, c, taglen, tag);
+}
 
-    if (! ad_padded) {
-      LOAD_AD_INTO_BLOCK(D - mlen_rup);
-      memxor2(block, k, klen);
-    }
-    else /* if (ad_padded) */ {
-      if (default_ad_block) {
-        memset(block + D - C, 0, C - mlen_rup);
-      }
-      else /* if (! default_ad_block) */ {
-        memcpy(block, k, klen);
-        memset(block + klen, 0, D - mlen_rup - klen);
-        /* default_ad_block = 1; */
-      }
-    }
+int blake2ets_dec_x2(const size_t klen[2], const void *const k[2], const size_t adlen[2], const void *const ad[2], const size_t clen[2], const void *const c[2], const size_t taglen[2], const void *const tag[2], const size_t mlen[2], void *const m[2], int fail_if_invalid, int is_valid[2]) {
+  return ets_dec_xn(2, blake2cf_update_x2, klen, k, adlen, ad, clen, c, taglen, tag, mlen, m, fail_if_invalid, is_valid);
+}
 
-    blake2cf_export(st, buf);
-    memxor3(c, m, buf, mlen);
-    /* c += mlen; */
+int blake2ets_enc_x3(const size_t klen[3], const void *const k[3], const size_t adlen[3], const void *const ad[3], const size_t mlen[3], const void *const m[3], const size_t clen[3], void *const c[3], const size_t taglen[3], void *const tag[3]) {
+  return ets_enc_xn(3, blake2cf_update_x3, klen, k, adlen, ad, mlen, m, clen, c, taglen, tag);
+}
 
-    memcpy(block + D - mlen_rup, m, mlen);
-    memset(block + D - mlen_rup + mlen, 0, mlen_rup - mlen - 1);
-    block[D - 1] = mlen; /* requires C <= 256 (bytes) */
-    /* m += mlen, mlen = 0; */
-    m_padded = 1;
-  }
+int blake2ets_dec_x3(const size_t klen[3], const void *const k[3], const size_t adlen[3], const void *const ad[3], const size_t clen[3], const void *const c[3], const size_t taglen[3], const void *const tag[3], const size_t mlen[3], void *const m[3], int fail_if_invalid, int is_valid[3]) {
+  return ets_dec_xn(3, blake2cf_update_x3, klen, k, adlen, ad, clen, c, taglen, tag, mlen, m, fail_if_invalid, is_valid);
+}
 
-  if (! ad_padded && adlen > 0) {
-    blake2cf_update(st, block, t++, 1);
+int blake2ets_enc_x4(const size_t klen[4], const void *const k[4], const size_t adlen[4], const void *const ad[4], const size_t mlen[4], const void *const m[4], const size_t clen[4], void *const c[4], const size_t taglen[4], void *const tag[4]) {
+  return ets_enc_xn(4, blake2cf_update_x4, klen, k, adlen, ad, mlen, m, clen, c, taglen, tag);
+}
 
-    while (adlen > D) {
-      blake2cf_update(st, ad, t++, 0);
-      ad += D, adlen -= D;
-    }
-    /* assert(0 < adlen && adlen <= D); */
-    LOAD_AD_INTO_BLOCK(D);
-    /* assert(ad_padded || (! ad_padded && adlen == 0)); */
-  }
+int blake2ets_dec_x4(const size_t klen[4], const void *const k[4], const size_t adlen[4], const void *const ad[4], const size_t clen[4], const void *const c[4], const size_t taglen[4], const void *const tag[4], const size_t mlen[4], void *const m[4], int fail_if_invalid, int is_valid[4]) {
+  return ets_dec_xn(4, blake2cf_update_x4, klen, k, adlen, ad, clen, c, taglen, tag, mlen, m, fail_if_invalid, is_valid);
+}
 
-  if (m_padded) {
-    blake2cf_update(st, block, t++, 1);
-  }
-  else {
-    blake2cf_update(st, block, t++, 0);
-  }
+int blake2ets_enc_x8(const size_t klen[8], const void *const k[8], const size_t adlen[8], const void *const ad[8], const size_t mlen[8], const void *const m[8], const size_t clen[8], void *const c[8], const size_t taglen[8], void *const tag[8]) {
+  return ets_enc_xn(8, blake2cf_update_x8, klen, k, adlen, ad, mlen, m, clen, c, taglen, tag);
+}
 
-  blake2cf_export(st, buf);
-  /* blake2cf_clear(st); */
+int blake2ets_dec_x8(const size_t klen[8], const void *const k[8], const size_t adlen[8], const void *const ad[8], const size_t clen[8], const void *const c[8], const size_t taglen[8], const void *const tag[8], const size_t mlen[8], void *const m[8], int fail_if_invalid, int is_valid[8]) {
+  return ets_dec_xn(8, blake2cf_update_x8, klen, k, adlen, ad, clen, c, taglen, tag, mlen, m, fail_if_invalid, is_valid);
+}
 
-  if (ad_padded) {
-    unsigned int i;
-    for (i = 0; i < taglen; i++) {
-      buf[i] ^= 0xa5;
-    }
-  }
+/* the records on which the lanes pay off depend on the kernel, see blake2cf_kernels[] */
 
-  memcpy(tag, buf, taglen);
+int blake2ets_enc_batch(const struct ets_batch *batch) {
+  return ets_batch_run(batch, 0, 8, blake2cf_update_x8, blake2cf_lanes_maxlen()) ? -1 : 0;
+}
 
-  return 0;
+int blake2ets_dec_batch(const struct ets_batch *batch) {
+  return ets_batch_run(batch, 1, 8, blake2cf_update_x8, blake2cf_lanes_maxlen()) ? -1 : 0;
 }
 
-int blake2ets_dec(size_t klen, const void *k, size_t adlen, const void * _ad, size_t clen, const void * _c, size_t taglen, const void *tag, size_t mlen, void * _m, int fail_if_invalid, int *is_valid) {
-  const uint8_t *ad = _ad;
-  const uint8_t *c = _c;
-  uint8_t *m = _m;
-  uint8_t st[BLAKE2CF_MEMSTATESIZE];
-  uint8_t block[D], buf[C];
-  unsigned long long int t = 0;
-  int ad_padded = 0;
-  int m_padded = 0;
-  int default_ad_block = 0; /* (default_ad_block == 1) ==> (block[0..D-C-1] == zero-padded key) */
-  size_t mlen_rup;
-  int valid;
-
-  if (! CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)) {
-    return -1;
-  }
+/*
+  Multi-buffer manager: jobs enter a free lane as they are submitted, and a lane is refilled as soon as its record
+  is done, so that records of different lengths keep the lanes busy. Once fewer than half of the lanes are active,
+  flushing no longer pays for the idle lanes and finishes the records one by one with the single-record code.
+*/
+
+struct blake2ets_mb_mgr {
+  int n;
+  ets_update_xn update;
+  struct ets_lane lanes[8];
+  struct ets_mb_job *jobs[8]; /* (jobs[j] == NULL) ==> lane j is free */
+  uint64_t idle_st[BLAKE2CF_MEMSTATESIZE / 8], idle_block[D / 8]; /* word-aligned, as st and block of struct ets_lane */
+};
 
-  if (mlen == 0) {
-    m_padded = 1;
+struct blake2ets_mb_mgr *blake2ets_mb_create(int lanes) {
+  struct blake2ets_mb_mgr *mgr;
+  int j;
+
+  if (lanes != 4 && lanes != 8) {
+    return NULL;
   }
 
-  /* first block */
-  LOAD_AD_INTO_BLOCK(D);
-  memxor2(block, k, klen);
+  mgr = malloc(sizeof(*mgr));
+  if (mgr == NULL) {
+    return NULL;
+  }
+  memset(mgr, 0, sizeof(*mgr));
+  mgr->n = lanes;
+  mgr->update = (lanes == 4) ? blake2cf_update_x4 : blake2cf_update_x8;
+  for (j = 0; j < lanes; j++) {
+    mgr->lanes[j].phase = LANE_DONE;
+  }
 
-  blake2cf_init(st, klen, taglen);
+  return mgr;
+}
 
-  /* bulk ciphertext processing */
-  while (mlen >= C) {
-    blake2cf_update(st, block, t++, 0);
+void blake2ets_mb_destroy(struct blake2ets_mb_mgr *mgr) {
+  free(mgr);
+}
 
-    if (! ad_padded) {
-      LOAD_AD_INTO_BLOCK(D - C);
-      memxor2(block, k, klen);
-    }
-    else /* if (ad_padded) */ {
-      if (! default_ad_block) {
-        memcpy(block, k, klen);
-        memset(block + klen, 0, D - C - klen);
-        default_ad_block = 1;
-      }
-    }
+/* hand the finished job of lane j back to the caller */
+static struct ets_mb_job *blake2ets_mb_complete(struct blake2ets_mb_mgr *mgr, int j) {
+  struct ets_mb_job *job = mgr->jobs[j];
+  const struct ets_lane *l = &mgr->lanes[j];
 
-    blake2cf_export(st, buf);
-    memxor3(m, c, buf, C);
-    memcpy(block + D - C, m, C);
-    c += C, m += C, mlen -= C;
+  if (! job->decrypt) {
+    memcpy(job->tag, l->buf, job->taglen);
+    job->status = 0;
   }
+  else {
+    job->status = memcmp(l->buf, job->tag, job->taglen) ? -1 : 0; /* constant-time comparison not necessary */
+  }
+  mgr->jobs[j] = NULL;
 
-  /* in case a partial ciphertext block remains */
-  if (0 < mlen /* && mlen < C */) {
-    blake2cf_update(st, block, t++, 0);
+  return job;
+}
 
-    mlen_rup = RUP_MAV(mlen + 1); /* by mlen < C and C == RUP_MAV(C): mlen_rup <= C */
+/* lane holding a finished job, or -1 */
+static int blake2ets_mb_done(const struct blake2ets_mb_mgr *mgr) {
+  int j;
 
-    if (! ad_padded) {
-      LOAD_AD_INTO_BLOCK(D - mlen_rup);
-      memxor2(block, k, klen);
-    }
-    else /* if (ad_padded) */ {
-      if (default_ad_block) {
-        memset(block + D - C, 0, C - mlen_rup);
-      }
-      else /* if (! default_ad_block) */ {
-        memcpy(block, k, klen);
-        memset(block + klen, 0, D - mlen_rup - klen);
-        /* default_ad_block = 1; */
-      }
+  for (j = 0; j < mgr->n; j++) {
+    if (mgr->jobs[j] != NULL && mgr->lanes[j].phase == LANE_DONE) {
+      return j;
     }
+  }
+  return -1;
+}
 
-    blake2cf_export(st, buf);
-    memxor3(m, c, buf, mlen);
-    /* c += mlen; */
+/* compress side by side until a job is done, returns its lane */
+static int blake2ets_mb_run(struct blake2ets_mb_mgr *mgr) {
+  int j;
 
-    memcpy(block + D - mlen_rup, m, mlen);
-    memset(block + D - mlen_rup + mlen, 0, mlen_rup - mlen - 1);
-    block[D - 1] = mlen; /* requires C <= 256 (bytes) */
-    /* m += mlen, mlen = 0; */
-    m_padded = 1;
+  while ((j = blake2ets_mb_done(mgr)) < 0) {
+    ets_lanes_round(mgr->lanes, mgr->n, mgr->update, mgr->idle_st, mgr->idle_block);
   }
+  return j;
+}
 
-  if (! ad_padded && adlen > 0) {
-    blake2cf_update(st, block, t++, 1);
+struct ets_mb_job *blake2ets_mb_submit(struct blake2ets_mb_mgr *mgr, struct ets_mb_job *job) {
+  int j, free_lanes;
 
-    while (adlen > D) {
-      blake2cf_update(st, ad, t++, 0);
-      ad += D, adlen -= D;
+  if (! CHECK_PARAMS_ENCDEC(job->klen, job->adlen, job->len, job->len, job->taglen)) {
+    job->status = -1;
+    return job;
+  }
+
+  /* there always is a free lane: a submission that fills the last one returns a job */
+  free_lanes = 0;
+  for (j = mgr->n - 1; j >= 0; j--) {
+    if (mgr->jobs[j] == NULL) {
+      free_lanes++;
+      if (free_lanes == 1) {
+        mgr->jobs[j] = job;
+        ets_lane_init(&mgr->lanes[j], job->klen, job->k, job->adlen, job->ad, job->len, job->in, job->out, job->taglen, job->decrypt);
+      }
     }
-    /* assert(0 < adlen && adlen <= D); */
-    LOAD_AD_INTO_BLOCK(D);
-    /* assert(ad_padded || (! ad_padded && adlen == 0)); */
   }
+  assert(free_lanes >= 1);
 
-  if (m_padded) {
-    blake2cf_update(st, block, t++, 1);
+  j = blake2ets_mb_done(mgr);
+  if (j >= 0) {
+    return blake2ets_mb_complete(mgr, j);
   }
-  else {
-    blake2cf_update(st, block, t++, 0);
+  if (free_lanes > 1) {
+    return NULL;
   }
+  return blake2ets_mb_complete(mgr, blake2ets_mb_run(mgr));
+}
+
+struct ets_mb_job *blake2ets_mb_flush(struct blake2ets_mb_mgr *mgr) {
+  struct ets_lane *l;
+  struct ets_mb_job *job;
+  const uint8_t *in;
+  int j, jmin, active, final;
 
-  blake2cf_export(st, buf);
-  /* blake2cf_clear(st); */
+  j = blake2ets_mb_done(mgr);
+  if (j >= 0) {
+    return blake2ets_mb_complete(mgr, j);
+  }
 
-  if (ad_padded) {
-    unsigned int i;
-    for (i = 0; i < taglen; i++) {
-      buf[i] ^= 0xa5;
+  active = 0, jmin = -1;
+  for (j = 0; j < mgr->n; j++) {
+    if (mgr->jobs[j] != NULL) {
+      active++;
+      if (jmin < 0 || mgr->lanes[j].mlen + mgr->lanes[j].adlen < mgr->lanes[jmin].mlen + mgr->lanes[jmin].adlen) {
+        jmin = j;
+      }
     }
   }
+  if (active == 0) {
+    return NULL;
+  }
 
-  valid = ! memcmp(buf, tag, taglen); /* constant-time comparison not necessary */
+  if (2 * active >= mgr->n) {
+    return blake2ets_mb_complete(mgr, blake2ets_mb_run(mgr));
+  }
 
-  if (fail_if_invalid) {
-    assert(is_valid == NULL);
-    if (! valid) {
-      return -1;
+  /* few jobs left: single-record code for the shortest one */
+  l = &mgr->lanes[jmin];
+  if (l->t == 0) {
+    /* not started yet, the one-shot functions do it with their bulk kernels */
+    job = mgr->jobs[jmin];
+    if (! job->decrypt) {
+      job->status = blake2ets_enc(job->klen, job->k, job->adlen, job->ad, job->len, job->in, job->len, job->out, job->taglen, job->tag);
     }
+    else {
+      job->status = blake2ets_dec(job->klen, job->k, job->adlen, job->ad, job->len, job->in, job->taglen, job->tag, job->len, job->out, 1, NULL);
+    }
+    l->phase = LANE_DONE;
+    mgr->jobs[jmin] = NULL;
+    return job;
   }
-  else /* if (! fail_if_invalid) */ {
-    assert(is_valid != NULL);
-    *is_valid = valid;
+  while (l->phase != LANE_DONE) {
+    in = ets_lane_input(l, &final);
+    blake2cf_update(l->st, in, l->t, final);
+    ets_lane_step(l);
   }
-
-  return 0;
+  return blake2ets_mb_complete(mgr, jmin);
 }
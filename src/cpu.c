@@ -0,0 +1,122 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+
+#if HAVE_X86_SIMD
+#include <cpuid.h>
+#endif
+
+static const struct {
+  const char *name;
+  unsigned int feature;
+} feature_names[] = {
+  { "sse2", CPU_SSE2 },
+  { "ssse3", CPU_SSSE3 },
+  { "sse4.1", CPU_SSE41 },
+  { "avx2", CPU_AVX2 },
+  { "avx512", CPU_AVX512 },
+  { "sha", CPU_SHA },
+};
+
+#if HAVE_X86_SIMD
+static unsigned int cpu_detect(void) {
+  unsigned int eax, ebx, ecx, edx, xcr0 = 0;
+  unsigned int ecx1, edx1, ebx7 = 0;
+  unsigned int features = 0;
+
+  if (! __get_cpuid(1, &eax, &ebx, &ecx1, &edx1)) {
+    return 0;
+  }
+  if (__get_cpuid_max(0, NULL) >= 7) {
+    __cpuid_count(7, 0, eax, ebx7, ecx, edx);
+  }
+  if (ecx1 & bit_OSXSAVE) {
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+  }
+
+  if (edx1 & bit_SSE2) {
+    features |= CPU_SSE2;
+  }
+  if (ecx1 & bit_SSSE3) {
+    features |= CPU_SSSE3;
+  }
+  if (ecx1 & bit_SSE4_1) {
+    features |= CPU_SSE41;
+  }
+  if ((ebx7 & bit_SHA) && (ecx1 & bit_SSE4_1)) {
+    features |= CPU_SHA;
+  }
+  if ((xcr0 & 0x06) == 0x06 /* XMM and YMM state enabled by the OS */) {
+    if ((ecx1 & bit_AVX) && (ebx7 & bit_AVX2)) {
+      features |= CPU_AVX2;
+    }
+    if ((xcr0 & 0xe0) == 0xe0 /* opmask and ZMM state enabled by the OS */) {
+      if ((features & CPU_AVX2) && (ebx7 & bit_AVX512F) && (ebx7 & bit_AVX512VL)) {
+        features |= CPU_AVX512;
+      }
+    }
+  }
+
+  return features;
+}
+#else
+static unsigned int cpu_detect(void) {
+  return 0;
+}
+#endif
+
+/* parses the comma-separated list of ETS_CPU_FEATURES; unknown names are ignored */
+static unsigned int cpu_mask(const char *s) {
+  unsigned int mask = 0;
+  size_t len, i;
+
+  while (*s) {
+    len = strcspn(s, ",");
+    for (i = 0; i < sizeof(feature_names) / sizeof(feature_names[0]); i++) {
+      if (strlen(feature_names[i].name) == len && ! strncmp(s, feature_names[i].name, len)) {
+        mask |= feature_names[i].feature;
+      }
+    }
+    s += len;
+    if (*s == ',') {
+      s++;
+    }
+  }
+
+  return mask;
+}
+
+#define CPU_DETECTED 0x80000000U
+
+unsigned int cpu_features(void) {
+  static unsigned int detected = 0;
+  unsigned int features = ATOMIC_LOAD_ACQUIRE(&detected);
+  const char *env;
+
+  if (! (features & CPU_DETECTED)) {
+    features = cpu_detect();
+    env = getenv("ETS_CPU_FEATURES");
+    if (env != NULL) {
+      features &= cpu_mask(env);
+    }
+    ATOMIC_STORE_RELEASE(&detected, features | CPU_DETECTED);
+  }
+
+  return features & ~CPU_DETECTED;
+}
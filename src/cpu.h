@@ -0,0 +1,66 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef CPU_H
+#define CPU_H
+
+/*
+  Runtime CPU feature detection for the instruction-set specific kernels (compression functions, memxor).
+
+  The kernels are compiled with the regular (ISA-agnostic) compiler flags; each kernel function enables the
+  instructions it needs via TARGET(...), and is only ever called after the corresponding CPU feature was detected.
+  Every compression function keeps a table of its kernels, best first and terminated by the portable reference
+  code; on its first invocation it binds to the first kernel whose required features are all present (from any
+  number of threads at once, see ATOMIC_LOAD_ACQUIRE below).
+
+  The set of detected features can be restricted (never extended) by setting the environment variable
+  ETS_CPU_FEATURES to a comma-separated list of feature names (e.g. "ssse3,sse4.1", or "none" for the
+  reference code only), which allows to exercise each kernel on a single machine.
+*/
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_X86_SIMD 1
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+#define CPU_SSSE3  0x01
+#define CPU_SSE41  0x02
+#define CPU_AVX2   0x04
+#define CPU_AVX512 0x08 /* AVX-512F and AVX-512VL */
+#define CPU_SHA    0x10
+#define CPU_SSE2   0x20
+
+unsigned int cpu_features(void);
+
+/*
+  Lazily initialized globals (the kernel a function is bound to, the detected features, ...) may be set up by
+  racing first calls from several threads: they are published with release and read with acquire semantics.
+  ATOMIC_CLAIM(p) turns *p from 0 to 1 and is true for the one caller that did so.
+*/
+
+#if defined(__GNUC__)
+#define ATOMIC_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ATOMIC_CLAIM(p) (__atomic_exchange_n((p), 1, __ATOMIC_ACQ_REL) == 0)
+#else /* single-threaded use only */
+#define ATOMIC_LOAD_ACQUIRE(p) (*(p))
+#define ATOMIC_STORE_RELEASE(p, v) (*(p) = (v))
+#define ATOMIC_CLAIM(p) (*(p) == 0 ? (*(p) = 1) : 0)
+#endif
+
+#endif /* CPU_H */
@@ -17,6 +17,8 @@
 #ifndef ETS_H
 #define ETS_H
 
+#include <sys/uio.h>
+
 /*
   Note that encrypt-to-self is a one-time primitive, i.e., each key may be used for at most one encryption.
 
@@ -30,9 +32,103 @@
 
   - if fail_if_invalid is true and is_valid == NULL: ets_dec flags invalid ciphertexts by returning -1;
     if fail_if_invalid is false and is_valid != NULL: ets_dec stores validity indicator in *is_valid and returns 0.
+
+  - ets_verify checks the tag as ets_dec does, but does not write the plaintext: it returns 0 for a valid and -1
+    for an invalid ciphertext (or inadmissible parameters)
+
+  - ets_reencrypt decrypts and encrypts under a new key in one pass, ets_encv/ets_decv take the AD, message and
+    ciphertext as fragments (struct iovec), see e.g. blake2ets.h
 */
 
 typedef int (*ets_enc)(size_t klen, const void *k, size_t adlen, const void *ad, size_t mlen, const void *m, size_t clen, void *c, size_t taglen, void *tag);
 typedef int (*ets_dec)(size_t klen, const void *k, size_t adlen, const void *ad, size_t clen, const void *c, size_t taglen, const void *tag, size_t mlen, void *m, int fail_if_invalid, int *is_valid);
+typedef int (*ets_verify)(size_t klen, const void *k, size_t adlen, const void *ad, size_t clen, const void *c, size_t taglen, const void *tag);
+typedef int (*ets_reencrypt)(size_t klen_old, const void *k_old, size_t klen_new, const void *k_new, size_t adlen, const void *ad, size_t clen, const void *c_in, size_t taglen_in, const void *tag_in, void *c_out, size_t taglen_new, void *tag_new, int fail_if_invalid, int *is_valid);
+typedef int (*ets_encv)(size_t klen, const void *k, const struct iovec *ad, int adcnt, const struct iovec *m, int mcnt, const struct iovec *c, int ccnt, size_t taglen, void *tag);
+typedef int (*ets_decv)(size_t klen, const void *k, const struct iovec *ad, int adcnt, const struct iovec *c, int ccnt, size_t taglen, const void *tag, const struct iovec *m, int mcnt, int fail_if_invalid, int *is_valid);
+
+/*
+  Incremental interface (e.g. blake2ets_enc_init) and its snapshots: the context is an opaque struct ets_ctx, which
+  may only be passed to the functions of the mode that created it
+*/
+
+struct ets_ctx;
+
+typedef struct ets_ctx *(*ets_enc_init)(size_t klen, const void *k, size_t taglen);
+typedef struct ets_ctx *(*ets_dec_init)(size_t klen, const void *k, size_t taglen);
+typedef int (*ets_update_ad)(struct ets_ctx *ctx, const void *ad, size_t adlen);
+typedef int (*ets_update_msg)(struct ets_ctx *ctx, const void *in, void *out, size_t len);
+typedef int (*ets_enc_final)(struct ets_ctx *ctx, void *tag);
+typedef int (*ets_dec_final)(struct ets_ctx *ctx, const void *tag, int fail_if_invalid, int *is_valid);
+typedef void (*ets_ctx_free)(struct ets_ctx *ctx);
+typedef size_t (*ets_snapshot_size)(const struct ets_ctx *ctx);
+typedef int (*ets_snapshot)(const struct ets_ctx *ctx, void *buf);
+typedef struct ets_ctx *(*ets_resume)(const void *buf, size_t len, size_t klen, const void *k);
+
+/* multi-buffer variants (e.g. blake2ets_enc_x4): one array entry per record, see blake2ets.h */
+typedef int (*ets_enc_mb)(const size_t *klen, const void *const *k, const size_t *adlen, const void *const *ad, const size_t *mlen, const void *const *m, const size_t *clen, void *const *c, const size_t *taglen, void *const *tag);
+typedef int (*ets_dec_mb)(const size_t *klen, const void *const *k, const size_t *adlen, const void *const *ad, const size_t *clen, const void *const *c, const size_t *taglen, const void *const *tag, const size_t *mlen, void *const *m, int fail_if_invalid, int *is_valid);
+
+/* a record for the multi-buffer managers (e.g. blake2ets_mb_submit), mlen == clen == len; in == out is allowed */
+struct ets_mb_job {
+  int decrypt; /* 0: in = m, out = c, tag is written; 1: in = c, out = m, tag is checked */
+  size_t klen;
+  const void *k;
+  size_t adlen;
+  const void *ad;
+  size_t len;
+  const void *in;
+  void *out;
+  size_t taglen;
+  void *tag;
+  int status; /* set on completion */
+  void *user_data; /* not touched by the managers */
+};
+
+/*
+  A batch of records for the batch functions (e.g. blake2ets_enc_batch), as parallel arrays: record i is given by
+  klen[i], k[i], ..., mlen == clen == len[i]; in == out is allowed. The batch functions store the outcome of record i
+  in status[i] and return 0 if all records succeeded, -1 otherwise.
+*/
+
+enum {
+  ETS_BATCH_OK = 0,
+  ETS_BATCH_EPARAM = -1, /* inadmissible parameters, the record was not processed */
+  ETS_BATCH_INVALID = -2, /* decryption: the tag does not match (the plaintext is written nevertheless) */
+};
+
+struct ets_batch {
+  size_t n; /* number of records */
+  const size_t *klen;
+  const void *const *k;
+  const size_t *adlen;
+  const void *const *ad;
+  const size_t *len;
+  const void *const *in; /* m (enc) or c (dec) */
+  void *const *out; /* c (enc) or m (dec) */
+  const size_t *taglen;
+  void *const *tag; /* written (enc) or checked (dec) */
+  int *status;
+};
+
+typedef int (*ets_enc_batch)(const struct ets_batch *batch);
+typedef int (*ets_dec_batch)(const struct ets_batch *batch);
+
+/*
+  Large messages: from this many bytes of message on, the bulk of sha256ets/sha512ets/blake2ets_enc/_dec is done in
+  streaming mode, with the input prefetched ahead and the output written by non-temporal stores, so that neither
+  displaces the working set of other code from the caches. The default is 4 MiB, or the value of the environment
+  variable ETS_STREAM_THRESHOLD (in bytes); ets_set_stream_threshold(0) streams all messages, (size_t)-1 none.
+*/
+
+size_t ets_stream_threshold(void);
+void ets_set_stream_threshold(size_t threshold);
+
+/*
+  Reports the compression function and memxor kernels selected for the executing CPU,
+  e.g. "blake2cf:avx512 sha256cf:shani sha512cf:avx2 memxor:avx512" (see src/cpu.h for how to restrict the selection).
+*/
+
+const char *ets_backend_info(void);
 
 #endif /* ETS_H */
@@ -0,0 +1,41 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+
+#include "blake2cf_impl.h"
+#include "sha256cf_impl.h"
+#include "sha512cf_impl.h"
+#include "memxor.h"
+#include "ets.h"
+#include "cpu.h"
+
+const char *ets_backend_info(void) {
+  static char info[96];
+  static int claimed = 0, ready = 0;
+
+  if (! ATOMIC_LOAD_ACQUIRE(&ready)) {
+    if (ATOMIC_CLAIM(&claimed)) {
+      snprintf(info, sizeof(info), "blake2cf:%s sha256cf:%s sha512cf:%s memxor:%s",
+               blake2cf_backend(), sha256cf_backend(), sha512cf_backend(), memxor_backend());
+      ATOMIC_STORE_RELEASE(&ready, 1);
+    }
+    while (! ATOMIC_LOAD_ACQUIRE(&ready)) {
+      ; /* another thread is writing info */
+    }
+  }
+  return info;
+}
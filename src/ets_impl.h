@@ -0,0 +1,1473 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef ETS_IMPL_H
+#define ETS_IMPL_H
+
+/*
+  Internal header: the ETS mode, written once against a compression function policy and instantiated by
+  sha256ets.c, sha512ets.c and blake2ets.c. Before including it, a translation unit defines
+
+    C, D              chaining value and block size of the compression function (bytes)
+    CF_MEMSTATESIZE   size of the state buffer
+    CF_KLEN_MAX       maximum key length the compression function accepts
+    ETS_LANES_MAX     widest multi-buffer kernel
+    ETS(name)         name of the public function, e.g. blake2ets_##name
+    CF_ID             identifies the compression function in snapshots
+
+  and the following static inline functions; t counts the compression function calls of a record, and final marks
+  the AD-final block and the padded final block (the finalization flag of BLAKE2, a flip of the state for SHA-2):
+
+    cf_init(st, klen, taglen)
+    cf_update(st, block, t, final)
+    cf_update_xor(st, block, t, out, in, len)
+    cf_update_split(st, ad, key, msg, t, out, in)
+    cf_ets_bulk(st, block, t, out, in, nblocks, decrypt)
+    cf_export(st, out)
+    cf_update_x2(st[2], block[2], t[2], final[2])   two independent cf_update calls, possibly interleaved
+
+  The compression functions behind them stay bound at run time to the best kernel for the CPU.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "ets.h"
+#include "memxor.h"
+
+#define assert(C) do { ; } while (! (C)) /* poor man's assert */
+
+_Static_assert(C <= D && C <= 256, "required by mode");
+
+/* round up to next multiple of 8 (for copy efficiency on 64-bit machines) */
+#define RUP_8(x) (((x) + 7) & ~0x07)
+
+#define MAV 16 /* memory alignment value (for even faster copies) */
+_Static_assert((MAV & (MAV - 1)) == 0, "memory alignment value not a power of two");
+
+#define RUP_MAV(x) (((x) + MAV - 1) & ~(MAV - 1)) /* round up to next multiple of MAV */
+
+_Static_assert(C == RUP_MAV(C) && D == RUP_MAV(D), "compression function shall work well with memory-aligned data");
+
+#define CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)            \
+  (                                                                     \
+   ((klen) >= 128 / 8 && (klen) <= (D - C) && (klen) == RUP_8(klen))    \
+   &&                                                                   \
+   ((klen) <= CF_KLEN_MAX)                                              \
+   &&                                                                   \
+   ((clen) == (mlen))                                                   \
+   &&                                                                   \
+   ((taglen) >= 80 / 8 && (taglen) <= C)                                \
+  )
+
+#define AD_FINALIZER 0x80
+
+#define LOAD_AD_INTO_BLOCK(_len) do {                                   \
+    /* assert(! ad_padded); */                                          \
+    size_t len = (_len);                                                \
+    if (adlen >= len) {                                                 \
+      memcpy(block, ad, len);                                           \
+      ad += len, adlen -= len;                                          \
+    }                                                                   \
+    else /* if (0 <= adlen < len) */ {                                  \
+      memcpy(block, ad, adlen);                                         \
+      block[adlen] = AD_FINALIZER;                                      \
+      memset(block + adlen + 1, 0, len - adlen - 1);                    \
+      /* ad += adlen, adlen = 0; */                                     \
+      ad_padded = 1;                                                    \
+    }                                                                   \
+  } while (0)
+
+/*
+  Tiny records, with adlen < D and mlen <= C: the padded AD block and (unless mlen == 0) the block with the message
+  are all there is to compress, so the bookkeeping of the general code is skipped. Leaves the full tag in buf;
+  in == out is allowed.
+*/
+static inline void ets_tiny(size_t klen, const void *k, size_t adlen, const void *ad, size_t mlen, const void *in, void *out, size_t taglen, uint8_t *buf, int decrypt) {
+  uint8_t st[CF_MEMSTATESIZE];
+  uint8_t block[D], mblock[D];
+  size_t pos, i;
+
+  memcpy(block, ad, adlen);
+  block[adlen] = AD_FINALIZER;
+  memset(block + adlen + 1, 0, D - adlen - 1);
+  memxor2(block, k, klen);
+
+  cf_init(st, klen, taglen);
+
+  if (mlen == 0) {
+    cf_update(st, block, 0, 1);
+  }
+  else {
+    memset(mblock, 0, D);
+    memcpy(mblock, k, klen);
+    pos = (mlen < C) ? D - RUP_MAV(mlen + 1) : D - C;
+    if (! decrypt) {
+      memcpy(mblock + pos, in, mlen); /* before out is written */
+    }
+    cf_update_xor(st, block, 0, out, in, mlen);
+    if (decrypt) {
+      memcpy(mblock + pos, out, mlen);
+    }
+    if (mlen < C) {
+      mblock[D - 1] = mlen; /* requires C <= 256 (bytes) */
+    }
+    cf_update(st, mblock, 1, mlen < C);
+  }
+
+  cf_export(st, buf);
+  for (i = 0; i < C; i++) {
+    buf[i] ^= 0xa5; /* adlen < D: the AD was padded */
+  }
+}
+
+/* compares the computed tag; the outcome is reported as selected by fail_if_invalid */
+static int ets_check_tag(const uint8_t *buf, const void *tag, size_t taglen, int fail_if_invalid, int *is_valid) {
+  int valid = ! memcmp(buf, tag, taglen); /* constant-time comparison not necessary */
+
+  if (fail_if_invalid) {
+    assert(is_valid == NULL);
+    if (! valid) {
+      return -1;
+    }
+  }
+  else /* if (! fail_if_invalid) */ {
+    assert(is_valid != NULL);
+    *is_valid = valid;
+  }
+
+  return 0;
+}
+
+#define STREAM_CHUNK 4096 /* output bytes per step of the streaming mode, staged in a buffer that stays in L1 */
+#define STREAM_AHEAD (2 * STREAM_CHUNK) /* prefetch distance of the streaming mode */
+
+_Static_assert(STREAM_CHUNK % C == 0, "streaming chunks shall consist of whole message blocks");
+
+/*
+  cf_ets_bulk for large messages (see ets_stream_threshold): chunk by chunk, the input is prefetched
+  STREAM_AHEAD bytes ahead and the output is written with non-temporal stores from a small staging buffer;
+  with out == NULL, the output is dropped (ETS(verify)).
+*/
+static void ets_bulk_stream(uint8_t *st, uint8_t *block, unsigned long long int t, uint8_t *out, const uint8_t *in, size_t n, int decrypt) {
+  uint8_t buf[STREAM_CHUNK];
+  size_t len = n * C, k;
+
+  mem_prefetch(in, (len < STREAM_AHEAD) ? len : STREAM_AHEAD);
+  while (len > 0) {
+    k = (len < STREAM_CHUNK) ? len : STREAM_CHUNK;
+    if (len > STREAM_AHEAD) {
+      mem_prefetch(in + STREAM_AHEAD, (len - STREAM_AHEAD < STREAM_CHUNK) ? len - STREAM_AHEAD : STREAM_CHUNK);
+    }
+    cf_ets_bulk(st, block, t, buf, in, k / C, decrypt);
+    if (out != NULL) {
+      memcpy_stream(out, buf, k);
+      out += k;
+    }
+    t += k / C;
+    in += k, len -= k;
+  }
+}
+
+int ETS(enc)(size_t klen, const void *k, size_t adlen, const void * _ad, size_t mlen, const void * _m, size_t clen, void * _c, size_t taglen, void *tag) {
+  const uint8_t *ad = _ad;
+  const uint8_t *m = _m;
+  uint8_t *c = _c;
+  uint8_t st[CF_MEMSTATESIZE];
+  uint8_t block[D], buf[C];
+  unsigned long long int t = 0;
+  int ad_padded = 0;
+  int m_padded = 0;
+  int default_ad_block = 0; /* (default_ad_block == 1) ==> (block[0..D-C-1] == zero-padded key) */
+  const uint8_t *ad_seg = NULL; /* (ad_seg != NULL) ==> the next block is (ad_seg XOR kpad) || m_prev, not staged in block */
+  const uint8_t *m_prev = NULL;
+  uint8_t kpad[D - C]; /* zero-padded key */
+  size_t mlen_rup;
+  int in_place = (c == m); /* ==> the plaintext of a chunk is saved to mbuf before its ciphertext overwrites it */
+  uint8_t mbuf[C];
+  const uint8_t *p; /* plaintext of the current chunk */
+
+  if (! CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)) {
+    return -1;
+  }
+
+  if (adlen < D && mlen <= C) {
+    ets_tiny(klen, k, adlen, ad, mlen, m, c, taglen, buf, 0);
+    memcpy(tag, buf, taglen);
+    return 0;
+  }
+
+  if (mlen == 0) {
+    m_padded = 1;
+  }
+
+  /* first block */
+  LOAD_AD_INTO_BLOCK(D);
+  memxor2(block, k, klen);
+
+  cf_init(st, klen, taglen);
+
+  /* bulk message processing */
+  while (mlen >= C) {
+    if (default_ad_block) {
+      /* steady state: the first D - C bytes of block no longer change, so the remaining full blocks go in one call */
+      size_t n = mlen / C;
+      if (mlen >= ets_stream_threshold()) {
+        ets_bulk_stream(st, block, t, c, m, n, 0);
+      }
+      else {
+        cf_ets_bulk(st, block, t, c, m, n, 0);
+      }
+      t += n;
+      c += n * C, m += n * C, mlen -= n * C;
+      break;
+    }
+
+    p = m;
+    if (ad_seg != NULL) {
+      cf_update_split(st, ad_seg, kpad, m_prev, t++, c, m);
+    }
+    else {
+      if (in_place) {
+        p = memcpy(mbuf, m, C);
+      }
+      cf_update_xor(st, block, t++, c, m, C);
+    }
+
+    if (! ad_padded && adlen >= D - C && ! in_place) {
+      /* a full AD segment: leave it in place, the next block is compressed from ad, kpad and m directly (not when
+         encrypting in place, as c overwrites m) */
+      if (ad_seg == NULL) {
+        memcpy(kpad, k, klen);
+        memset(kpad + klen, 0, D - C - klen);
+      }
+      ad_seg = ad, m_prev = m;
+      ad += D - C, adlen -= D - C;
+      c += C, m += C, mlen -= C;
+      continue;
+    }
+    ad_seg = NULL;
+
+    if (! ad_padded) {
+      LOAD_AD_INTO_BLOCK(D - C);
+      memxor2(block, k, klen);
+    }
+    else /* if (ad_padded) */ {
+      if (! default_ad_block) {
+        memcpy(block, k, klen);
+        memset(block + klen, 0, D - C - klen);
+        default_ad_block = 1;
+      }
+    }
+
+    memcpy(block + D - C, p, C);
+    c += C, m += C, mlen -= C;
+  }
+
+  if (ad_seg != NULL) {
+    /* stage the pending block for the code below */
+    memcpy(block, ad_seg, D - C);
+    memxor2(block, k, klen);
+    memcpy(block + D - C, m_prev, C);
+  }
+
+  /* in case a partial message block remains */
+  if (0 < mlen /* && mlen < C */) {
+    p = in_place ? memcpy(mbuf, m, mlen) : m;
+    cf_update_xor(st, block, t++, c, m, mlen);
+
+    mlen_rup = RUP_MAV(mlen + 1); /* by mlen < C and C == RUP_MAV(C): mlen_rup <= C */
+
+    if (! ad_padded) {
+      LOAD_AD_INTO_BLOCK(D - mlen_rup);
+      memxor2(block, k, klen);
+    }
+    else /* if (ad_padded) */ {
+      if (default_ad_block) {
+        memset(block + D - C, 0, C - mlen_rup);
+      }
+      else /* if (! default_ad_block) */ {
+        memcpy(block, k, klen);
+        memset(block + klen, 0, D - mlen_rup - klen);
+        /* default_ad_block = 1; */
+      }
+    }
+
+    /* c += mlen; */
+
+    memcpy(block + D - mlen_rup, p, mlen);
+    memset(block + D - mlen_rup + mlen, 0, mlen_rup - mlen - 1);
+    block[D - 1] = mlen; /* requires C <= 256 (bytes) */
+    /* m += mlen, mlen = 0; */
+    m_padded = 1;
+  }
+
+  if (! ad_padded && adlen > 0) {
+    cf_update(st, block, t++, 1);
+
+    while (adlen > D) {
+      cf_update(st, ad, t++, 0);
+      ad += D, adlen -= D;
+    }
+    /* assert(0 < adlen && adlen <= D); */
+    LOAD_AD_INTO_BLOCK(D);
+    /* assert(ad_padded || (! ad_padded && adlen == 0)); */
+  }
+
+  if (m_padded) {
+    cf_update(st, block, t++, 1);
+  }
+  else {
+    cf_update(st, block, t++, 0);
+  }
+
+  cf_export(st, buf);
+  /* cf_clear(st); */
+
+  if (ad_padded) {
+    unsigned int i;
+    for (i = 0; i < taglen; i++) {
+      buf[i] ^= 0xa5;
+    }
+  }
+
+  memcpy(tag, buf, taglen);
+
+  return 0;
+}
+
+/*
+  Decryption up to the full tag in buf, for parameters that passed the checks. With m == NULL, the plaintext is
+  recovered only as far as needed for the next block, in a buffer of C bytes (resp. the staging buffer of
+  ets_bulk_stream), and not written out.
+*/
+static void ets_dec_tag(size_t klen, const void *k, size_t adlen, const uint8_t *ad, size_t mlen, const uint8_t *c, uint8_t *m, size_t taglen, uint8_t *buf) {
+  uint8_t mbuf[C];
+  size_t mstep = (m != NULL) ? C : 0; /* advance of m per full block */
+  uint8_t st[CF_MEMSTATESIZE];
+  uint8_t block[D];
+  unsigned long long int t = 0;
+  int ad_padded = 0;
+  int m_padded = 0;
+  int default_ad_block = 0; /* (default_ad_block == 1) ==> (block[0..D-C-1] == zero-padded key) */
+  const uint8_t *ad_seg = NULL; /* (ad_seg != NULL) ==> the next block is (ad_seg XOR kpad) || m_prev, not staged in block */
+  const uint8_t *m_prev = NULL;
+  uint8_t kpad[D - C]; /* zero-padded key */
+  size_t mlen_rup;
+
+  if (m == NULL) {
+    m = mbuf;
+  }
+
+  if (adlen < D && mlen <= C) {
+    ets_tiny(klen, k, adlen, ad, mlen, c, m, taglen, buf, 1);
+    return;
+  }
+
+  if (mlen == 0) {
+    m_padded = 1;
+  }
+
+  /* first block */
+  LOAD_AD_INTO_BLOCK(D);
+  memxor2(block, k, klen);
+
+  cf_init(st, klen, taglen);
+
+  /* bulk ciphertext processing */
+  while (mlen >= C) {
+    if (default_ad_block) {
+      /* steady state: the first D - C bytes of block no longer change, so the remaining full blocks go in one call */
+      size_t n = mlen / C;
+      if (mstep == 0) {
+        ets_bulk_stream(st, block, t, NULL, c, n, 1);
+      }
+      else if (mlen >= ets_stream_threshold()) {
+        ets_bulk_stream(st, block, t, m, c, n, 1);
+      }
+      else {
+        cf_ets_bulk(st, block, t, m, c, n, 1);
+      }
+      t += n;
+      c += n * C, m += n * mstep, mlen -= n * C;
+      break;
+    }
+
+    if (ad_seg != NULL) {
+      cf_update_split(st, ad_seg, kpad, m_prev, t++, m, c);
+    }
+    else {
+      cf_update_xor(st, block, t++, m, c, C);
+    }
+
+    if (! ad_padded && adlen >= D - C) {
+      /* a full AD segment: leave it in place, the next block is compressed from ad, kpad and m directly */
+      if (ad_seg == NULL) {
+        memcpy(kpad, k, klen);
+        memset(kpad + klen, 0, D - C - klen);
+      }
+      ad_seg = ad, m_prev = m;
+      ad += D - C, adlen -= D - C;
+      c += C, m += mstep, mlen -= C;
+      continue;
+    }
+    ad_seg = NULL;
+
+    if (! ad_padded) {
+      LOAD_AD_INTO_BLOCK(D - C);
+      memxor2(block, k, klen);
+    }
+    else /* if (ad_padded) */ {
+      if (! default_ad_block) {
+        memcpy(block, k, klen);
+        memset(block + klen, 0, D - C - klen);
+        default_ad_block = 1;
+      }
+    }
+
+    memcpy(block + D - C, m, C);
+    c += C, m += mstep, mlen -= C;
+  }
+
+  if (ad_seg != NULL) {
+    /* stage the pending block for the code below */
+    memcpy(block, ad_seg, D - C);
+    memxor2(block, k, klen);
+    memcpy(block + D - C, m_prev, C);
+  }
+
+  /* in case a partial ciphertext block remains */
+  if (0 < mlen /* && mlen < C */) {
+    cf_update_xor(st, block, t++, m, c, mlen);
+
+    mlen_rup = RUP_MAV(mlen + 1); /* by mlen < C and C == RUP_MAV(C): mlen_rup <= C */
+
+    if (! ad_padded) {
+      LOAD_AD_INTO_BLOCK(D - mlen_rup);
+      memxor2(block, k, klen);
+    }
+    else /* if (ad_padded) */ {
+      if (default_ad_block) {
+        memset(block + D - C, 0, C - mlen_rup);
+      }
+      else /* if (! default_ad_block) */ {
+        memcpy(block, k, klen);
+        memset(block + klen, 0, D - mlen_rup - klen);
+        /* default_ad_block = 1; */
+      }
+    }
+
+    /* c += mlen; */
+
+    memcpy(block + D - mlen_rup, m, mlen);
+    memset(block + D - mlen_rup + mlen, 0, mlen_rup - mlen - 1);
+    block[D - 1] = mlen; /* requires C <= 256 (bytes) */
+    /* m += mlen, mlen = 0; */
+    m_padded = 1;
+  }
+
+  if (! ad_padded && adlen > 0) {
+    cf_update(st, block, t++, 1);
+
+    while (adlen > D) {
+      cf_update(st, ad, t++, 0);
+      ad += D, adlen -= D;
+    }
+    /* assert(0 < adlen && adlen <= D); */
+    LOAD_AD_INTO_BLOCK(D);
+    /* assert(ad_padded || (! ad_padded && adlen == 0)); */
+  }
+
+  if (m_padded) {
+    cf_update(st, block, t++, 1);
+  }
+  else {
+    cf_update(st, block, t++, 0);
+  }
+
+  cf_export(st, buf);
+  /* cf_clear(st); */
+
+  if (ad_padded) {
+    unsigned int i;
+    for (i = 0; i < taglen; i++) {
+      buf[i] ^= 0xa5;
+    }
+  }
+
+}
+
+int ETS(dec)(size_t klen, const void *k, size_t adlen, const void *ad, size_t clen, const void *c, size_t taglen, const void *tag, size_t mlen, void *m, int fail_if_invalid, int *is_valid) {
+  uint8_t buf[C];
+
+  if (! CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)) {
+    return -1;
+  }
+
+  ets_dec_tag(klen, k, adlen, ad, mlen, c, m, taglen, buf);
+  return ets_check_tag(buf, tag, taglen, fail_if_invalid, is_valid);
+}
+
+int ETS(verify)(size_t klen, const void *k, size_t adlen, const void *ad, size_t clen, const void *c, size_t taglen, const void *tag) {
+  uint8_t buf[C];
+
+  if (! CHECK_PARAMS_ENCDEC(klen, adlen, clen, clen, taglen)) {
+    return -1;
+  }
+
+  ets_dec_tag(klen, k, adlen, ad, clen, c, NULL, taglen, buf);
+  return ets_check_tag(buf, tag, taglen, 1, NULL);
+}
+
+/*
+  Multi-buffer mode: ETS(enc/dec) restated as a resumable per-record state machine, so that the compression
+  function calls of several records can be issued side by side to an ets_update_xn kernel. Each step compresses
+  the block named by the lane's phase and then consumes the new chaining value, exactly as the loop above does.
+*/
+
+enum { LANE_MSG, LANE_AD_FINAL, LANE_AD, LANE_TAG, LANE_DONE };
+
+struct ets_lane {
+  uint8_t st[CF_MEMSTATESIZE]; /* first, as the kernels access st and block as words: both stay aligned */
+  uint8_t block[D], buf[C];
+  size_t klen;
+  const uint8_t *k;
+  size_t adlen;
+  const uint8_t *ad;
+  size_t mlen;
+  const uint8_t *in; /* m (enc) or c (dec) */
+  uint8_t *out; /* c (enc) or m (dec) */
+  int decrypt;
+  unsigned long long int t;
+  int ad_padded;
+  int m_padded;
+  int default_ad_block;
+  int phase;
+};
+
+static void ets_lane_load_ad(struct ets_lane *l, size_t n) {
+  const uint8_t *ad = l->ad;
+  size_t adlen = l->adlen;
+  uint8_t *block = l->block;
+  int ad_padded = l->ad_padded;
+
+  LOAD_AD_INTO_BLOCK(n);
+  l->ad = ad, l->adlen = adlen, l->ad_padded = ad_padded;
+}
+
+/* phase following the message part */
+static int ets_lane_after_msg(const struct ets_lane *l) {
+  return (! l->ad_padded && l->adlen > 0) ? LANE_AD_FINAL : LANE_TAG;
+}
+
+static void ets_lane_init(struct ets_lane *l, size_t klen, const void *k, size_t adlen, const void *ad, size_t mlen, const void *in, void *out, size_t taglen, int decrypt) {
+  l->klen = klen, l->k = k;
+  l->adlen = adlen, l->ad = ad;
+  l->mlen = mlen, l->in = in, l->out = out;
+  l->decrypt = decrypt;
+  l->t = 0;
+  l->ad_padded = 0;
+  l->m_padded = (mlen == 0);
+  l->default_ad_block = 0;
+
+  /* first block */
+  ets_lane_load_ad(l, D);
+  memxor2(l->block, k, klen);
+
+  cf_init(l->st, klen, taglen);
+
+  l->phase = (mlen > 0) ? LANE_MSG : ets_lane_after_msg(l);
+}
+
+/* input of the next compression function call */
+static const uint8_t *ets_lane_input(const struct ets_lane *l, int *final) {
+  switch (l->phase) {
+  case LANE_AD_FINAL:
+    *final = 1;
+    return l->block;
+  case LANE_AD:
+    *final = 0;
+    return l->ad;
+  case LANE_TAG:
+    *final = l->m_padded;
+    return l->block;
+  default /* LANE_MSG */:
+    *final = 0;
+    return l->block;
+  }
+}
+
+/* a (full or partial) message chunk: output, then the next block */
+static void ets_lane_msg(struct ets_lane *l) {
+  uint8_t x[C];
+  size_t len = (l->mlen < C) ? l->mlen : C;
+  const uint8_t *p = l->decrypt ? l->out : l->in; /* plaintext */
+  uint8_t *block = l->block;
+  size_t mlen_rup;
+
+  cf_export(l->st, x);
+  if (l->decrypt) {
+    memxor3(l->out, l->in, x, len);
+  }
+
+  if (len == C) {
+    if (! l->ad_padded) {
+      ets_lane_load_ad(l, D - C);
+      memxor2(block, l->k, l->klen);
+    }
+    else if (! l->default_ad_block) {
+      memcpy(block, l->k, l->klen);
+      memset(block + l->klen, 0, D - C - l->klen);
+      l->default_ad_block = 1;
+    }
+    memcpy(block + D - C, p, C);
+  }
+  else {
+    mlen_rup = RUP_MAV(len + 1);
+    if (! l->ad_padded) {
+      ets_lane_load_ad(l, D - mlen_rup);
+      memxor2(block, l->k, l->klen);
+    }
+    else if (l->default_ad_block) {
+      memset(block + D - C, 0, C - mlen_rup);
+    }
+    else {
+      memcpy(block, l->k, l->klen);
+      memset(block + l->klen, 0, D - mlen_rup - l->klen);
+    }
+    memcpy(block + D - mlen_rup, p, len);
+    memset(block + D - mlen_rup + len, 0, mlen_rup - len - 1);
+    block[D - 1] = len;
+    l->m_padded = 1;
+  }
+
+  if (! l->decrypt) {
+    /* only now, as the plaintext was still needed */
+    memxor3(l->out, l->in, x, len);
+  }
+
+  l->in += len, l->out += len, l->mlen -= len;
+  if (l->mlen == 0) {
+    l->phase = ets_lane_after_msg(l);
+  }
+}
+
+/* consume the chaining value left by the compression of ets_lane_input() */
+static void ets_lane_step(struct ets_lane *l) {
+  unsigned int i;
+
+  l->t++;
+  switch (l->phase) {
+  case LANE_MSG:
+    ets_lane_msg(l);
+    break;
+  case LANE_AD:
+    l->ad += D, l->adlen -= D;
+    /* fall through */
+  case LANE_AD_FINAL:
+    if (l->adlen > D) {
+      l->phase = LANE_AD;
+    }
+    else {
+      ets_lane_load_ad(l, D);
+      l->phase = LANE_TAG;
+    }
+    break;
+  case LANE_TAG:
+    cf_export(l->st, l->buf);
+    if (l->ad_padded) {
+      for (i = 0; i < C; i++) {
+        l->buf[i] ^= 0xa5;
+      }
+    }
+    l->phase = LANE_DONE;
+    break;
+  }
+}
+
+typedef void (*ets_update_xn)(void *const *st, const void *const *block, const unsigned long long int *t, const int *final);
+
+/* one compression function call for n lanes; lanes that are done compress the idle state and block. Returns the number of active lanes */
+static int ets_lanes_round(struct ets_lane *lanes, int n, ets_update_xn update, void *idle_st, const void *idle_block) {
+  void *st[ETS_LANES_MAX];
+  const void *block[ETS_LANES_MAX];
+  unsigned long long int t[ETS_LANES_MAX];
+  int final[ETS_LANES_MAX];
+  int j, active;
+
+  active = 0;
+  for (j = 0; j < n; j++) {
+    if (lanes[j].phase != LANE_DONE) {
+      st[j] = lanes[j].st;
+      block[j] = ets_lane_input(&lanes[j], &final[j]);
+      t[j] = lanes[j].t;
+      active++;
+    }
+    else {
+      st[j] = idle_st;
+      block[j] = idle_block;
+      t[j] = 0;
+      final[j] = 0;
+    }
+  }
+  if (! active) {
+    return 0;
+  }
+
+  (*update)(st, block, t, final);
+
+  for (j = 0; j < n; j++) {
+    if (lanes[j].phase != LANE_DONE) {
+      ets_lane_step(&lanes[j]);
+    }
+  }
+
+  return active;
+}
+
+/* run all lanes to completion, n at a time through update */
+static void ets_lanes_run(struct ets_lane *lanes, int n, ets_update_xn update) {
+  uint64_t idle_st[CF_MEMSTATESIZE / 8], idle_block[D / 8]; /* word-aligned, as st and block of struct ets_lane */
+
+  memset(idle_st, 0, sizeof(idle_st));
+  memset(idle_block, 0, sizeof(idle_block));
+
+  while (ets_lanes_round(lanes, n, update, idle_st, idle_block)) {
+    ;
+  }
+}
+
+static int ets_enc_xn(int n, ets_update_xn update, const size_t *klen, const void *const *k, const size_t *adlen, const void *const *ad, const size_t *mlen, const void *const *m, const size_t *clen, void *const *c, const size_t *taglen, void *const *tag) {
+  struct ets_lane lanes[ETS_LANES_MAX];
+  int j;
+
+  for (j = 0; j < n; j++) {
+    if (! CHECK_PARAMS_ENCDEC(klen[j], adlen[j], mlen[j], clen[j], taglen[j])) {
+      return -1;
+    }
+  }
+
+  for (j = 0; j < n; j++) {
+    ets_lane_init(&lanes[j], klen[j], k[j], adlen[j], ad[j], mlen[j], m[j], c[j], taglen[j], 0);
+  }
+  ets_lanes_run(lanes, n, update);
+
+  for (j = 0; j < n; j++) {
+    memcpy(tag[j], lanes[j].buf, taglen[j]);
+  }
+
+  return 0;
+}
+
+static int ets_dec_xn(int n, ets_update_xn update, const size_t *klen, const void *const *k, const size_t *adlen, const void *const *ad, const size_t *clen, const void *const *c, const size_t *taglen, const void *const *tag, const size_t *mlen, void *const *m, int fail_if_invalid, int *is_valid) {
+  struct ets_lane lanes[ETS_LANES_MAX];
+  int j, valid, all_valid;
+
+  for (j = 0; j < n; j++) {
+    if (! CHECK_PARAMS_ENCDEC(klen[j], adlen[j], mlen[j], clen[j], taglen[j])) {
+      return -1;
+    }
+  }
+
+  for (j = 0; j < n; j++) {
+    ets_lane_init(&lanes[j], klen[j], k[j], adlen[j], ad[j], clen[j], c[j], m[j], taglen[j], 1);
+  }
+  ets_lanes_run(lanes, n, update);
+
+  all_valid = 1;
+  for (j = 0; j < n; j++) {
+    valid = ! memcmp(lanes[j].buf, tag[j], taglen[j]); /* constant-time comparison not necessary */
+    all_valid &= valid;
+    if (! fail_if_invalid) {
+      assert(is_valid != NULL);
+      is_valid[j] = valid;
+    }
+  }
+
+  if (fail_if_invalid) {
+    assert(is_valid == NULL);
+    if (! all_valid) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+  Batches (struct ets_batch): records up to lanes_maxlen bytes (AD and message) share the n lanes of update, a lane
+  being refilled with the next such record as soon as its record is done, so that records of different lengths keep
+  the lanes busy; as in the multi-buffer manager, the last few records are finished one by one once fewer than half
+  of the lanes would be active. Longer records, and those due for streaming mode, go through ETS(enc/dec) with their
+  bulk kernels. Returns the number of failed records.
+*/
+
+static size_t ets_batch_single(const struct ets_batch *b, size_t i, int decrypt) {
+  int valid = 0; /* set by ETS(dec), the parameters are checked already */
+
+  if (! decrypt) {
+    ETS(enc)(b->klen[i], b->k[i], b->adlen[i], b->ad[i], b->len[i], b->in[i], b->len[i], b->out[i], b->taglen[i], b->tag[i]);
+    b->status[i] = ETS_BATCH_OK;
+    return 0;
+  }
+  ETS(dec)(b->klen[i], b->k[i], b->adlen[i], b->ad[i], b->len[i], b->in[i], b->taglen[i], b->tag[i], b->len[i], b->out[i], 0, &valid);
+  b->status[i] = valid ? ETS_BATCH_OK : ETS_BATCH_INVALID;
+  return ! valid;
+}
+
+static size_t ets_batch_complete(const struct ets_batch *b, size_t i, const struct ets_lane *l, int decrypt) {
+  if (! decrypt) {
+    memcpy(b->tag[i], l->buf, b->taglen[i]);
+    b->status[i] = ETS_BATCH_OK;
+    return 0;
+  }
+  if (memcmp(l->buf, b->tag[i], b->taglen[i])) { /* constant-time comparison not necessary */
+    b->status[i] = ETS_BATCH_INVALID;
+    return 1;
+  }
+  b->status[i] = ETS_BATCH_OK;
+  return 0;
+}
+
+static int ets_batch_for_lanes(const struct ets_batch *b, size_t i, size_t lanes_maxlen) {
+  return b->adlen[i] + b->len[i] <= lanes_maxlen && b->len[i] < ets_stream_threshold();
+}
+
+static size_t ets_batch_run(const struct ets_batch *b, int decrypt, int n, ets_update_xn update, size_t lanes_maxlen) {
+  struct ets_lane lanes[ETS_LANES_MAX];
+  size_t rec[ETS_LANES_MAX]; /* (rec[j] == b->n) ==> lane j is free */
+  uint64_t idle_st[CF_MEMSTATESIZE / 8], idle_block[D / 8]; /* word-aligned, as st and block of struct ets_lane */
+  const uint8_t *in;
+  size_t i, next, failed;
+  int j, active, final;
+
+  failed = 0;
+  for (i = 0; i < b->n; i++) {
+    if (! CHECK_PARAMS_ENCDEC(b->klen[i], b->adlen[i], b->len[i], b->len[i], b->taglen[i])) {
+      b->status[i] = ETS_BATCH_EPARAM;
+      failed++;
+    }
+    else if (! ets_batch_for_lanes(b, i, lanes_maxlen)) {
+      failed += ets_batch_single(b, i, decrypt);
+    }
+    else {
+      b->status[i] = ETS_BATCH_OK; /* until the lane is done: status[] is read below, and may hold anything before */
+    }
+  }
+
+  memset(idle_st, 0, sizeof(idle_st));
+  memset(idle_block, 0, sizeof(idle_block));
+  for (j = 0; j < n; j++) {
+    lanes[j].phase = LANE_DONE;
+    rec[j] = b->n;
+  }
+
+  next = 0;
+  for (;;) {
+    active = 0;
+    for (j = 0; j < n; j++) {
+      if (lanes[j].phase == LANE_DONE) {
+        if (rec[j] < b->n) {
+          failed += ets_batch_complete(b, rec[j], &lanes[j], decrypt);
+          rec[j] = b->n;
+        }
+        while (next < b->n && (b->status[next] == ETS_BATCH_EPARAM || ! ets_batch_for_lanes(b, next, lanes_maxlen))) {
+          next++;
+        }
+        if (next < b->n) {
+          rec[j] = next++;
+          ets_lane_init(&lanes[j], b->klen[rec[j]], b->k[rec[j]], b->adlen[rec[j]], b->ad[rec[j]], b->len[rec[j]], b->in[rec[j]], b->out[rec[j]], b->taglen[rec[j]], decrypt);
+        }
+      }
+      active += (rec[j] < b->n);
+    }
+    if (active == 0 || (next == b->n && 2 * active < n)) {
+      break;
+    }
+    ets_lanes_round(lanes, n, update, idle_st, idle_block);
+  }
+
+  /* few records left: single-record code */
+  for (j = 0; j < n; j++) {
+    if (rec[j] == b->n) {
+      continue;
+    }
+    if (lanes[j].t == 0) {
+      failed += ets_batch_single(b, rec[j], decrypt);
+      continue;
+    }
+    while (lanes[j].phase != LANE_DONE) {
+      in = ets_lane_input(&lanes[j], &final);
+      cf_update(lanes[j].st, in, lanes[j].t, final);
+      ets_lane_step(&lanes[j]);
+    }
+    failed += ets_batch_complete(b, rec[j], &lanes[j], decrypt);
+  }
+
+  return failed;
+}
+
+/*
+  Re-encryption: the decryption of the old record and the encryption of the new one have the same block structure
+  (it depends on adlen and clen only), so they run as two lanes in lockstep. In each round, the decryption lane
+  leaves a chunk of plaintext in p, which the encryption lane absorbs and encrypts right away. The verdict on the
+  old tag is known only at the end, so an invalid record has its output wiped then. In place, that would destroy
+  the stored record (also for a mere wrong k_old), so the old tag is checked in a pass of its own first.
+*/
+int ETS(reencrypt)(size_t klen_old, const void *k_old, size_t klen_new, const void *k_new, size_t adlen, const void *ad, size_t clen, const void *c_in, size_t taglen_in, const void *tag_in, void *c_out, size_t taglen_new, void *tag_new, int fail_if_invalid, int *is_valid) {
+  struct ets_lane lanes[2];
+  uint64_t idle_st[CF_MEMSTATESIZE / 8], idle_block[D / 8];
+  uint8_t p[C];
+  int valid, ret;
+
+  if (! CHECK_PARAMS_ENCDEC(klen_old, adlen, clen, clen, taglen_in) || ! CHECK_PARAMS_ENCDEC(klen_new, adlen, clen, clen, taglen_new)) {
+    return -1;
+  }
+
+  if (c_out == c_in) {
+    /* as ETS(verify), with p for the tag */
+    ets_dec_tag(klen_old, k_old, adlen, ad, clen, c_in, NULL, taglen_in, p);
+    if (memcmp(p, tag_in, taglen_in)) { /* constant-time comparison not necessary */
+      if (tag_new != tag_in) {
+        memset(tag_new, 0, taglen_new);
+      }
+      return ets_check_tag(p, tag_in, taglen_in, fail_if_invalid, is_valid);
+    }
+  }
+
+  memset(idle_st, 0, sizeof(idle_st)); /* not compressed: both lanes finish in the same round */
+  memset(idle_block, 0, sizeof(idle_block));
+
+  ets_lane_init(&lanes[0], klen_old, k_old, adlen, ad, clen, c_in, p, taglen_in, 1);
+  ets_lane_init(&lanes[1], klen_new, k_new, adlen, ad, clen, p, c_out, taglen_new, 0);
+  do {
+    /* lanes are stepped in order: the plaintext is written to p by lane 0 before lane 1 reads it */
+    lanes[0].out = p;
+    lanes[1].in = p;
+  } while (ets_lanes_round(lanes, 2, cf_update_x2, idle_st, idle_block));
+
+  valid = ! memcmp(lanes[0].buf, tag_in, taglen_in); /* constant-time comparison not necessary */
+  ret = ets_check_tag(lanes[0].buf, tag_in, taglen_in, fail_if_invalid, is_valid); /* before tag_new, which may be tag_in */
+  if (valid) {
+    memcpy(tag_new, lanes[1].buf, taglen_new);
+  }
+  else {
+    /* the old record is forged or corrupt, or k_old is wrong: its re-encryption must not authenticate under k_new (c_out != c_in here) */
+    memset(c_out, 0, clen);
+    if (tag_new != tag_in) {
+      memset(tag_new, 0, taglen_new);
+    }
+  }
+  return ret;
+}
+
+/*
+  Incremental interface: the blocks of ETS(enc/dec) are formed from the input as it arrives. A message chunk is
+  encrypted as soon as it is given, with the chaining value of the block before it; a block is only compressed
+  when the next message byte arrives or at the end, as the flags of the last compressions depend on what follows.
+  The AD goes D - C bytes into each block next to the message, so it is kept until it is absorbed.
+*/
+
+struct ETS(ctx) {
+  uint8_t st[CF_MEMSTATESIZE]; /* first, word-aligned for the kernels, as in struct ets_lane */
+  uint8_t block[D]; /* (ad_closed && mpos == 0) ==> the next block to compress */
+  int decrypt;
+  size_t klen;
+  uint8_t kpad[D - C]; /* zero-padded key */
+  size_t taglen;
+  unsigned long long int t;
+  uint8_t x[C]; /* exported chaining value, the key stream of the current message chunk */
+  uint8_t p[C]; /* plaintext of the current message chunk */
+  size_t mpos; /* bytes of the current message chunk processed so far */
+  int has_msg;
+  int ad_closed; /* no more AD, the first block has been formed */
+  int ad_padded;
+  int default_ad_block; /* (default_ad_block == 1) ==> (block[0..D-C-1] == kpad) */
+  const struct iovec *adv; /* the AD not absorbed yet: adlen bytes from adoff bytes into adv[0] on */
+  size_t adoff, adlen;
+  uint8_t *adbuf; /* the AD given to ETS(update_ad), adv == &adbuf_iov then */
+  size_t adcap;
+  struct iovec adbuf_iov;
+};
+
+/* dst = the n bytes at the cursor (*v, *off), which then moves past them */
+static void ets_iov_read(const struct iovec **v, size_t *off, uint8_t *dst, size_t n) {
+  size_t k;
+
+  while (n > 0) {
+    k = (*v)->iov_len - *off;
+    k = (k < n) ? k : n;
+    memcpy(dst, (const uint8_t *)(*v)->iov_base + *off, k);
+    dst += k, n -= k, *off += k;
+    if (*off == (*v)->iov_len) {
+      (*v)++, *off = 0;
+    }
+  }
+}
+
+static size_t ets_iov_len(const struct iovec *v, int cnt) {
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < cnt; i++) {
+    len += v[i].iov_len;
+  }
+  return len;
+}
+
+/* a context without AD, for parameters that passed the checks */
+static void ets_ctx_setup(struct ETS(ctx) *ctx, size_t klen, const void *k, size_t taglen, int decrypt) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->decrypt = decrypt;
+  ctx->klen = klen;
+  memcpy(ctx->kpad, k, klen);
+  ctx->taglen = taglen;
+  cf_init(ctx->st, klen, taglen);
+  ctx->adv = &ctx->adbuf_iov;
+}
+
+static struct ETS(ctx) *ets_ctx_init(size_t klen, const void *k, size_t taglen, int decrypt) {
+  struct ETS(ctx) *ctx;
+
+  if (! CHECK_PARAMS_ENCDEC(klen, 0, 0, 0, taglen)) {
+    return NULL;
+  }
+
+  ctx = malloc(sizeof(*ctx));
+  if (ctx == NULL) {
+    return NULL;
+  }
+  ets_ctx_setup(ctx, klen, k, taglen, decrypt);
+
+  return ctx;
+}
+
+static void ets_ctx_destroy(struct ETS(ctx) *ctx) {
+  if (ctx == NULL) {
+    return;
+  }
+  free(ctx->adbuf);
+  memset(ctx, 0, sizeof(*ctx)); /* the key */
+  free(ctx);
+}
+
+/* the public functions take and return the opaque struct ets_ctx (ets.h), which stands for a struct ETS(ctx) */
+
+struct ets_ctx *ETS(enc_init)(size_t klen, const void *k, size_t taglen) {
+  return (struct ets_ctx *)ets_ctx_init(klen, k, taglen, 0);
+}
+
+struct ets_ctx *ETS(dec_init)(size_t klen, const void *k, size_t taglen) {
+  return (struct ets_ctx *)ets_ctx_init(klen, k, taglen, 1);
+}
+
+void ETS(ctx_free)(struct ets_ctx * _ctx) {
+  ets_ctx_destroy((struct ETS(ctx) *)_ctx);
+}
+
+int ETS(update_ad)(struct ets_ctx * _ctx, const void *ad, size_t adlen) {
+  struct ETS(ctx) *ctx = (struct ETS(ctx) *)_ctx;
+  uint8_t *adbuf;
+  size_t cap;
+
+  if (ctx->ad_closed) {
+    return -1;
+  }
+  if (adlen == 0) {
+    return 0;
+  }
+
+  if (ctx->adlen + adlen > ctx->adcap) {
+    cap = (ctx->adcap > 0) ? ctx->adcap : 256;
+    while (cap < ctx->adlen + adlen) {
+      cap *= 2;
+    }
+    adbuf = realloc(ctx->adbuf, cap);
+    if (adbuf == NULL) {
+      return -1;
+    }
+    ctx->adbuf = adbuf, ctx->adcap = cap;
+  }
+  memcpy(ctx->adbuf + ctx->adlen, ad, adlen);
+  ctx->adlen += adlen;
+  ctx->adbuf_iov.iov_base = ctx->adbuf, ctx->adbuf_iov.iov_len = ctx->adlen;
+
+  return 0;
+}
+
+static void ets_ctx_load_ad(struct ETS(ctx) *ctx, size_t n) {
+  /* LOAD_AD_INTO_BLOCK, gathering the AD from the cursor */
+  if (ctx->adlen >= n) {
+    ets_iov_read(&ctx->adv, &ctx->adoff, ctx->block, n);
+    ctx->adlen -= n;
+  }
+  else {
+    ets_iov_read(&ctx->adv, &ctx->adoff, ctx->block, ctx->adlen);
+    ctx->block[ctx->adlen] = AD_FINALIZER;
+    memset(ctx->block + ctx->adlen + 1, 0, n - ctx->adlen - 1);
+    ctx->adlen = 0;
+    ctx->ad_padded = 1;
+  }
+}
+
+/* the AD is complete: form the first block */
+static void ets_ctx_close_ad(struct ETS(ctx) *ctx) {
+  if (! ctx->ad_closed) {
+    ets_ctx_load_ad(ctx, D);
+    memxor2(ctx->block, ctx->kpad, ctx->klen);
+    ctx->ad_closed = 1;
+  }
+}
+
+/* the current message chunk is complete: form the next block, as ETS(enc) does after a full chunk */
+static void ets_ctx_next_block(struct ETS(ctx) *ctx) {
+  if (! ctx->ad_padded) {
+    ets_ctx_load_ad(ctx, D - C);
+    memxor2(ctx->block, ctx->kpad, ctx->klen);
+  }
+  else if (! ctx->default_ad_block) {
+    memcpy(ctx->block, ctx->kpad, D - C);
+    ctx->default_ad_block = 1;
+  }
+  memcpy(ctx->block + D - C, ctx->p, C);
+  ctx->mpos = 0;
+}
+
+int ETS(update_msg)(struct ets_ctx * _ctx, const void * _in, void * _out, size_t len) {
+  struct ETS(ctx) *ctx = (struct ETS(ctx) *)_ctx;
+  const uint8_t *in = _in;
+  uint8_t *out = _out;
+  size_t n;
+
+  ets_ctx_close_ad(ctx);
+  if (len > 0) {
+    ctx->has_msg = 1;
+  }
+
+  while (len > 0) {
+    if (ctx->mpos == 0) {
+      if (ctx->default_ad_block && len >= C) {
+        /* steady state, as in ETS(enc/dec): the block is kpad || previous chunk, which cf_ets_bulk keeps up to date */
+        n = len / C;
+        if (len >= ets_stream_threshold()) {
+          ets_bulk_stream(ctx->st, ctx->block, ctx->t, out, in, n, ctx->decrypt);
+        }
+        else {
+          cf_ets_bulk(ctx->st, ctx->block, ctx->t, out, in, n, ctx->decrypt);
+        }
+        ctx->t += n;
+        in += n * C, out += n * C, len -= n * C;
+        continue;
+      }
+      if (len >= C) {
+        /* a whole chunk at once, the key stream need not be kept */
+        if (! ctx->decrypt) {
+          memcpy(ctx->p, in, C);
+        }
+        cf_update_xor(ctx->st, ctx->block, ctx->t++, out, in, C);
+        if (ctx->decrypt) {
+          memcpy(ctx->p, out, C);
+        }
+        in += C, out += C, len -= C;
+        ets_ctx_next_block(ctx);
+        continue;
+      }
+      cf_update(ctx->st, ctx->block, ctx->t++, 0);
+      cf_export(ctx->st, ctx->x);
+    }
+
+    n = (len < C - ctx->mpos) ? len : C - ctx->mpos;
+    if (! ctx->decrypt) {
+      memcpy(ctx->p + ctx->mpos, in, n); /* before out is written, in == out is allowed */
+    }
+    memxor3(out, in, ctx->x + ctx->mpos, n);
+    if (ctx->decrypt) {
+      memcpy(ctx->p + ctx->mpos, out, n);
+    }
+    ctx->mpos += n;
+    in += n, out += n, len -= n;
+
+    if (ctx->mpos == C) {
+      ets_ctx_next_block(ctx);
+    }
+  }
+
+  return 0;
+}
+
+/* the remaining compressions of ETS(enc/dec) after the message loop; leaves the full tag in buf */
+static void ets_ctx_tag(struct ETS(ctx) *ctx, uint8_t *buf) {
+  uint8_t *block = ctx->block;
+  size_t mlen = ctx->mpos, mlen_rup, i;
+  int m_padded = ! ctx->has_msg;
+
+  ets_ctx_close_ad(ctx);
+
+  if (0 < mlen /* && mlen < C */) {
+    mlen_rup = RUP_MAV(mlen + 1);
+    if (! ctx->ad_padded) {
+      ets_ctx_load_ad(ctx, D - mlen_rup);
+      memxor2(block, ctx->kpad, ctx->klen);
+    }
+    else {
+      memcpy(block, ctx->kpad, D - C);
+      memset(block + D - C, 0, C - mlen_rup);
+    }
+    memcpy(block + D - mlen_rup, ctx->p, mlen);
+    memset(block + D - mlen_rup + mlen, 0, mlen_rup - mlen - 1);
+    block[D - 1] = mlen; /* requires C <= 256 (bytes) */
+    m_padded = 1;
+  }
+
+  if (! ctx->ad_padded && ctx->adlen > 0) {
+    cf_update(ctx->st, block, ctx->t++, 1);
+
+    while (ctx->adlen > D) {
+      if (ctx->adv->iov_len - ctx->adoff > D) {
+        /* within a fragment, no need to gather (this leaves the cursor in the fragment) */
+        cf_update(ctx->st, (const uint8_t *)ctx->adv->iov_base + ctx->adoff, ctx->t++, 0);
+        ctx->adoff += D;
+      }
+      else {
+        ets_iov_read(&ctx->adv, &ctx->adoff, block, D);
+        cf_update(ctx->st, block, ctx->t++, 0);
+      }
+      ctx->adlen -= D;
+    }
+    ets_ctx_load_ad(ctx, D);
+  }
+
+  cf_update(ctx->st, block, ctx->t++, m_padded);
+  cf_export(ctx->st, buf);
+
+  if (ctx->ad_padded) {
+    for (i = 0; i < C; i++) {
+      buf[i] ^= 0xa5;
+    }
+  }
+}
+
+int ETS(enc_final)(struct ets_ctx * _ctx, void *tag) {
+  struct ETS(ctx) *ctx = (struct ETS(ctx) *)_ctx;
+  uint8_t buf[C];
+
+  ets_ctx_tag(ctx, buf);
+  memcpy(tag, buf, ctx->taglen);
+  ets_ctx_destroy(ctx);
+
+  return 0;
+}
+
+int ETS(dec_final)(struct ets_ctx * _ctx, const void *tag, int fail_if_invalid, int *is_valid) {
+  struct ETS(ctx) *ctx = (struct ETS(ctx) *)_ctx;
+  uint8_t buf[C];
+  size_t taglen = ctx->taglen;
+
+  ets_ctx_tag(ctx, buf);
+  ets_ctx_destroy(ctx);
+
+  return ets_check_tag(buf, tag, taglen, fail_if_invalid, is_valid);
+}
+
+/*
+  Scatter-gather: the AD is gathered into the blocks straight from its fragments, and the message is processed
+  piece by piece along the fragments of in and out, as by ETS(update_msg). Leaves the full tag in buf.
+*/
+static int ets_cryptv(size_t klen, const void *k, const struct iovec *ad, int adcnt, const struct iovec *in, int incnt, const struct iovec *out, int outcnt, size_t taglen, uint8_t *buf, int decrypt) {
+  struct ETS(ctx) ctx;
+  size_t adlen = ets_iov_len(ad, adcnt), mlen = ets_iov_len(in, incnt), inoff = 0, outoff = 0, n;
+
+  if (! CHECK_PARAMS_ENCDEC(klen, adlen, mlen, ets_iov_len(out, outcnt), taglen)) {
+    return -1;
+  }
+
+  ets_ctx_setup(&ctx, klen, k, taglen, decrypt);
+  ctx.adv = ad, ctx.adlen = adlen;
+  ets_ctx_close_ad(&ctx);
+
+  while (mlen > 0) {
+    while (inoff == in->iov_len) {
+      in++, inoff = 0;
+    }
+    while (outoff == out->iov_len) {
+      out++, outoff = 0;
+    }
+    n = in->iov_len - inoff;
+    n = (n < out->iov_len - outoff) ? n : out->iov_len - outoff;
+    ETS(update_msg)((struct ets_ctx *)&ctx, (const uint8_t *)in->iov_base + inoff, (uint8_t *)out->iov_base + outoff, n);
+    inoff += n, outoff += n, mlen -= n;
+  }
+
+  ets_ctx_tag(&ctx, buf);
+  return 0;
+}
+
+int ETS(encv)(size_t klen, const void *k, const struct iovec *ad, int adcnt, const struct iovec *m, int mcnt, const struct iovec *c, int ccnt, size_t taglen, void *tag) {
+  uint8_t buf[C];
+
+  if (adcnt < 0 || mcnt < 0 || ccnt < 0) {
+    return -1;
+  }
+
+  if (adcnt <= 1 && mcnt <= 1 && ccnt <= 1) {
+    /* nothing to gather */
+    return ETS(enc)(klen, k, adcnt ? ad->iov_len : 0, adcnt ? ad->iov_base : NULL, mcnt ? m->iov_len : 0, mcnt ? m->iov_base : NULL, ccnt ? c->iov_len : 0, ccnt ? c->iov_base : NULL, taglen, tag);
+  }
+
+  if (ets_cryptv(klen, k, ad, adcnt, m, mcnt, c, ccnt, taglen, buf, 0)) {
+    return -1;
+  }
+  memcpy(tag, buf, taglen);
+  return 0;
+}
+
+int ETS(decv)(size_t klen, const void *k, const struct iovec *ad, int adcnt, const struct iovec *c, int ccnt, size_t taglen, const void *tag, const struct iovec *m, int mcnt, int fail_if_invalid, int *is_valid) {
+  uint8_t buf[C];
+
+  if (adcnt < 0 || mcnt < 0 || ccnt < 0) {
+    return -1;
+  }
+
+  if (adcnt <= 1 && mcnt <= 1 && ccnt <= 1) {
+    return ETS(dec)(klen, k, adcnt ? ad->iov_len : 0, adcnt ? ad->iov_base : NULL, ccnt ? c->iov_len : 0, ccnt ? c->iov_base : NULL, taglen, tag, mcnt ? m->iov_len : 0, mcnt ? m->iov_base : NULL, fail_if_invalid, is_valid);
+  }
+
+  if (ets_cryptv(klen, k, ad, adcnt, c, ccnt, m, mcnt, taglen, buf, 1)) {
+    return -1;
+  }
+  return ets_check_tag(buf, tag, taglen, fail_if_invalid, is_valid);
+}
+
+/*
+  Snapshots of a context at a block boundary (all message chunks complete), for checkpoint/resume and append.
+  Format, version 1: 'E' 'T' 'S' CF_ID, version, flags, klen, taglen, t (8 bytes), chaining value
+  (CF_MEMSTATESIZE bytes), next block with the key removed (D bytes), length of the AD not absorbed yet (8 bytes),
+  that AD. Integers are little-endian; the chaining value is the compression function's state in memory. The block
+  holds the last message chunk in plaintext, so snapshots are as sensitive as the plaintext.
+*/
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER (4 + 4 + 8 + CF_MEMSTATESIZE + D + 8)
+
+enum { SNAPSHOT_DECRYPT = 1, SNAPSHOT_HAS_MSG = 2, SNAPSHOT_AD_CLOSED = 4, SNAPSHOT_AD_PADDED = 8, SNAPSHOT_DEFAULT_AD_BLOCK = 16 };
+
+static void ets_store64(uint8_t *p, unsigned long long int x) {
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    p[i] = (uint8_t)(x >> (8 * i));
+  }
+}
+
+static unsigned long long int ets_load64(const uint8_t *p) {
+  unsigned long long int x = 0;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    x |= (unsigned long long int)p[i] << (8 * i);
+  }
+  return x;
+}
+
+size_t ETS(snapshot_size)(const struct ets_ctx * _ctx) {
+  const struct ETS(ctx) *ctx = (const struct ETS(ctx) *)_ctx;
+
+  return SNAPSHOT_HEADER + ctx->adlen;
+}
+
+int ETS(snapshot)(const struct ets_ctx * _ctx, void * _buf) {
+  const struct ETS(ctx) *ctx = (const struct ETS(ctx) *)_ctx;
+  uint8_t *buf = _buf;
+  const struct iovec *adv;
+  size_t adoff;
+
+  if (ctx->mpos != 0) {
+    return -1;
+  }
+
+  buf[0] = 'E', buf[1] = 'T', buf[2] = 'S', buf[3] = CF_ID;
+  buf[4] = SNAPSHOT_VERSION;
+  buf[5] = (ctx->decrypt ? SNAPSHOT_DECRYPT : 0) | (ctx->has_msg ? SNAPSHOT_HAS_MSG : 0) | (ctx->ad_closed ? SNAPSHOT_AD_CLOSED : 0) | (ctx->ad_padded ? SNAPSHOT_AD_PADDED : 0) | (ctx->default_ad_block ? SNAPSHOT_DEFAULT_AD_BLOCK : 0);
+  buf[6] = ctx->klen;
+  buf[7] = ctx->taglen;
+  ets_store64(buf + 8, ctx->t);
+  buf += 16;
+  memcpy(buf, ctx->st, CF_MEMSTATESIZE);
+  buf += CF_MEMSTATESIZE;
+  memcpy(buf, ctx->block, D);
+  if (ctx->ad_closed) {
+    memxor2(buf, ctx->kpad, ctx->klen);
+  }
+  buf += D;
+  ets_store64(buf, ctx->adlen);
+  buf += 8;
+  if (ctx->adlen > 0) {
+    adv = ctx->adv, adoff = ctx->adoff;
+    ets_iov_read(&adv, &adoff, buf, ctx->adlen);
+  }
+
+  return 0;
+}
+
+struct ets_ctx *ETS(resume)(const void * _buf, size_t len, size_t klen, const void *k) {
+  const uint8_t *buf = _buf;
+  struct ETS(ctx) *ctx;
+  unsigned long long int adlen;
+  int flags;
+
+  if (len < SNAPSHOT_HEADER || buf[0] != 'E' || buf[1] != 'T' || buf[2] != 'S' || buf[3] != CF_ID || buf[4] != SNAPSHOT_VERSION || buf[6] != klen) {
+    return NULL;
+  }
+  adlen = ets_load64(buf + SNAPSHOT_HEADER - 8);
+  if (adlen != len - SNAPSHOT_HEADER) {
+    return NULL;
+  }
+  flags = buf[5];
+
+  ctx = ets_ctx_init(klen, k, buf[7], flags & SNAPSHOT_DECRYPT);
+  if (ctx == NULL) {
+    return NULL;
+  }
+  ctx->has_msg = !! (flags & SNAPSHOT_HAS_MSG);
+  ctx->ad_closed = !! (flags & SNAPSHOT_AD_CLOSED);
+  ctx->ad_padded = !! (flags & SNAPSHOT_AD_PADDED);
+  ctx->default_ad_block = !! (flags & SNAPSHOT_DEFAULT_AD_BLOCK);
+  ctx->t = ets_load64(buf + 8);
+  buf += 16;
+  memcpy(ctx->st, buf, CF_MEMSTATESIZE);
+  buf += CF_MEMSTATESIZE;
+  memcpy(ctx->block, buf, D);
+  if (ctx->ad_closed) {
+    memxor2(ctx->block, ctx->kpad, ctx->klen);
+  }
+  buf += D + 8;
+  if (adlen > 0) {
+    ctx->adbuf = malloc(adlen);
+    if (ctx->adbuf == NULL) {
+      ets_ctx_destroy(ctx);
+      return NULL;
+    }
+    memcpy(ctx->adbuf, buf, adlen);
+    ctx->adcap = ctx->adlen = adlen;
+    ctx->adbuf_iov.iov_base = ctx->adbuf, ctx->adbuf_iov.iov_len = adlen;
+  }
+
+  return (struct ets_ctx *)ctx;
+}
+
+#endif /* ETS_IMPL_H */
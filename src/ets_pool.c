@@ -0,0 +1,364 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _GNU_SOURCE /* activates  pthread_setaffinity_np  and the CPU_SET macros */
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ets.h"
+#include "ets_pool.h"
+
+#define POOL_LARGE ((size_t)1 << 20) /* records of this many bytes (AD and message) on are tasks of their own */
+#define POOL_RECORD_COST 256 /* per-record overhead, in bytes of AD and message */
+#define POOL_GROUP_MIN ((size_t)16 << 10) /* limits for the size of the groups of small records ... */
+#define POOL_GROUP_MAX ((size_t)256 << 10)
+#define POOL_GROUPS_PER_WORKER 8 /* ... within which there are this many groups per worker, for stealing */
+
+/* records first .. first + n - 1 of the batch */
+struct ets_pool_task {
+  size_t first, n;
+  size_t weight;
+};
+
+struct ets_pool_worker {
+  struct ets_pool *pool;
+  int id;
+  pthread_t thread;
+  pthread_mutex_t lock; /* guards head and tail */
+  size_t head, tail; /* the deque: tasks id + k * nthreads, for head <= k < tail */
+  int failed;
+  struct ets_pool_stats stats; /* run_ns is kept by the pool */
+};
+
+struct ets_pool {
+  int n;
+  int affinity;
+  struct ets_pool_worker *workers;
+  pthread_mutex_t run_lock; /* one batch at a time */
+  pthread_mutex_t lock; /* guards generation, shutdown and busy */
+  pthread_cond_t work, done;
+  unsigned long long int generation; /* incremented for each batch */
+  int shutdown;
+  int busy; /* workers still on the current batch */
+  /* the current batch */
+  ets_enc_batch fn;
+  const struct ets_batch *batch;
+  struct ets_pool_task *tasks;
+  size_t ntasks, tasks_cap;
+  unsigned long long int run_ns;
+};
+
+static unsigned long long int ets_pool_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long int)ts.tv_sec * 1000000000ULL + (unsigned long long int)ts.tv_nsec;
+}
+
+static size_t ets_pool_weight(const struct ets_batch *b, size_t i) {
+  return b->adlen[i] + b->len[i] + POOL_RECORD_COST;
+}
+
+/* pins the calling worker to the id-th CPU of the process */
+static void ets_pool_pin(int id) {
+#ifdef __linux__
+  cpu_set_t allowed, set;
+  int cpu, count;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+    return;
+  }
+  id %= CPU_COUNT(&allowed);
+  for (cpu = 0, count = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed) && count++ == id) {
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set); /* best effort */
+      return;
+    }
+  }
+#else
+  (void)id;
+#endif
+}
+
+/* next task of worker w's own deque (largest first), or of another's (smallest first); NULL once all are empty */
+static const struct ets_pool_task *ets_pool_next(struct ets_pool *pool, struct ets_pool_worker *w) {
+  struct ets_pool_worker *v;
+  size_t k;
+  int i, found;
+
+  pthread_mutex_lock(&w->lock);
+  found = (w->head < w->tail);
+  k = found ? w->head++ : 0;
+  pthread_mutex_unlock(&w->lock);
+  if (found) {
+    return &pool->tasks[w->id + k * pool->n];
+  }
+
+  for (i = 1; i < pool->n; i++) {
+    v = &pool->workers[(w->id + i) % pool->n];
+    pthread_mutex_lock(&v->lock);
+    found = (v->head < v->tail);
+    k = found ? --v->tail : 0;
+    pthread_mutex_unlock(&v->lock);
+    if (found) {
+      w->stats.steals++;
+      return &pool->tasks[v->id + k * pool->n];
+    }
+  }
+  return NULL;
+}
+
+static void ets_pool_work(struct ets_pool *pool, struct ets_pool_worker *w) {
+  const struct ets_batch *b = pool->batch;
+  const struct ets_pool_task *task;
+  struct ets_batch sub;
+  unsigned long long int start;
+
+  while ((task = ets_pool_next(pool, w)) != NULL) {
+    sub.n = task->n;
+    sub.klen = b->klen + task->first, sub.k = b->k + task->first;
+    sub.adlen = b->adlen + task->first, sub.ad = b->ad + task->first;
+    sub.len = b->len + task->first, sub.in = b->in + task->first, sub.out = b->out + task->first;
+    sub.taglen = b->taglen + task->first, sub.tag = b->tag + task->first;
+    sub.status = b->status + task->first;
+
+    start = ets_pool_now();
+    if ((*pool->fn)(&sub) != 0) {
+      w->failed = 1;
+    }
+    w->stats.busy_ns += ets_pool_now() - start;
+    w->stats.tasks++;
+    w->stats.records += task->n;
+    w->stats.bytes += task->weight - task->n * POOL_RECORD_COST;
+  }
+}
+
+static void *ets_pool_worker_main(void *arg) {
+  struct ets_pool_worker *w = arg;
+  struct ets_pool *pool = w->pool;
+  unsigned long long int seen = 0;
+
+  if (pool->affinity) {
+    ets_pool_pin(w->id);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == seen && ! pool->shutdown) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    if (pool->shutdown) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    ets_pool_work(pool, w);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/* stops and joins the first n workers */
+static void ets_pool_stop(struct ets_pool *pool, int n) {
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < n; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  for (i = 0; i < pool->n; i++) {
+    pthread_mutex_destroy(&pool->workers[i].lock);
+  }
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->run_lock);
+  free(pool->tasks);
+  free(pool->workers);
+  free(pool);
+}
+
+struct ets_pool *ets_pool_create(int nthreads, int affinity) {
+  struct ets_pool *pool;
+  int i;
+
+  if (nthreads < 1) {
+    return NULL;
+  }
+
+  pool = malloc(sizeof(*pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+  memset(pool, 0, sizeof(*pool));
+  pool->workers = calloc(nthreads, sizeof(*pool->workers));
+  if (pool->workers == NULL) {
+    free(pool);
+    return NULL;
+  }
+  pool->n = nthreads;
+  pool->affinity = affinity;
+  pthread_mutex_init(&pool->run_lock, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (i = 0; i < nthreads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].id = i;
+    pthread_mutex_init(&pool->workers[i].lock, NULL);
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&pool->workers[i].thread, NULL, ets_pool_worker_main, &pool->workers[i]) != 0) {
+      ets_pool_stop(pool, i);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+void ets_pool_destroy(struct ets_pool *pool) {
+  if (pool != NULL) {
+    ets_pool_stop(pool, pool->n);
+  }
+}
+
+static int ets_pool_task_cmp(const void *a, const void *b) {
+  size_t wa = ((const struct ets_pool_task *)a)->weight, wb = ((const struct ets_pool_task *)b)->weight;
+
+  return (wa < wb) - (wa > wb); /* largest first */
+}
+
+/* cuts the batch into tasks, largest first; -1 if out of memory */
+static int ets_pool_split(struct ets_pool *pool, const struct ets_batch *b) {
+  struct ets_pool_task *task;
+  size_t i, w, total, group;
+
+  if (b->n > pool->tasks_cap) {
+    task = realloc(pool->tasks, b->n * sizeof(*task));
+    if (task == NULL) {
+      return -1;
+    }
+    pool->tasks = task;
+    pool->tasks_cap = b->n;
+  }
+
+  /* small records: groups large enough to amortize the call, yet enough of them to go round */
+  total = 0;
+  for (i = 0; i < b->n; i++) {
+    w = ets_pool_weight(b, i);
+    total += (w < POOL_LARGE) ? w : 0;
+  }
+  group = total / ((size_t)pool->n * POOL_GROUPS_PER_WORKER);
+  group = (group < POOL_GROUP_MIN) ? POOL_GROUP_MIN : (group > POOL_GROUP_MAX) ? POOL_GROUP_MAX : group;
+
+  pool->ntasks = 0;
+  task = NULL; /* the open group */
+  for (i = 0; i < b->n; i++) {
+    w = ets_pool_weight(b, i);
+    if (w >= POOL_LARGE) {
+      pool->tasks[pool->ntasks].first = i;
+      pool->tasks[pool->ntasks].n = 1;
+      pool->tasks[pool->ntasks].weight = w;
+      pool->ntasks++;
+      task = NULL; /* the group must not span the large record */
+      continue;
+    }
+    if (task == NULL) {
+      task = &pool->tasks[pool->ntasks++];
+      task->first = i;
+      task->n = 0;
+      task->weight = 0;
+    }
+    task->n++;
+    task->weight += w;
+    if (task->weight >= group) {
+      task = NULL;
+    }
+  }
+
+  qsort(pool->tasks, pool->ntasks, sizeof(*pool->tasks), ets_pool_task_cmp);
+  return 0;
+}
+
+int ets_pool_run(struct ets_pool *pool, ets_enc_batch fn, const struct ets_batch *batch) {
+  unsigned long long int start;
+  int i, failed;
+
+  pthread_mutex_lock(&pool->run_lock);
+  start = ets_pool_now();
+
+  if (ets_pool_split(pool, batch) != 0) {
+    pthread_mutex_unlock(&pool->run_lock);
+    return -1;
+  }
+
+  /* deal the tasks round-robin: worker i gets tasks i, i + n, i + 2n, ... */
+  for (i = 0; i < pool->n; i++) {
+    pool->workers[i].head = 0;
+    pool->workers[i].tail = (pool->ntasks > (size_t)i) ? (pool->ntasks - i + pool->n - 1) / pool->n : 0;
+    pool->workers[i].failed = 0;
+  }
+  pool->fn = fn;
+  pool->batch = batch;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->generation++;
+  pool->busy = pool->n;
+  pthread_cond_broadcast(&pool->work);
+  while (pool->busy > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  failed = 0;
+  for (i = 0; i < pool->n; i++) {
+    failed |= pool->workers[i].failed;
+  }
+  pool->run_ns += ets_pool_now() - start;
+
+  pthread_mutex_unlock(&pool->run_lock);
+  return failed ? -1 : 0;
+}
+
+int ets_pool_stats(struct ets_pool *pool, int i, struct ets_pool_stats *stats) {
+  if (i < 0 || i >= pool->n) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&pool->run_lock);
+  *stats = pool->workers[i].stats;
+  stats->run_ns = pool->run_ns;
+  pthread_mutex_unlock(&pool->run_lock);
+
+  return 0;
+}
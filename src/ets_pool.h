@@ -0,0 +1,59 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef ETS_POOL_H
+#define ETS_POOL_H
+
+#include <stddef.h>
+#include "ets.h"
+
+/*
+  Optional thread pool for batches (struct ets_batch, see ets.h); link with -pthread.
+
+  ets_pool_run cuts the batch into tasks, one per large record and one per group of consecutive small records, and
+  has the workers of the pool process them with the given batch function (e.g. blake2ets_enc_batch, or a _dec_batch
+  function). Each worker has a deque of its own, dealt largest task first; a worker whose deque runs empty steals
+  from the back of the others', so that a batch mixing tiny and huge records keeps all workers busy.
+
+  - ets_pool_create(nthreads, affinity) starts nthreads >= 1 workers; if affinity is nonzero, worker i is pinned to
+    the i-th CPU the process may run on (modulo their number; Linux only, ignored elsewhere). NULL is returned if
+    nthreads < 1 or the threads cannot be started.
+
+  - ets_pool_run returns once the whole batch is done, with status[] as set by fn, and returns 0 if all records are
+    OK, -1 otherwise (or if out of memory, with no record processed). The pool runs one batch at a time: concurrent
+    calls wait for each other.
+
+  - ets_pool_stats stores the counters of worker i (cumulative since ets_pool_create) in *stats, -1 if there is no
+    such worker. busy_ns / run_ns is the utilization of the worker.
+*/
+
+struct ets_pool;
+
+struct ets_pool_stats {
+  unsigned long long int run_ns; /* wall time spent in ets_pool_run, the same for all workers */
+  unsigned long long int busy_ns; /* time spent processing tasks */
+  unsigned long long int tasks; /* tasks processed */
+  unsigned long long int steals; /* tasks taken from the deques of other workers (included in tasks) */
+  unsigned long long int records;
+  unsigned long long int bytes; /* AD and message */
+};
+
+struct ets_pool *ets_pool_create(int nthreads, int affinity);
+void ets_pool_destroy(struct ets_pool *pool);
+int ets_pool_run(struct ets_pool *pool, ets_enc_batch fn, const struct ets_batch *batch);
+int ets_pool_stats(struct ets_pool *pool, int i, struct ets_pool_stats *stats);
+
+#endif /* ETS_POOL_H */
@@ -0,0 +1,52 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdlib.h>
+#include "ets.h"
+#include "cpu.h"
+
+/*
+  Message size from which the modes write their output with memcpy_stream, see ets.h: the value of the last
+  ets_set_stream_threshold, else that of the environment variable, read on first use.
+*/
+
+#define STREAM_THRESHOLD_DEFAULT ((size_t)4 << 20)
+
+static size_t stream_threshold, stream_threshold_env;
+static int stream_threshold_set = 0, stream_threshold_env_read = 0;
+
+size_t ets_stream_threshold(void) {
+  const char *env;
+  size_t threshold;
+
+  if (ATOMIC_LOAD_ACQUIRE(&stream_threshold_set)) {
+    return ATOMIC_LOAD_ACQUIRE(&stream_threshold);
+  }
+  if (ATOMIC_LOAD_ACQUIRE(&stream_threshold_env_read)) {
+    return ATOMIC_LOAD_ACQUIRE(&stream_threshold_env);
+  }
+
+  env = getenv("ETS_STREAM_THRESHOLD");
+  threshold = (env != NULL && *env != '\0') ? (size_t)strtoull(env, NULL, 10) : STREAM_THRESHOLD_DEFAULT;
+  ATOMIC_STORE_RELEASE(&stream_threshold_env, threshold);
+  ATOMIC_STORE_RELEASE(&stream_threshold_env_read, 1);
+  return threshold;
+}
+
+void ets_set_stream_threshold(size_t threshold) {
+  ATOMIC_STORE_RELEASE(&stream_threshold, threshold);
+  ATOMIC_STORE_RELEASE(&stream_threshold_set, 1);
+}
@@ -0,0 +1,229 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "memxor.h"
+#include "cpu.h"
+
+#if HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* 64-bit words through memcpy, which compiles to plain unaligned loads and stores, then single bytes */
+static void memxor3_ref(void * _dst, const void * _srcA, const void * _srcB, size_t num) {
+  uint8_t *dst = _dst;
+  const uint8_t *srcA = _srcA;
+  const uint8_t *srcB = _srcB;
+  uint64_t a, b;
+
+  for ( ; num >= 8; num -= 8) {
+    memcpy(&a, srcA, 8);
+    memcpy(&b, srcB, 8);
+    a ^= b;
+    memcpy(dst, &a, 8);
+    dst += 8, srcA += 8, srcB += 8;
+  }
+  while (num--) {
+    *dst++ = *srcA++ ^ *srcB++;
+  }
+}
+
+static void memcpy_stream_ref(void *dst, const void *src, size_t num) {
+  memcpy(dst, src, num);
+}
+
+#if HAVE_X86_SIMD
+
+/*
+  The non-temporal stores need aligned destinations: the head up to the first aligned address and the tail
+  go through memcpy. The sfence orders the streaming stores before any later store.
+*/
+
+TARGET("sse2")
+static void memcpy_stream_sse2(void * _dst, const void * _src, size_t num) {
+  uint8_t *dst = _dst;
+  const uint8_t *src = _src;
+  size_t head = (size_t)(-(uintptr_t)dst & 15);
+
+  if (num < head + 16) {
+    memcpy(dst, src, num);
+    return;
+  }
+  memcpy(dst, src, head);
+  dst += head, src += head, num -= head;
+
+  for ( ; num >= 16; num -= 16) {
+    _mm_stream_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+    dst += 16, src += 16;
+  }
+  _mm_sfence();
+  memcpy(dst, src, num);
+}
+
+TARGET("avx2")
+static void memcpy_stream_avx2(void * _dst, const void * _src, size_t num) {
+  uint8_t *dst = _dst;
+  const uint8_t *src = _src;
+  size_t head = (size_t)(-(uintptr_t)dst & 31);
+
+  if (num < head + 32) {
+    memcpy(dst, src, num);
+    return;
+  }
+  memcpy(dst, src, head);
+  dst += head, src += head, num -= head;
+
+  for ( ; num >= 32; num -= 32) {
+    _mm256_stream_si256((__m256i *)dst, _mm256_loadu_si256((const __m256i *)src));
+    dst += 32, src += 32;
+  }
+  _mm_sfence();
+  memcpy(dst, src, num);
+}
+
+TARGET("avx512f")
+static void memcpy_stream_avx512(void * _dst, const void * _src, size_t num) {
+  uint8_t *dst = _dst;
+  const uint8_t *src = _src;
+  size_t head = (size_t)(-(uintptr_t)dst & 63);
+
+  if (num < head + 64) {
+    memcpy(dst, src, num);
+    return;
+  }
+  memcpy(dst, src, head);
+  dst += head, src += head, num -= head;
+
+  for ( ; num >= 64; num -= 64) {
+    _mm512_stream_si512((void *)dst, _mm512_loadu_si512(src));
+    dst += 64, src += 64;
+  }
+  _mm_sfence();
+  memcpy(dst, src, num);
+}
+
+TARGET("sse2")
+static void memxor3_sse2(void * _dst, const void * _srcA, const void * _srcB, size_t num) {
+  uint8_t *dst = _dst;
+  const uint8_t *srcA = _srcA;
+  const uint8_t *srcB = _srcB;
+
+  for ( ; num >= 16; num -= 16) {
+    _mm_storeu_si128((__m128i *)dst, _mm_xor_si128(_mm_loadu_si128((const __m128i *)srcA), _mm_loadu_si128((const __m128i *)srcB)));
+    dst += 16, srcA += 16, srcB += 16;
+  }
+  memxor3_ref(dst, srcA, srcB, num);
+}
+
+TARGET("avx2")
+static void memxor3_avx2(void * _dst, const void * _srcA, const void * _srcB, size_t num) {
+  uint8_t *dst = _dst;
+  const uint8_t *srcA = _srcA;
+  const uint8_t *srcB = _srcB;
+
+  for ( ; num >= 32; num -= 32) {
+    _mm256_storeu_si256((__m256i *)dst, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)srcA), _mm256_loadu_si256((const __m256i *)srcB)));
+    dst += 32, srcA += 32, srcB += 32;
+  }
+  if (num >= 16) {
+    _mm_storeu_si128((__m128i *)dst, _mm_xor_si128(_mm_loadu_si128((const __m128i *)srcA), _mm_loadu_si128((const __m128i *)srcB)));
+    dst += 16, srcA += 16, srcB += 16, num -= 16;
+  }
+  memxor3_ref(dst, srcA, srcB, num);
+}
+
+/* the tail below 64 bytes goes through one masked operation on whole 64-bit words (AVX-512F has no byte masks) */
+TARGET("avx512f")
+static void memxor3_avx512(void * _dst, const void * _srcA, const void * _srcB, size_t num) {
+  uint8_t *dst = _dst;
+  const uint8_t *srcA = _srcA;
+  const uint8_t *srcB = _srcB;
+  __mmask8 mask;
+
+  for ( ; num >= 64; num -= 64) {
+    _mm512_storeu_si512(dst, _mm512_xor_si512(_mm512_loadu_si512(srcA), _mm512_loadu_si512(srcB)));
+    dst += 64, srcA += 64, srcB += 64;
+  }
+  if (num >= 8) {
+    mask = (__mmask8)((1U << (num / 8)) - 1);
+    _mm512_mask_storeu_epi64(dst, mask, _mm512_xor_si512(_mm512_maskz_loadu_epi64(mask, srcA), _mm512_maskz_loadu_epi64(mask, srcB)));
+    dst += num & ~(size_t)7, srcA += num & ~(size_t)7, srcB += num & ~(size_t)7, num &= 7;
+  }
+  while (num--) {
+    *dst++ = *srcA++ ^ *srcB++;
+  }
+}
+
+#endif /* HAVE_X86_SIMD */
+
+const struct memxor_kernel memxor_kernels[] = {
+#if HAVE_X86_SIMD
+  { "avx512", CPU_AVX512, memxor3_avx512, memcpy_stream_avx512 },
+  { "avx2", CPU_AVX2, memxor3_avx2, memcpy_stream_avx2 },
+  { "sse2", CPU_SSE2, memxor3_sse2, memcpy_stream_sse2 },
+#endif
+  { "ref", 0, memxor3_ref, memcpy_stream_ref },
+};
+
+static const struct memxor_kernel *memxor_select(void) {
+  const struct memxor_kernel *kernel = memxor_kernels;
+  unsigned int features = cpu_features();
+
+  while ((kernel->features & features) != kernel->features) {
+    kernel++;
+  }
+  return kernel;
+}
+
+static void memxor3_bind(void *dst, const void *srcA, const void *srcB, size_t num);
+static void memcpy_stream_bind(void *dst, const void *src, size_t num);
+
+static memxor3_fn memxor3_impl = memxor3_bind;
+static memcpy_stream_fn memcpy_stream_impl = memcpy_stream_bind;
+
+static void memxor_bind(void) {
+  const struct memxor_kernel *kernel = memxor_select();
+  ATOMIC_STORE_RELEASE(&memxor3_impl, kernel->xor3);
+  ATOMIC_STORE_RELEASE(&memcpy_stream_impl, kernel->copy_stream);
+}
+
+/* first call only: bind memxor2/memxor3/memcpy_stream to the best kernel, then forward */
+static void memxor3_bind(void *dst, const void *srcA, const void *srcB, size_t num) {
+  memxor_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&memxor3_impl))(dst, srcA, srcB, num);
+}
+
+static void memcpy_stream_bind(void *dst, const void *src, size_t num) {
+  memxor_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&memcpy_stream_impl))(dst, src, num);
+}
+
+void memxor3(void *dst, const void *srcA, const void *srcB, size_t num) {
+  (*ATOMIC_LOAD_ACQUIRE(&memxor3_impl))(dst, srcA, srcB, num);
+}
+
+void memxor2(void *dst, const void *src, size_t num) {
+  (*ATOMIC_LOAD_ACQUIRE(&memxor3_impl))(dst, dst, src, num);
+}
+
+void memcpy_stream(void *dst, const void *src, size_t num) {
+  (*ATOMIC_LOAD_ACQUIRE(&memcpy_stream_impl))(dst, src, num);
+}
+
+const char *memxor_backend(void) {
+  return memxor_select()->name;
+}
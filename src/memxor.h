@@ -17,42 +17,48 @@
 #ifndef MEMXOR_H
 #define MEMXOR_H
 
-#define memxor3(_dst, _srcA, _srcB, _num) do {                          \
-    uint64_t *dst64; const uint64_t *src64A, *src64B;                   \
-    uint8_t *dst8; const uint8_t *src8A, *src8B;                        \
-    size_t num = (_num);                                                \
-    dst64 = (uint64_t *)(_dst);                                         \
-    src64A = (const uint64_t *)(_srcA);                                 \
-    src64B = (const uint64_t *)(_srcB);                                 \
-    if (((unsigned long)dst64 | (unsigned long)src64A | (unsigned long)src64B) % 8 == 0) { \
-      for ( ; num >= 8; num -= 8) {                                     \
-        *dst64++ = *src64A++ ^ *src64B++;                               \
-      }                                                                 \
-    }                                                                   \
-    dst8 = (uint8_t *)(dst64);                                          \
-    src8A = (const uint8_t *)(src64A);                                  \
-    src8B = (const uint8_t *)(src64B);                                  \
-    while (num--) {                                                     \
-      *dst8++ = *src8A++ ^ *src8B++;                                    \
-    }                                                                   \
-  } while (0)
-
-#define memxor2(_dst, _src, _num) do {                                  \
-    uint64_t *dst64; const uint64_t *src64;                             \
-    uint8_t *dst8; const uint8_t *src8;                                 \
-    size_t num = (_num);                                                \
-    dst64 = (uint64_t *)(_dst);                                         \
-    src64 = (const uint64_t *)(_src);                                   \
-    if (((unsigned long)dst64 | (unsigned long)src64) % 8 == 0) {       \
-      for ( ; num >= 8; num -= 8) {                                     \
-        *dst64++ ^= *src64++;                                           \
-      }                                                                 \
-    }                                                                   \
-    dst8 = (uint8_t *)(dst64);                                          \
-    src8 = (const uint8_t *)(src64);                                    \
-    while (num--) {                                                     \
-      *dst8++ ^= *src8++;                                               \
-    }                                                                   \
-  } while (0)
+#include <stddef.h>
+
+/*
+  dst = srcA XOR srcB, resp. dst ^= src, over num bytes; any alignment of the pointers.
+  dst may equal srcA (resp. src), other overlaps are not allowed.
+*/
+void memxor3(void *dst, const void *srcA, const void *srcB, size_t num);
+void memxor2(void *dst, const void *src, size_t num);
+
+/*
+  dst = src over num bytes, bypassing the cache with non-temporal stores where the CPU has them (plain memcpy
+  otherwise), for output that is not read again soon; no overlap allowed.
+*/
+void memcpy_stream(void *dst, const void *src, size_t num);
+
+/* hint that the num bytes at p are going to be read once, soon; never faults */
+static inline void mem_prefetch(const void *p, size_t num) {
+#if defined(__GNUC__)
+  const char *q = p;
+  size_t i;
+  for (i = 0; i < num; i += 64) {
+    __builtin_prefetch(q + i, 0, 0);
+  }
+#else
+  (void)p, (void)num;
+#endif
+}
+
+typedef void (*memxor3_fn)(void *dst, const void *srcA, const void *srcB, size_t num);
+typedef void (*memcpy_stream_fn)(void *dst, const void *src, size_t num);
+
+struct memxor_kernel {
+  const char *name;
+  unsigned int features; /* required CPU features, see cpu.h */
+  memxor3_fn xor3;
+  memcpy_stream_fn copy_stream;
+};
+
+/* best kernel first, terminated by the portable code (features == 0) */
+extern const struct memxor_kernel memxor_kernels[];
+
+/* name of the kernel memxor2/memxor3/memcpy_stream are bound to */
+const char *memxor_backend(void);
 
 #endif /* MEMXOR_H */
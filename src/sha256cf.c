@@ -16,40 +16,29 @@
 
 #define _DEFAULT_SOURCE /* activates  htobe32  and  be32toh  from endian.h */
 #include <stdint.h>
+#include <string.h>
 #include <endian.h>
 #include "sha256cf.h"
+#include "sha256cf_impl.h"
 
 _Static_assert(sizeof(uint32_t[8]) == SHA256CF_MEMSTATESIZE, "SHA256CF_MEMSTATESIZE has wrong value!");
 
-static const uint32_t k[64] = {
-  0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
-  0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
-  0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
-  0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
-  0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
-  0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
-  0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL,
-  0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
-  0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL,
-  0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
-  0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL,
-  0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
-  0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL,
-  0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
-  0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
-  0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL,
-};
-
 static const uint32_t iv[8] = {
   0x6a09e667UL, 0xbb67ae85UL, 0x3c6ef372UL, 0xa54ff53aUL,
   0x510e527fUL, 0x9b05688cUL, 0x1f83d9abUL, 0x5be0cd19UL,
 };
 
+/* position of words a..h in the memory state, see sha256cf_impl.h */
+static const uint8_t pos[8] = {
+  SHA256CF_POS_A, SHA256CF_POS_B, SHA256CF_POS_C, SHA256CF_POS_D,
+  SHA256CF_POS_E, SHA256CF_POS_F, SHA256CF_POS_G, SHA256CF_POS_H,
+};
+
 void sha256cf_init(void * _st) {
   uint32_t *st = _st;
   int i;
   for (i = 0; i < 8; i++) {
-    st[i] = iv[i];
+    st[pos[i]] = iv[i];
   }
 }
 
@@ -66,7 +55,7 @@ void sha256cf_export(const void * _st, void * _out) {
   uint32_t *out = _out;
   int i;
   for (i = 0; i < 8; i++) {
-    *out++ = htobe32(*st++);
+    *out++ = htobe32(st[pos[i]]);
   }
 }
 
@@ -78,26 +67,25 @@ void sha256cf_export(const void * _st, void * _out) {
 #define Ch(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
 #define Maj(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
 
-void sha256cf_update(void * _st, const void * _block) {
-  uint32_t *st = _st;
-  const uint32_t *block = _block;
+/* the compression proper, on words s[0..7] = a..h and message words m (host byte order) */
+static inline void sha256cf_compress(uint32_t s[8], const uint32_t m[16]) {
   uint32_t a, b, c, d, e, f, g, h;
   uint32_t w[16];
   uint32_t s0, s1, temp1, temp2;
   int i;
 
-  a = st[0];
-  b = st[1];
-  c = st[2];
-  d = st[3];
-  e = st[4];
-  f = st[5];
-  g = st[6];
-  h = st[7];
+  a = s[0];
+  b = s[1];
+  c = s[2];
+  d = s[3];
+  e = s[4];
+  f = s[5];
+  g = s[6];
+  h = s[7];
 
   for (i = 0; i < 16; i++) {
-    w[i] = be32toh(*block++);
-    temp1 = h + Sigma1(e) + Ch(e, f, g) + k[i] + w[i];
+    w[i] = m[i];
+    temp1 = h + Sigma1(e) + Ch(e, f, g) + sha256cf_k[i] + w[i];
     temp2 = Sigma0(a) + Maj(a, b, c);
     h = g;
     g = f;
@@ -115,7 +103,7 @@ void sha256cf_update(void * _st, const void * _block) {
     s1 = w[(i - 2 + 16) & 0x0f];
     s1 = sigma1(s1);
     w[i & 0x0f] += s0 + w[(i - 7 + 16) & 0x0f] + s1;
-    temp1 = h + Sigma1(e) + Ch(e, f, g) + k[i] + w[i & 0x0f];
+    temp1 = h + Sigma1(e) + Ch(e, f, g) + sha256cf_k[i] + w[i & 0x0f];
     temp2 = Sigma0(a) + Maj(a, b, c);
     h = g;
     g = f;
@@ -127,17 +115,283 @@ void sha256cf_update(void * _st, const void * _block) {
     a = temp1 + temp2;
   }
 
-  st[0] += a;
-  st[1] += b;
-  st[2] += c;
-  st[3] += d;
-  st[4] += e;
-  st[5] += f;
-  st[6] += g;
-  st[7] += h;
+  s[0] += a;
+  s[1] += b;
+  s[2] += c;
+  s[3] += d;
+  s[4] += e;
+  s[5] += f;
+  s[6] += g;
+  s[7] += h;
+}
+
+static void sha256cf_update_ref(void * _st, const void * _block) {
+  uint32_t *st = _st;
+  const uint8_t *block = _block;
+  uint32_t s[8], m[16], x;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    s[i] = st[pos[i]];
+  }
+  for (i = 0; i < 16; i++) {
+    memcpy(&x, block + 4 * i, 4); /* the block may be unaligned */
+    m[i] = be32toh(x);
+  }
+
+  sha256cf_compress(s, m);
+
+  for (i = 0; i < 8; i++) {
+    st[pos[i]] = s[i];
+  }
+}
+
+static void sha256cf_update_xor_ref(void * _st, const void *block, void * _out, const void * _in, size_t len) {
+  const uint32_t *st = _st;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint32_t w;
+  int i;
+
+  sha256cf_update_ref(_st, block);
+
+  if (len == SHA256CF_STATESIZE) {
+    for (i = 0; i < 8; i++) {
+      memcpy(&w, in + 4 * i, 4);
+      w ^= htobe32(st[pos[i]]);
+      memcpy(out + 4 * i, &w, 4);
+    }
+  }
+  else {
+    sha256cf_xor_state(st, out, in, len);
+  }
+}
+
+static void sha256cf_update_split_ref(void * _st, const void * _ad, const void * _key, const void * _msg, void * _out, const void * _in) {
+  uint32_t *st = _st;
+  const uint8_t *ad = _ad;
+  const uint8_t *key = _key;
+  const uint8_t *msg = _msg;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint32_t s[8], m[16];
+  uint32_t x, y;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    s[i] = st[pos[i]];
+  }
+  for (i = 0; i < 8; i++) {
+    memcpy(&x, ad + 4 * i, 4);
+    memcpy(&y, key + 4 * i, 4);
+    m[i] = be32toh(x ^ y);
+    memcpy(&x, msg + 4 * i, 4);
+    m[8 + i] = be32toh(x);
+  }
+
+  sha256cf_compress(s, m);
+
+  for (i = 0; i < 8; i++) {
+    st[pos[i]] = s[i];
+  }
+  for (i = 0; i < 8; i++) {
+    memcpy(&x, in + 4 * i, 4);
+    x ^= htobe32(s[i]);
+    memcpy(out + 4 * i, &x, 4);
+  }
+}
+
+static void sha256cf_ets_bulk_ref(void * _st, void * _block, void * _out, const void * _in, size_t nblocks, int decrypt) {
+  uint32_t *st = _st;
+  uint8_t *block = _block;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint32_t s[8], m[16];
+  uint32_t x, y;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    s[i] = st[pos[i]];
+  }
+  for (i = 0; i < 16; i++) {
+    memcpy(&x, block + 4 * i, 4);
+    m[i] = be32toh(x);
+  }
+
+  for ( ; nblocks > 0; nblocks--) {
+    sha256cf_compress(s, m);
+    for (i = 0; i < 8; i++) {
+      memcpy(&x, in + 4 * i, 4);
+      y = x ^ htobe32(s[i]);
+      memcpy(out + 4 * i, &y, 4);
+      m[8 + i] = be32toh(decrypt ? y : x); /* the plaintext, read before (encryption) or after (decryption) the store */
+    }
+    in += SHA256CF_STATESIZE, out += SHA256CF_STATESIZE;
+  }
+
+  for (i = 0; i < 8; i++) {
+    st[pos[i]] = s[i];
+    x = htobe32(m[8 + i]);
+    memcpy(block + 32 + 4 * i, &x, 4);
+  }
+}
+
+const struct sha256cf_kernel sha256cf_kernels[] = {
+#if HAVE_X86_SIMD
+  { "shani", CPU_SHA | CPU_SSE41, sha256cf_update_shani, sha256cf_update_xor_shani, sha256cf_update_split_shani, sha256cf_ets_bulk_shani },
+  /* single blocks stay scalar, only the bulk phase gets the multi-block message schedule */
+  { "avx2", CPU_AVX2, sha256cf_update_ref, sha256cf_update_xor_ref, sha256cf_update_split_ref, sha256cf_ets_bulk_avx2 },
+#endif
+  { "ref", 0, sha256cf_update_ref, sha256cf_update_xor_ref, sha256cf_update_split_ref, sha256cf_ets_bulk_ref },
+};
+
+static const struct sha256cf_kernel *sha256cf_select(void) {
+  const struct sha256cf_kernel *kernel = sha256cf_kernels;
+  unsigned int features = cpu_features();
+
+  while ((kernel->features & features) != kernel->features) {
+    kernel++;
+  }
+  return kernel;
+}
+
+static void sha256cf_update_bind(void *st, const void *block);
+static void sha256cf_update_xor_bind(void *st, const void *block, void *out, const void *in, size_t len);
+static void sha256cf_update_split_bind(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in);
+static void sha256cf_ets_bulk_bind(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
+
+static sha256cf_update_fn sha256cf_update_impl = sha256cf_update_bind;
+static sha256cf_update_xor_fn sha256cf_update_xor_impl = sha256cf_update_xor_bind;
+static sha256cf_update_split_fn sha256cf_update_split_impl = sha256cf_update_split_bind;
+static sha256cf_ets_bulk_fn sha256cf_ets_bulk_impl = sha256cf_ets_bulk_bind;
+
+static void sha256cf_bind(void) {
+  const struct sha256cf_kernel *kernel = sha256cf_select();
+  ATOMIC_STORE_RELEASE(&sha256cf_update_impl, kernel->update);
+  ATOMIC_STORE_RELEASE(&sha256cf_update_xor_impl, kernel->update_xor);
+  ATOMIC_STORE_RELEASE(&sha256cf_update_split_impl, kernel->update_split);
+  ATOMIC_STORE_RELEASE(&sha256cf_ets_bulk_impl, kernel->ets_bulk);
+}
+
+/* first call only: bind sha256cf_update(_xor/_split) and sha256cf_ets_bulk to the best kernel, then forward */
+static void sha256cf_update_bind(void *st, const void *block) {
+  sha256cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_impl))(st, block);
+}
+
+static void sha256cf_update_xor_bind(void *st, const void *block, void *out, const void *in, size_t len) {
+  sha256cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_xor_impl))(st, block, out, in, len);
+}
+
+static void sha256cf_update_split_bind(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in) {
+  sha256cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_split_impl))(st, ad, key, msg, out, in);
+}
+
+static void sha256cf_ets_bulk_bind(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt) {
+  sha256cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_ets_bulk_impl))(st, block, out, in, nblocks, decrypt);
+}
+
+void sha256cf_update(void *st, const void *block) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_impl))(st, block);
+}
+
+void sha256cf_update_xor(void *st, const void *block, void *out, const void *in, size_t len) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_xor_impl))(st, block, out, in, len);
+}
+
+void sha256cf_update_split(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_split_impl))(st, ad, key, msg, out, in);
+}
+
+void sha256cf_ets_bulk(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_ets_bulk_impl))(st, block, out, in, nblocks, decrypt);
+}
+
+const char *sha256cf_backend(void) {
+  return sha256cf_select()->name;
+}
+
+static void sha256cf_update_x8_ref(void *const st[8], const void *const block[8]) {
+  int j;
+
+  for (j = 0; j < 8; j++) {
+    sha256cf_update_ref(st[j], block[j]);
+  }
+}
+
+static void sha256cf_update_x16_ref(void *const st[16], const void *const block[16]) {
+  int j;
+
+  for (j = 0; j < 16; j++) {
+    sha256cf_update_ref(st[j], block[j]);
+  }
+}
+
+const struct sha256cf_mb_kernel sha256cf_mb_kernels[] = {
+#if HAVE_X86_SIMD
+  /* past a few KiB per record, SHA-NI in the single-record code catches up with the 16 AVX-512 lanes */
+  { "avx512+shani", CPU_AVX512 | CPU_SHA | CPU_SSE41, sha256cf_update_x8_shani, sha256cf_update_x16_avx512, 8192 },
+  { "avx512", CPU_AVX512, sha256cf_update_x8_avx512, sha256cf_update_x16_avx512, SIZE_MAX },
+  /* SHA-NI lanes run one after the other, as do the reference ones: the single-record code is as fast or faster */
+  { "shani", CPU_SHA | CPU_SSE41, sha256cf_update_x8_shani, sha256cf_update_x16_shani, 0 },
+  { "avx2", CPU_AVX2, sha256cf_update_x8_avx2, sha256cf_update_x16_avx2, SIZE_MAX },
+#endif
+  { "ref", 0, sha256cf_update_x8_ref, sha256cf_update_x16_ref, 0 },
+};
+
+static const struct sha256cf_mb_kernel *sha256cf_mb_select(void) {
+  const struct sha256cf_mb_kernel *kernel = sha256cf_mb_kernels;
+  unsigned int features = cpu_features();
+
+  while ((kernel->features & features) != kernel->features) {
+    kernel++;
+  }
+  return kernel;
+}
+
+static void sha256cf_update_x8_bind(void *const st[8], const void *const block[8]);
+static void sha256cf_update_x16_bind(void *const st[16], const void *const block[16]);
+
+static sha256cf_update_xn_fn sha256cf_update_x8_impl = sha256cf_update_x8_bind;
+static sha256cf_update_xn_fn sha256cf_update_x16_impl = sha256cf_update_x16_bind;
+
+static void sha256cf_mb_bind(void) {
+  const struct sha256cf_mb_kernel *kernel = sha256cf_mb_select();
+  ATOMIC_STORE_RELEASE(&sha256cf_update_x8_impl, kernel->update_x8);
+  ATOMIC_STORE_RELEASE(&sha256cf_update_x16_impl, kernel->update_x16);
+}
+
+/* first call only: bind sha256cf_update_x8/x16 to the best multi-buffer kernel, then forward */
+static void sha256cf_update_x8_bind(void *const st[8], const void *const block[8]) {
+  sha256cf_mb_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_x8_impl))(st, block);
+}
+
+static void sha256cf_update_x16_bind(void *const st[16], const void *const block[16]) {
+  sha256cf_mb_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_x16_impl))(st, block);
+}
+
+void sha256cf_update_x8(void *const st[8], const void *const block[8]) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_x8_impl))(st, block);
+}
+
+void sha256cf_update_x16(void *const st[16], const void *const block[16]) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha256cf_update_x16_impl))(st, block);
+}
+
+const char *sha256cf_mb_backend(void) {
+  return sha256cf_mb_select()->name;
+}
+
+size_t sha256cf_mb_lanes_maxlen(void) {
+  return sha256cf_mb_select()->lanes_maxlen;
 }
 
-void sha256cf_flip(void * _st) {
+void sha256cf_flip(void * _st) { /* independent of the word order in memory */
   uint32_t *st = _st;
   int i;
   for (i = 0; i < 8; i++) {
@@ -17,6 +17,8 @@
 #ifndef SHA256CF_H
 #define SHA256CF_H
 
+#include <stddef.h>
+
 #define SHA256CF_BLOCKSIZE 64
 #define SHA256CF_STATESIZE 32
 
@@ -26,6 +28,28 @@ void sha256cf_init(void *st);
 void sha256cf_clear(void *st);
 void sha256cf_export(const void *st, void *out);
 void sha256cf_update(void *st, const void *block);
+
+/* sha256cf_update, then out = in XOR (first len <= SHA256CF_STATESIZE bytes of the exported state); out == in is allowed */
+void sha256cf_update_xor(void *st, const void *block, void *out, const void *in, size_t len);
+
+/*
+  Compress the block (ad XOR key) || msg, with SHA256CF_BLOCKSIZE - SHA256CF_STATESIZE bytes of ad and key and
+  SHA256CF_STATESIZE bytes of msg, without staging it in a buffer; then out = in XOR (exported state),
+  over SHA256CF_STATESIZE bytes; out == in is allowed.
+*/
+void sha256cf_update_split(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in);
+
+/*
+  Steady-state bulk phase of the encrypt-to-self mode, with the chaining value kept in registers throughout:
+  for each of the nblocks blocks, compress block, XOR the exported state into the next SHA256CF_STATESIZE bytes
+  of in to give out, and replace the last SHA256CF_STATESIZE bytes of block by the plaintext of this step
+  (in if decrypt == 0, out otherwise). The first bytes of block are the same for all blocks.
+*/
+void sha256cf_ets_bulk(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
 void sha256cf_flip(void *st);
 
+/* eight, resp. sixteen, independent sha256cf_update calls, lane j on st[j] with block[j], computed side by side in SIMD lanes */
+void sha256cf_update_x8(void *const st[8], const void *const block[8]);
+void sha256cf_update_x16(void *const st[16], const void *const block[16]);
+
 #endif /* SHA256CF_H */
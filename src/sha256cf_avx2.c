@@ -0,0 +1,280 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _DEFAULT_SOURCE /* activates  htobe32  and  be32toh  from endian.h */
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include "sha256cf.h"
+#include "sha256cf_impl.h"
+
+#if HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+  SHA-256 bulk phase for CPUs without the SHA extensions. On the encryption side all blocks of the next LANES
+  steps are known in advance (constant first half, previous plaintext chunk as second half), so their schedules
+  are expanded side by side, one block per 32-bit lane, into wk[i][lane] = w[i] + k[i]; only the rounds are left
+  for the serial chain. Decryption learns each plaintext one step at a time and runs the same code on lane 0 only.
+*/
+
+#define LANES 8
+
+#define ROR32(a, n) (((uint32_t)(a) << (32 - n)) | (((uint32_t)(a) >> n)))
+#define Sigma0(x) (ROR32((x), 2) ^ ROR32((x), 13) ^ ROR32((x), 22))
+#define Sigma1(x) (ROR32((x), 6) ^ ROR32((x), 11) ^ ROR32((x), 25))
+#define Ch(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define Maj(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+#define VROR32(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define vsigma0(x) _mm256_xor_si256(_mm256_xor_si256(VROR32((x), 7), VROR32((x), 18)), _mm256_srli_epi32((x), 3))
+#define vsigma1(x) _mm256_xor_si256(_mm256_xor_si256(VROR32((x), 17), VROR32((x), 19)), _mm256_srli_epi32((x), 10))
+
+/* r[0..7] = rows of an 8x8 matrix of 32-bit words; transposed in place */
+#define TRANSPOSE8(r) do {                                              \
+    __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);                     \
+    __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);                     \
+    __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);                     \
+    __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);                     \
+    __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);                     \
+    __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);                     \
+    __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);                     \
+    __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);                     \
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);                         \
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);                         \
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);                         \
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);                         \
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6);                         \
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6);                         \
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7);                         \
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7);                         \
+    r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);                     \
+    r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);                     \
+    r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);                     \
+    r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);                     \
+    r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);                     \
+    r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);                     \
+    r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);                     \
+    r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);                     \
+  } while (0)
+
+#define ROUND(a, b, c, d, e, f, g, h, i) do {                           \
+    uint32_t temp1, temp2;                                              \
+    temp1 = h + Sigma1(e) + Ch(e, f, g) + wk[(i) * stride];             \
+    temp2 = Sigma0(a) + Maj(a, b, c);                                   \
+    d += temp1;                                                         \
+    h = temp1 + temp2;                                                  \
+  } while (0)
+
+/* the 64 rounds on s[0..7] = a..h, reading w[i] + k[i] from wk[i * stride] */
+static inline void sha256cf_rounds(uint32_t *s, const uint32_t *wk, size_t stride) {
+  uint32_t a, b, c, d, e, f, g, h;
+  int i;
+
+  a = s[0];
+  b = s[1];
+  c = s[2];
+  d = s[3];
+  e = s[4];
+  f = s[5];
+  g = s[6];
+  h = s[7];
+
+  for (i = 0; i < 64; i += 8) {
+    ROUND(a, b, c, d, e, f, g, h, i + 0);
+    ROUND(h, a, b, c, d, e, f, g, i + 1);
+    ROUND(g, h, a, b, c, d, e, f, i + 2);
+    ROUND(f, g, h, a, b, c, d, e, i + 3);
+    ROUND(e, f, g, h, a, b, c, d, i + 4);
+    ROUND(d, e, f, g, h, a, b, c, i + 5);
+    ROUND(c, d, e, f, g, h, a, b, i + 6);
+    ROUND(b, c, d, e, f, g, h, a, i + 7);
+  }
+
+  s[0] += a;
+  s[1] += b;
+  s[2] += c;
+  s[3] += d;
+  s[4] += e;
+  s[5] += f;
+  s[6] += g;
+  s[7] += h;
+}
+
+/* the second half of the block of lane j is chunk[j]; head[] holds the first half (host byte order) */
+TARGET("avx2")
+static inline void sha256cf_schedule_lanes(uint32_t wk[64][LANES], const uint32_t *head, const uint8_t *chunk[LANES]) {
+  const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                         3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i w[16], x;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    w[i] = _mm256_set1_epi32((int)head[i]);
+    w[8 + i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)chunk[i]), bswap);
+  }
+  TRANSPOSE8((w + 8));
+
+  for (i = 0; i < 64; i++) {
+    if (i >= 16) {
+      x = _mm256_add_epi32(vsigma1(w[(i - 2) & 15]), w[(i - 7) & 15]);
+      w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(x, vsigma0(w[(i - 15) & 15])), w[i & 15]);
+    }
+    _mm256_storeu_si256((__m256i *)wk[i], _mm256_add_epi32(w[i & 15], _mm256_set1_epi32((int)sha256cf_k[i])));
+  }
+}
+
+TARGET("avx2")
+void sha256cf_ets_bulk_avx2(void * _st, void * _block, void * _out, const void * _in, size_t nblocks, int decrypt) {
+  uint32_t *st = _st;
+  uint8_t *block = _block;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint32_t s[8], head[8];
+  uint8_t p[SHA256CF_STATESIZE];
+  uint32_t wk[64][LANES];
+  const uint8_t *chunk[LANES];
+  uint32_t x, y;
+  size_t n, j;
+  int i;
+
+  s[0] = st[SHA256CF_POS_A];
+  s[1] = st[SHA256CF_POS_B];
+  s[2] = st[SHA256CF_POS_C];
+  s[3] = st[SHA256CF_POS_D];
+  s[4] = st[SHA256CF_POS_E];
+  s[5] = st[SHA256CF_POS_F];
+  s[6] = st[SHA256CF_POS_G];
+  s[7] = st[SHA256CF_POS_H];
+  for (i = 0; i < 8; i++) {
+    memcpy(&x, block + 4 * i, 4);
+    head[i] = be32toh(x);
+  }
+  memcpy(p, block + SHA256CF_BLOCKSIZE - SHA256CF_STATESIZE, sizeof(p));
+
+  /* the block of step j ends with the plaintext of step j - 1 */
+  for ( ; nblocks > 0; nblocks -= n) {
+    n = decrypt ? 1 : nblocks < LANES ? nblocks : LANES;
+    for (j = 0; j < LANES; j++) {
+      chunk[j] = j == 0 || j >= n ? p : in + (j - 1) * SHA256CF_STATESIZE;
+    }
+    sha256cf_schedule_lanes(wk, head, chunk);
+
+    for (j = 0; j < n; j++) {
+      sha256cf_rounds(s, &wk[0][j], LANES);
+      for (i = 0; i < 8; i++) {
+        memcpy(&x, in + 4 * i, 4);
+        y = x ^ htobe32(s[i]);
+        memcpy(out + 4 * i, &y, 4);
+        memcpy(p + 4 * i, decrypt ? &y : &x, 4);
+      }
+      in += SHA256CF_STATESIZE, out += SHA256CF_STATESIZE;
+    }
+  }
+
+  st[SHA256CF_POS_A] = s[0];
+  st[SHA256CF_POS_B] = s[1];
+  st[SHA256CF_POS_C] = s[2];
+  st[SHA256CF_POS_D] = s[3];
+  st[SHA256CF_POS_E] = s[4];
+  st[SHA256CF_POS_F] = s[5];
+  st[SHA256CF_POS_G] = s[6];
+  st[SHA256CF_POS_H] = s[7];
+  memcpy(block + SHA256CF_BLOCKSIZE - SHA256CF_STATESIZE, p, sizeof(p));
+}
+
+/*
+  Multi-buffer compression of eight independent blocks, one per 32-bit lane: state words, message schedule
+  and rounds all run on whole registers, with 8x8 transposes to get the state and the message into this layout.
+*/
+
+#define VSigma0(x) _mm256_xor_si256(_mm256_xor_si256(VROR32((x), 2), VROR32((x), 13)), VROR32((x), 22))
+#define VSigma1(x) _mm256_xor_si256(_mm256_xor_si256(VROR32((x), 6), VROR32((x), 11)), VROR32((x), 25))
+#define VCh(x, y, z) _mm256_xor_si256(_mm256_and_si256((x), (y)), _mm256_andnot_si256((x), (z)))
+#define VMaj(x, y, z) _mm256_or_si256(_mm256_and_si256((x), (y)), _mm256_and_si256((z), _mm256_or_si256((x), (y))))
+
+#define VROUND(a, b, c, d, e, f, g, h, i) do {                          \
+    __m256i temp1, temp2;                                               \
+    if ((i) >= 16) {                                                    \
+      temp1 = _mm256_add_epi32(vsigma1(w[((i) - 2) & 15]), w[((i) - 7) & 15]); \
+      w[(i) & 15] = _mm256_add_epi32(_mm256_add_epi32(temp1, vsigma0(w[((i) - 15) & 15])), w[(i) & 15]); \
+    }                                                                   \
+    temp1 = _mm256_add_epi32(_mm256_add_epi32(h, VSigma1(e)), _mm256_add_epi32(VCh(e, f, g), \
+                             _mm256_add_epi32(w[(i) & 15], _mm256_set1_epi32((int)sha256cf_k[i])))); \
+    temp2 = _mm256_add_epi32(VSigma0(a), VMaj(a, b, c));                \
+    d = _mm256_add_epi32(d, temp1);                                     \
+    h = _mm256_add_epi32(temp1, temp2);                                 \
+  } while (0)
+
+TARGET("avx2")
+void sha256cf_update_x8_avx2(void *const st[8], const void *const block[8]) {
+  const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                         3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i s[8], w[16], a, b, c, d, e, f, g, h;
+  int i, j;
+
+  for (j = 0; j < 8; j++) {
+    s[j] = _mm256_loadu_si256((const __m256i *)st[j]);
+    w[j] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)block[j] + 0), bswap);
+    w[8 + j] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)block[j] + 1), bswap);
+  }
+  TRANSPOSE8(s);
+  TRANSPOSE8(w);
+  TRANSPOSE8((w + 8));
+
+  a = s[SHA256CF_POS_A];
+  b = s[SHA256CF_POS_B];
+  c = s[SHA256CF_POS_C];
+  d = s[SHA256CF_POS_D];
+  e = s[SHA256CF_POS_E];
+  f = s[SHA256CF_POS_F];
+  g = s[SHA256CF_POS_G];
+  h = s[SHA256CF_POS_H];
+
+  for (i = 0; i < 64; i += 8) {
+    VROUND(a, b, c, d, e, f, g, h, i + 0);
+    VROUND(h, a, b, c, d, e, f, g, i + 1);
+    VROUND(g, h, a, b, c, d, e, f, i + 2);
+    VROUND(f, g, h, a, b, c, d, e, i + 3);
+    VROUND(e, f, g, h, a, b, c, d, i + 4);
+    VROUND(d, e, f, g, h, a, b, c, i + 5);
+    VROUND(c, d, e, f, g, h, a, b, i + 6);
+    VROUND(b, c, d, e, f, g, h, a, i + 7);
+  }
+
+  s[SHA256CF_POS_A] = _mm256_add_epi32(s[SHA256CF_POS_A], a);
+  s[SHA256CF_POS_B] = _mm256_add_epi32(s[SHA256CF_POS_B], b);
+  s[SHA256CF_POS_C] = _mm256_add_epi32(s[SHA256CF_POS_C], c);
+  s[SHA256CF_POS_D] = _mm256_add_epi32(s[SHA256CF_POS_D], d);
+  s[SHA256CF_POS_E] = _mm256_add_epi32(s[SHA256CF_POS_E], e);
+  s[SHA256CF_POS_F] = _mm256_add_epi32(s[SHA256CF_POS_F], f);
+  s[SHA256CF_POS_G] = _mm256_add_epi32(s[SHA256CF_POS_G], g);
+  s[SHA256CF_POS_H] = _mm256_add_epi32(s[SHA256CF_POS_H], h);
+  TRANSPOSE8(s);
+  for (j = 0; j < 8; j++) {
+    _mm256_storeu_si256((__m256i *)st[j], s[j]);
+  }
+}
+
+/* sixteen lanes as two halves of eight */
+TARGET("avx2")
+void sha256cf_update_x16_avx2(void *const st[16], const void *const block[16]) {
+  sha256cf_update_x8_avx2(st + 0, block + 0);
+  sha256cf_update_x8_avx2(st + 8, block + 8);
+}
+
+#endif /* HAVE_X86_SIMD */
@@ -0,0 +1,157 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "sha256cf.h"
+#include "sha256cf_impl.h"
+
+#if HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+  Multi-buffer compression of sixteen independent blocks, one per 32-bit lane of the 512-bit registers
+  (see sha256cf_update_x8_avx2); AVX-512 adds native rotations (vprord) and three-input logic (vpternlogd)
+  for Ch, Maj and the three-way XORs of the Sigma functions.
+*/
+
+#define ROR(x, n) _mm512_ror_epi32((x), (n))
+#define XOR3(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0x96)
+#define Sigma0(x) XOR3(ROR((x), 2), ROR((x), 13), ROR((x), 22))
+#define Sigma1(x) XOR3(ROR((x), 6), ROR((x), 11), ROR((x), 25))
+#define sigma0(x) XOR3(ROR((x), 7), ROR((x), 18), _mm512_srli_epi32((x), 3))
+#define sigma1(x) XOR3(ROR((x), 17), ROR((x), 19), _mm512_srli_epi32((x), 10))
+#define Ch(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0xca)
+#define Maj(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0xe8)
+
+/* byte swap of each 32-bit word without vpshufb (AVX-512BW): bytes 0, 2 from the left, bytes 1, 3 from the right rotation */
+#define BSWAP32(x) _mm512_ternarylogic_epi32(_mm512_set1_epi32(0x00ff00ff), ROR((x), 24), ROR((x), 8), 0xca)
+
+#define ROUND(a, b, c, d, e, f, g, h, i) do {                           \
+    __m512i temp1, temp2;                                               \
+    if ((i) >= 16) {                                                    \
+      temp1 = _mm512_add_epi32(sigma1(w[((i) - 2) & 15]), w[((i) - 7) & 15]); \
+      w[(i) & 15] = _mm512_add_epi32(_mm512_add_epi32(temp1, sigma0(w[((i) - 15) & 15])), w[(i) & 15]); \
+    }                                                                   \
+    temp1 = _mm512_add_epi32(_mm512_add_epi32(h, Sigma1(e)), _mm512_add_epi32(Ch(e, f, g), \
+                             _mm512_add_epi32(w[(i) & 15], _mm512_set1_epi32((int)sha256cf_k[i])))); \
+    temp2 = _mm512_add_epi32(Sigma0(a), Maj(a, b, c));                  \
+    d = _mm512_add_epi32(d, temp1);                                     \
+    h = _mm512_add_epi32(temp1, temp2);                                 \
+  } while (0)
+
+/*
+  r[0..15] = rows of a 16x16 matrix of 32-bit words; transposed in place. The first two steps transpose the 4x4
+  blocks within each 128-bit lane, the last two move the 128-bit lanes of each group of four rows into place.
+*/
+TARGET("avx2,avx512f,avx512vl")
+static inline void sha256cf_transpose16(__m512i r[16]) {
+  __m512i t[16], u[16];
+  int g;
+
+  for (g = 0; g < 16; g += 4) {
+    t[g + 0] = _mm512_unpacklo_epi32(r[g + 0], r[g + 1]);
+    t[g + 1] = _mm512_unpackhi_epi32(r[g + 0], r[g + 1]);
+    t[g + 2] = _mm512_unpacklo_epi32(r[g + 2], r[g + 3]);
+    t[g + 3] = _mm512_unpackhi_epi32(r[g + 2], r[g + 3]);
+    /* u[g + c], 128-bit lane k: column 4k + c of rows g..g+3 */
+    u[g + 0] = _mm512_unpacklo_epi64(t[g + 0], t[g + 2]);
+    u[g + 1] = _mm512_unpackhi_epi64(t[g + 0], t[g + 2]);
+    u[g + 2] = _mm512_unpacklo_epi64(t[g + 1], t[g + 3]);
+    u[g + 3] = _mm512_unpackhi_epi64(t[g + 1], t[g + 3]);
+  }
+  for (g = 0; g < 4; g++) {
+    t[0] = _mm512_shuffle_i32x4(u[0 + g], u[4 + g], 0x44);
+    t[1] = _mm512_shuffle_i32x4(u[0 + g], u[4 + g], 0xee);
+    t[2] = _mm512_shuffle_i32x4(u[8 + g], u[12 + g], 0x44);
+    t[3] = _mm512_shuffle_i32x4(u[8 + g], u[12 + g], 0xee);
+    r[0 + g] = _mm512_shuffle_i32x4(t[0], t[2], 0x88);
+    r[4 + g] = _mm512_shuffle_i32x4(t[0], t[2], 0xdd);
+    r[8 + g] = _mm512_shuffle_i32x4(t[1], t[3], 0x88);
+    r[12 + g] = _mm512_shuffle_i32x4(t[1], t[3], 0xdd);
+  }
+}
+
+TARGET("avx2,avx512f,avx512vl")
+void sha256cf_update_x16_avx512(void *const st[16], const void *const block[16]) {
+  __m512i s[16], w[16], a, b, c, d, e, f, g, h;
+  int i, j;
+
+  for (j = 0; j < 16; j++) {
+    s[j] = _mm512_zextsi256_si512(_mm256_loadu_si256((const __m256i *)st[j]));
+    w[j] = _mm512_loadu_si512(block[j]);
+  }
+  sha256cf_transpose16(s);
+  sha256cf_transpose16(w);
+  for (i = 0; i < 16; i++) {
+    w[i] = BSWAP32(w[i]);
+  }
+
+  a = s[SHA256CF_POS_A];
+  b = s[SHA256CF_POS_B];
+  c = s[SHA256CF_POS_C];
+  d = s[SHA256CF_POS_D];
+  e = s[SHA256CF_POS_E];
+  f = s[SHA256CF_POS_F];
+  g = s[SHA256CF_POS_G];
+  h = s[SHA256CF_POS_H];
+
+  for (i = 0; i < 64; i += 8) {
+    ROUND(a, b, c, d, e, f, g, h, i + 0);
+    ROUND(h, a, b, c, d, e, f, g, i + 1);
+    ROUND(g, h, a, b, c, d, e, f, i + 2);
+    ROUND(f, g, h, a, b, c, d, e, i + 3);
+    ROUND(e, f, g, h, a, b, c, d, i + 4);
+    ROUND(d, e, f, g, h, a, b, c, i + 5);
+    ROUND(c, d, e, f, g, h, a, b, i + 6);
+    ROUND(b, c, d, e, f, g, h, a, i + 7);
+  }
+
+  s[SHA256CF_POS_A] = _mm512_add_epi32(s[SHA256CF_POS_A], a);
+  s[SHA256CF_POS_B] = _mm512_add_epi32(s[SHA256CF_POS_B], b);
+  s[SHA256CF_POS_C] = _mm512_add_epi32(s[SHA256CF_POS_C], c);
+  s[SHA256CF_POS_D] = _mm512_add_epi32(s[SHA256CF_POS_D], d);
+  s[SHA256CF_POS_E] = _mm512_add_epi32(s[SHA256CF_POS_E], e);
+  s[SHA256CF_POS_F] = _mm512_add_epi32(s[SHA256CF_POS_F], f);
+  s[SHA256CF_POS_G] = _mm512_add_epi32(s[SHA256CF_POS_G], g);
+  s[SHA256CF_POS_H] = _mm512_add_epi32(s[SHA256CF_POS_H], h);
+  for (i = 8; i < 16; i++) {
+    s[i] = _mm512_setzero_si512();
+  }
+  sha256cf_transpose16(s);
+  for (j = 0; j < 16; j++) {
+    _mm256_storeu_si256((__m256i *)st[j], _mm512_castsi512_si256(s[j]));
+  }
+}
+
+/* eight lanes through the sixteen-lane kernel: even with half of it idle, this beats the AVX2 kernel */
+TARGET("avx2,avx512f,avx512vl")
+void sha256cf_update_x8_avx512(void *const st[8], const void *const block[8]) {
+  uint32_t idle_st[8] = { 0 };
+  uint32_t idle_block[16] = { 0 };
+  void *st16[16];
+  const void *block16[16];
+  int j;
+
+  for (j = 0; j < 8; j++) {
+    st16[j] = st[j], block16[j] = block[j];
+    st16[8 + j] = idle_st, block16[8 + j] = idle_block;
+  }
+  sha256cf_update_x16_avx512(st16, block16);
+}
+
+#endif /* HAVE_X86_SIMD */
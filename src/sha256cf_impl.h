@@ -0,0 +1,128 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef SHA256CF_IMPL_H
+#define SHA256CF_IMPL_H
+
+/* internal header, shared by the scalar, the SHA-NI, the AVX2 and the AVX-512 implementations of sha256cf_update */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/*
+  Memory layout of the chaining state: the eight 32-bit words a..h are stored in the order expected by the
+  SHA-NI instructions, i.e., as the two 128-bit values ABEF and CDGH with A and C in the most significant lanes.
+  The scalar code indexes the words through the positions below, the SHA-NI code loads the state without shuffles.
+*/
+#define SHA256CF_POS_A 3
+#define SHA256CF_POS_B 2
+#define SHA256CF_POS_C 7
+#define SHA256CF_POS_D 6
+#define SHA256CF_POS_E 1
+#define SHA256CF_POS_F 0
+#define SHA256CF_POS_G 5
+#define SHA256CF_POS_H 4
+
+static const uint32_t sha256cf_k[64] = {
+  0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
+  0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
+  0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
+  0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
+  0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+  0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
+  0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL,
+  0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
+  0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL,
+  0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+  0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL,
+  0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
+  0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL,
+  0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
+  0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+  0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL,
+};
+
+typedef void (*sha256cf_update_fn)(void *st, const void *block);
+typedef void (*sha256cf_update_xor_fn)(void *st, const void *block, void *out, const void *in, size_t len);
+typedef void (*sha256cf_update_split_fn)(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in);
+typedef void (*sha256cf_ets_bulk_fn)(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
+typedef void (*sha256cf_update_xn_fn)(void *const *st, const void *const *block);
+
+struct sha256cf_kernel {
+  const char *name;
+  unsigned int features; /* required CPU features, see cpu.h */
+  sha256cf_update_fn update;
+  sha256cf_update_xor_fn update_xor;
+  sha256cf_update_split_fn update_split;
+  sha256cf_ets_bulk_fn ets_bulk;
+};
+
+/* best kernel first, terminated by the portable reference code (features == 0) */
+extern const struct sha256cf_kernel sha256cf_kernels[];
+
+/* name of the kernel sha256cf_update is bound to */
+const char *sha256cf_backend(void);
+
+/*
+  The multi-buffer kernels have a table of their own: whether SIMD lanes beat SHA-NI one block after the other
+  depends on the register width, so their order does not follow the one of sha256cf_kernels[].
+*/
+struct sha256cf_mb_kernel {
+  const char *name;
+  unsigned int features; /* required CPU features, see cpu.h */
+  sha256cf_update_xn_fn update_x8;
+  sha256cf_update_xn_fn update_x16;
+  size_t lanes_maxlen; /* longest ETS record (AD and message) on which the multi-buffer kernels beat the single-record code, SIZE_MAX: all, 0: none */
+};
+
+/* best kernel first, terminated by the portable reference code (features == 0) */
+extern const struct sha256cf_mb_kernel sha256cf_mb_kernels[];
+
+/* name of the kernel sha256cf_update_x8/x16 are bound to, for display only */
+const char *sha256cf_mb_backend(void);
+
+/* lanes_maxlen of that kernel, by which the batch functions decide between the lanes and the single-record code */
+size_t sha256cf_mb_lanes_maxlen(void);
+
+/* out = in XOR (first len bytes of the big-endian encoding of words a..h of st); the partial-block tail of the fused kernels */
+static inline void sha256cf_xor_state(const uint32_t *st, uint8_t *out, const uint8_t *in, size_t len) {
+  static const uint8_t pos[8] = {
+    SHA256CF_POS_A, SHA256CF_POS_B, SHA256CF_POS_C, SHA256CF_POS_D,
+    SHA256CF_POS_E, SHA256CF_POS_F, SHA256CF_POS_G, SHA256CF_POS_H,
+  };
+  size_t i;
+  for (i = 0; i < len; i++) {
+    out[i] = in[i] ^ (uint8_t)(st[pos[i / 4]] >> (24 - 8 * (i % 4)));
+  }
+}
+
+#if HAVE_X86_SIMD
+/* same contracts as sha256cf_update(_xor/_split/_x8/_x16) and sha256cf_ets_bulk; callers have to make sure the CPU supports the SHA extensions, resp. AVX2 or AVX-512 */
+void sha256cf_update_shani(void *st, const void *block);
+void sha256cf_update_xor_shani(void *st, const void *block, void *out, const void *in, size_t len);
+void sha256cf_update_split_shani(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in);
+void sha256cf_ets_bulk_shani(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
+void sha256cf_update_x8_shani(void *const st[8], const void *const block[8]);
+void sha256cf_update_x16_shani(void *const st[16], const void *const block[16]);
+void sha256cf_ets_bulk_avx2(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
+void sha256cf_update_x8_avx2(void *const st[8], const void *const block[8]);
+void sha256cf_update_x16_avx2(void *const st[16], const void *const block[16]);
+void sha256cf_update_x8_avx512(void *const st[8], const void *const block[8]);
+void sha256cf_update_x16_avx512(void *const st[16], const void *const block[16]);
+#endif
+
+#endif /* SHA256CF_IMPL_H */
@@ -0,0 +1,197 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include "sha256cf.h"
+#include "sha256cf_impl.h"
+
+#if HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+  SHA-256 compression with the SHA extensions: the state lives in the two registers ABEF and CDGH (which is also
+  its memory layout, see sha256cf_impl.h), sha256rnds2 performs two rounds, sha256msg1/sha256msg2 expand the
+  message schedule four words at a time.
+*/
+
+#define LOAD_MSG(i) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)block + (i)), bswap)
+
+#define RNDS4(i, w) do {                                                \
+    msg = _mm_add_epi32((w), _mm_loadu_si128((const __m128i *)(sha256cf_k + 4 * (i)))); \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);                      \
+    msg = _mm_shuffle_epi32(msg, 0x0e);                                 \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);                      \
+  } while (0)
+
+/* finish the expansion of next = w[i+4..i+7] from cur = w[i..i+3] and prev = w[i-4..i-1] */
+#define MSG2(next, cur, prev) do {                                      \
+    next = _mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4));          \
+    next = _mm_sha256msg2_epu32(next, cur);                             \
+  } while (0)
+
+#define MSG1(prev, cur) do {                                            \
+    prev = _mm_sha256msg1_epu32(prev, cur);                             \
+  } while (0)
+
+TARGET("sha,sse4.1")
+static inline void sha256cf_rounds(__m128i *abef_io, __m128i *cdgh_io, __m128i w0, __m128i w1, __m128i w2, __m128i w3) {
+  __m128i abef, cdgh, msg;
+
+  abef = *abef_io;
+  cdgh = *cdgh_io;
+
+  RNDS4(0, w0);
+  RNDS4(1, w1); MSG1(w0, w1);
+  RNDS4(2, w2); MSG1(w1, w2);
+  RNDS4(3, w3); MSG2(w0, w3, w2); MSG1(w2, w3);
+
+  RNDS4( 4, w0); MSG2(w1, w0, w3); MSG1(w3, w0);
+  RNDS4( 5, w1); MSG2(w2, w1, w0); MSG1(w0, w1);
+  RNDS4( 6, w2); MSG2(w3, w2, w1); MSG1(w1, w2);
+  RNDS4( 7, w3); MSG2(w0, w3, w2); MSG1(w2, w3);
+  RNDS4( 8, w0); MSG2(w1, w0, w3); MSG1(w3, w0);
+  RNDS4( 9, w1); MSG2(w2, w1, w0); MSG1(w0, w1);
+  RNDS4(10, w2); MSG2(w3, w2, w1); MSG1(w1, w2);
+  RNDS4(11, w3); MSG2(w0, w3, w2); MSG1(w2, w3);
+  RNDS4(12, w0); MSG2(w1, w0, w3); MSG1(w3, w0);
+  RNDS4(13, w1); MSG2(w2, w1, w0);
+  RNDS4(14, w2); MSG2(w3, w2, w1);
+  RNDS4(15, w3);
+
+  *abef_io = _mm_add_epi32(abef, *abef_io);
+  *cdgh_io = _mm_add_epi32(cdgh, *cdgh_io);
+}
+
+TARGET("sha,sse4.1")
+static inline void sha256cf_compress(uint32_t *st, const void *block, __m128i *abef, __m128i *cdgh) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  *abef = _mm_loadu_si128((const __m128i *)(st + 0));
+  *cdgh = _mm_loadu_si128((const __m128i *)(st + 4));
+  sha256cf_rounds(abef, cdgh, LOAD_MSG(0), LOAD_MSG(1), LOAD_MSG(2), LOAD_MSG(3));
+  _mm_storeu_si128((__m128i *)(st + 0), *abef);
+  _mm_storeu_si128((__m128i *)(st + 4), *cdgh);
+}
+
+/* back to the canonical word order a..h, then big-endian: the exported state */
+TARGET("sha,sse4.1")
+static inline void sha256cf_canonical(__m128i abef, __m128i cdgh, __m128i *abcd, __m128i *efgh) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i feba, dchg;
+
+  feba = _mm_shuffle_epi32(abef, 0x1b);
+  dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+  *abcd = _mm_shuffle_epi8(_mm_blend_epi16(feba, dchg, 0xf0), bswap);
+  *efgh = _mm_shuffle_epi8(_mm_alignr_epi8(dchg, feba, 8), bswap);
+}
+
+TARGET("sha,sse4.1")
+void sha256cf_update_shani(void *st, const void *block) {
+  __m128i abef, cdgh;
+
+  sha256cf_compress(st, block, &abef, &cdgh);
+}
+
+TARGET("sha,sse4.1")
+void sha256cf_update_xor_shani(void *st, const void *block, void *out, const void *in, size_t len) {
+  __m128i abef, cdgh, abcd, efgh;
+
+  sha256cf_compress(st, block, &abef, &cdgh);
+  if (len == SHA256CF_STATESIZE) {
+    sha256cf_canonical(abef, cdgh, &abcd, &efgh);
+    _mm_storeu_si128((__m128i *)out + 0, _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 0), abcd));
+    _mm_storeu_si128((__m128i *)out + 1, _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 1), efgh));
+  }
+  else {
+    sha256cf_xor_state(st, out, in, len);
+  }
+}
+
+TARGET("sha,sse4.1")
+void sha256cf_update_split_shani(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i abef, cdgh, abcd, efgh, w0, w1;
+
+  w0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)ad + 0), _mm_loadu_si128((const __m128i *)key + 0));
+  w1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)ad + 1), _mm_loadu_si128((const __m128i *)key + 1));
+
+  abef = _mm_loadu_si128((const __m128i *)st + 0);
+  cdgh = _mm_loadu_si128((const __m128i *)st + 1);
+  sha256cf_rounds(&abef, &cdgh, _mm_shuffle_epi8(w0, bswap), _mm_shuffle_epi8(w1, bswap),
+                  _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)msg + 0), bswap),
+                  _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)msg + 1), bswap));
+  _mm_storeu_si128((__m128i *)st + 0, abef);
+  _mm_storeu_si128((__m128i *)st + 1, cdgh);
+
+  sha256cf_canonical(abef, cdgh, &abcd, &efgh);
+  _mm_storeu_si128((__m128i *)out + 0, _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 0), abcd));
+  _mm_storeu_si128((__m128i *)out + 1, _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 1), efgh));
+}
+
+TARGET("sha,sse4.1")
+void sha256cf_ets_bulk_shani(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i abef, cdgh, abcd, efgh, w0, w1, p0, p1, x0, x1, y0, y1;
+
+  abef = _mm_loadu_si128((const __m128i *)st + 0);
+  cdgh = _mm_loadu_si128((const __m128i *)st + 1);
+  w0 = LOAD_MSG(0);
+  w1 = LOAD_MSG(1);
+  p0 = _mm_loadu_si128((const __m128i *)block + 2);
+  p1 = _mm_loadu_si128((const __m128i *)block + 3);
+
+  for ( ; nblocks > 0; nblocks--) {
+    sha256cf_rounds(&abef, &cdgh, w0, w1, _mm_shuffle_epi8(p0, bswap), _mm_shuffle_epi8(p1, bswap));
+    sha256cf_canonical(abef, cdgh, &abcd, &efgh);
+    x0 = _mm_loadu_si128((const __m128i *)in + 0);
+    x1 = _mm_loadu_si128((const __m128i *)in + 1);
+    y0 = _mm_xor_si128(x0, abcd);
+    y1 = _mm_xor_si128(x1, efgh);
+    _mm_storeu_si128((__m128i *)out + 0, y0);
+    _mm_storeu_si128((__m128i *)out + 1, y1);
+    p0 = decrypt ? y0 : x0;
+    p1 = decrypt ? y1 : x1;
+    in = (const uint8_t *)in + SHA256CF_STATESIZE;
+    out = (uint8_t *)out + SHA256CF_STATESIZE;
+  }
+
+  _mm_storeu_si128((__m128i *)st + 0, abef);
+  _mm_storeu_si128((__m128i *)st + 1, cdgh);
+  _mm_storeu_si128((__m128i *)block + 2, p0);
+  _mm_storeu_si128((__m128i *)block + 3, p1);
+}
+
+/* on CPUs with the SHA extensions, one lane after the other beats the eight-lane AVX2 kernel */
+TARGET("sha,sse4.1")
+void sha256cf_update_x8_shani(void *const st[8], const void *const block[8]) {
+  int j;
+
+  for (j = 0; j < 8; j++) {
+    sha256cf_update_shani(st[j], block[j]);
+  }
+}
+
+TARGET("sha,sse4.1")
+void sha256cf_update_x16_shani(void *const st[16], const void *const block[16]) {
+  int j;
+
+  for (j = 0; j < 16; j++) {
+    sha256cf_update_shani(st[j], block[j]);
+  }
+}
+
+#endif /* HAVE_X86_SIMD */
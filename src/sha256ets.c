@@ -18,285 +18,108 @@
 #include <string.h>
 
 #include "sha256cf.h"
+#include "sha256cf_impl.h"
 #include "sha256ets.h"
+#include "ets.h"
 #include "memxor.h"
 
 #define C SHA256CF_STATESIZE /* 32 */
 #define D SHA256CF_BLOCKSIZE /* 64 */
+#define CF_MEMSTATESIZE SHA256CF_MEMSTATESIZE
+#define CF_KLEN_MAX (D - C) /* no limit beyond the mode's own */
+#define ETS_LANES_MAX 16
+#define ETS(name) sha256ets_##name
+#define CF_ID 1
 
-#define assert(C) do { ; } while (! (C)) /* poor man's assert */
-
-_Static_assert(C <= D && C <= 256, "required by mode");
-
-/* round up to next multiple of 8 (for copy efficiency on 64-bit machines) */
-#define RUP_8(x) (((x) + 7) & ~0x07)
-
-#define MAV 16 /* memory alignment value (for even faster copies) */
-_Static_assert((MAV & (MAV - 1)) == 0, "memory alignment value not a power of two");
-
-#define RUP_MAV(x) (((x) + MAV - 1) & ~(MAV - 1)) /* round up to next multiple of MAV */
-
-_Static_assert(C == RUP_MAV(C) && D == RUP_MAV(D), "compression function shall work well with memory-aligned data");
-
-#define CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)            \
-  (                                                                     \
-   ((klen) >= 128 / 8 && (klen) <= (D - C) && (klen) == RUP_8(klen))    \
-   &&                                                                   \
-   ((clen) == (mlen))                                                   \
-   &&                                                                   \
-   ((taglen) >= 80 / 8 && (taglen) <= C)                                \
-  )
-
-#define AD_FINALIZER 0x80
-
-#define LOAD_AD_INTO_BLOCK(_len) do {                                   \
-    /* assert(! ad_padded); */                                          \
-    size_t len = (_len);                                                \
-    if (adlen >= len) {                                                 \
-      memcpy(block, ad, len);                                           \
-      ad += len, adlen -= len;                                          \
-    }                                                                   \
-    else /* if (0 <= adlen < len) */ {                                  \
-      memcpy(block, ad, adlen);                                         \
-      block[adlen] = AD_FINALIZER;                                      \
-      memset(block + adlen + 1, 0, len - adlen - 1);                    \
-      /* ad += adlen, adlen = 0; */                                     \
-      ad_padded = 1;                                                    \
-    }                                                                   \
-  } while (0)
-
-int sha256ets_enc(size_t klen, const void *k, size_t adlen, const void * _ad, size_t mlen, const void * _m, size_t clen, void * _c, size_t taglen, void *tag) {
-  const uint8_t *ad = _ad;
-  const uint8_t *m = _m;
-  uint8_t *c = _c;
-  uint8_t st[SHA256CF_MEMSTATESIZE];
-  uint8_t block[D], buf[C];
-  int ad_padded = 0;
-  int m_padded = 0;
-  int default_ad_block = 0; /* (default_ad_block == 1) ==> (block[0..D-C-1] == zero-padded key) */
-  size_t mlen_rup;
-
-  if (! CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)) {
-    return -1;
-  }
-
-  if (mlen == 0) {
-    m_padded = 1;
-  }
-
-  /* first block */
-  LOAD_AD_INTO_BLOCK(D);
-  memxor2(block, k, klen);
+/* sha256cf has no block counter, and the final flag is realized by flipping the state before the compression */
 
+static inline void cf_init(void *st, size_t klen, size_t taglen) {
+  (void)klen, (void)taglen;
   sha256cf_init(st);
+}
 
-  /* bulk message processing */
-  while (mlen >= C) {
-    sha256cf_update(st, block);
-
-    if (! ad_padded) {
-      LOAD_AD_INTO_BLOCK(D - C);
-      memxor2(block, k, klen);
-    }
-    else /* if (ad_padded) */ {
-      if (! default_ad_block) {
-        memcpy(block, k, klen);
-        memset(block + klen, 0, D - C - klen);
-        default_ad_block = 1;
-      }
-    }
-
-    sha256cf_export(st, buf);
-    memxor3(c, m, buf, C);
-    memcpy(block + D - C, m, C);
-    c += C, m += C, mlen -= C;
-  }
-
-  /* in case a partial message block remains */
-  if (0 < mlen /* && mlen < C */) {
-    sha256cf_update(st, block);
-
-    mlen_rup = RUP_MAV(mlen + 1); /* by mlen < C and C == RUP_MAV(C): mlen_rup <= C */
-
-    if (! ad_padded) {
-      LOAD_AD_INTO_BLOCK(D - mlen_rup);
-      memxor2(block, k, klen);
-    }
-    else /* if (ad_padded) */ {
-      if (default_ad_block) {
-        memset(block + D - C, 0, C - mlen_rup);
-      }
-      else /* if (! default_ad_block) */ {
-        memcpy(block, k, klen);
-        memset(block + klen, 0, D - mlen_rup - klen);
-        /* default_ad_block = 1; */
-      }
-    }
-
-    sha256cf_export(st, buf);
-    memxor3(c, m, buf, mlen);
-    /* c += mlen; */
-
-    memcpy(block + D - mlen_rup, m, mlen);
-    memset(block + D - mlen_rup + mlen, 0, mlen_rup - mlen - 1);
-    block[D - 1] = mlen; /* requires C <= 256 (bytes) */
-    /* m += mlen, mlen = 0; */
-    m_padded = 1;
-  }
-
-  if (! ad_padded && adlen > 0) {
-    sha256cf_flip(st);
-    sha256cf_update(st, block);
-
-    while (adlen > D) {
-      sha256cf_update(st, ad);
-      ad += D, adlen -= D;
-    }
-    /* assert(0 < adlen && adlen <= D); */
-    LOAD_AD_INTO_BLOCK(D);
-    /* assert(ad_padded || (! ad_padded && adlen == 0)); */
-  }
-
-  if (m_padded) {
+static inline void cf_update(void *st, const void *block, unsigned long long int t, int final) {
+  (void)t;
+  if (final) {
     sha256cf_flip(st);
   }
   sha256cf_update(st, block);
+}
 
-  sha256cf_export(st, buf);
-  /* sha256cf_clear(st); */
-
-  if (ad_padded) {
-    unsigned int i;
-    for (i = 0; i < taglen; i++) {
-      buf[i] ^= 0xa5;
-    }
-  }
-
-  memcpy(tag, buf, taglen);
+static inline void cf_update_xor(void *st, const void *block, unsigned long long int t, void *out, const void *in, size_t len) {
+  (void)t;
+  sha256cf_update_xor(st, block, out, in, len);
+}
 
-  return 0;
+static inline void cf_update_split(void *st, const void *ad, const void *key, const void *msg, unsigned long long int t, void *out, const void *in) {
+  (void)t;
+  sha256cf_update_split(st, ad, key, msg, out, in);
 }
 
-int sha256ets_dec(size_t klen, const void *k, size_t adlen, const void * _ad, size_t clen, const void * _c, size_t taglen, const void *tag, size_t mlen, void * _m, int fail_if_invalid, int *is_valid) {
-  const uint8_t *ad = _ad;
-  const uint8_t *c = _c;
-  uint8_t *m = _m;
-  uint8_t st[SHA256CF_MEMSTATESIZE];
-  uint8_t block[D], buf[C];
-  int ad_padded = 0;
-  int m_padded = 0;
-  int default_ad_block = 0; /* (default_ad_block == 1) ==> (block[0..D-C-1] == zero-padded key) */
-  size_t mlen_rup;
-  int valid;
+static inline void cf_ets_bulk(void *st, void *block, unsigned long long int t, void *out, const void *in, size_t nblocks, int decrypt) {
+  (void)t;
+  sha256cf_ets_bulk(st, block, out, in, nblocks, decrypt);
+}
 
-  if (! CHECK_PARAMS_ENCDEC(klen, adlen, mlen, clen, taglen)) {
-    return -1;
-  }
+static inline void cf_export(const void *st, void *out) {
+  sha256cf_export(st, out);
+}
 
-  if (mlen == 0) {
-    m_padded = 1;
-  }
+static void cf_update_x2(void *const *st, const void *const *block, const unsigned long long int *t, const int *final) {
+  cf_update(st[0], block[0], t[0], final[0]);
+  cf_update(st[1], block[1], t[1], final[1]);
+}
 
-  /* first block */
-  LOAD_AD_INTO_BLOCK(D);
-  memxor2(block, k, klen);
+#include "ets_impl.h"
 
-  sha256cf_init(st);
+/* the multi-buffer kernels in the shape of ets_update_xn */
 
-  /* bulk ciphertext processing */
-  while (mlen >= C) {
-    sha256cf_update(st, block);
+static void sha256ets_update_x8(void *const *st, const void *const *block, const unsigned long long int *t, const int *final) {
+  int j;
 
-    if (! ad_padded) {
-      LOAD_AD_INTO_BLOCK(D - C);
-      memxor2(block, k, klen);
-    }
-    else /* if (ad_padded) */ {
-      if (! default_ad_block) {
-        memcpy(block, k, klen);
-        memset(block + klen, 0, D - C - klen);
-        default_ad_block = 1;
-      }
+  (void)t;
+  for (j = 0; j < 8; j++) {
+    if (final[j]) {
+      sha256cf_flip(st[j]);
     }
-
-    sha256cf_export(st, buf);
-    memxor3(m, c, buf, C);
-    memcpy(block + D - C, m, C);
-    c += C, m += C, mlen -= C;
   }
+  sha256cf_update_x8(st, block);
+}
 
-  /* in case a partial ciphertext block remains */
-  if (0 < mlen /* && mlen < C */) {
-    sha256cf_update(st, block);
-
-    mlen_rup = RUP_MAV(mlen + 1); /* by mlen < C and C == RUP_MAV(C): mlen_rup <= C */
+static void sha256ets_update_x16(void *const *st, const void *const *block, const unsigned long long int *t, const int *final) {
+  int j;
 
-    if (! ad_padded) {
-      LOAD_AD_INTO_BLOCK(D - mlen_rup);
-      memxor2(block, k, klen);
+  (void)t;
+  for (j = 0; j < 16; j++) {
+    if (final[j]) {
+      sha256cf_flip(st[j]);
     }
-    else /* if (ad_padded) */ {
-      if (default_ad_block) {
-        memset(block + D - C, 0, C - mlen_rup);
-      }
-      else /* if (! default_ad_block) */ {
-        memcpy(block, k, klen);
-        memset(block + klen, 0, D - mlen_rup - klen);
-        /* default_ad_block = 1; */
-      }
-    }
-
-    sha256cf_export(st, buf);
-    memxor3(m, c, buf, mlen);
-    /* c += mlen; */
-
-    memcpy(block + D - mlen_rup, m, mlen);
-    memset(block + D - mlen_rup + mlen, 0, mlen_rup - mlen - 1);
-    block[D - 1] = mlen; /* requires C <= 256 (bytes) */
-    /* m += mlen, mlen = 0; */
-    m_padded = 1;
   }
+  sha256cf_update_x16(st, block);
+}
 
-  if (! ad_padded && adlen > 0) {
-    sha256cf_flip(st);
-    sha256cf_update(st, block);
-
-    while (adlen > D) {
-      sha256cf_update(st, ad);
-      ad += D, adlen -= D;
-    }
-    /* assert(0 < adlen && adlen <= D); */
-    LOAD_AD_INTO_BLOCK(D);
-    /* assert(ad_padded || (! ad_padded && adlen == 0)); */
-  }
+int sha256ets_enc_x8(const size_t klen[8], const void *const k[8], const size_t adlen[8], const void *const ad[8], const size_t mlen[8], const void *const m[8], const size_t clen[8], void *const c[8], const size_t taglen[8], void *const tag[8]) {
+  return ets_enc_xn(8, sha256ets_update_x8, klen, k, adlen, ad, mlen, m, clen, c, taglen, tag);
+}
 
-  if (m_padded) {
-    sha256cf_flip(st);
-  }
-  sha256cf_update(st, block);
+int sha256ets_dec_x8(const size_t klen[8], const void *const k[8], const size_t adlen[8], const void *const ad[8], const size_t clen[8], const void *const c[8], const size_t taglen[8], const void *const tag[8], const size_t mlen[8], void *const m[8], int fail_if_invalid, int is_valid[8]) {
+  return ets_dec_xn(8, sha256ets_update_x8, klen, k, adlen, ad, clen, c, taglen, tag, mlen, m, fail_if_invalid, is_valid);
+}
 
-  sha256cf_export(st, buf);
-  /* sha256cf_clear(st); */
+int sha256ets_enc_x16(const size_t klen[16], const void *const k[16], const size_t adlen[16], const void *const ad[16], const size_t mlen[16], const void *const m[16], const size_t clen[16], void *const c[16], const size_t taglen[16], void *const tag[16]) {
+  return ets_enc_xn(16, sha256ets_update_x16, klen, k, adlen, ad, mlen, m, clen, c, taglen, tag);
+}
 
-  if (ad_padded) {
-    unsigned int i;
-    for (i = 0; i < taglen; i++) {
-      buf[i] ^= 0xa5;
-    }
-  }
+int sha256ets_dec_x16(const size_t klen[16], const void *const k[16], const size_t adlen[16], const void *const ad[16], const size_t clen[16], const void *const c[16], const size_t taglen[16], const void *const tag[16], const size_t mlen[16], void *const m[16], int fail_if_invalid, int is_valid[16]) {
+  return ets_dec_xn(16, sha256ets_update_x16, klen, k, adlen, ad, clen, c, taglen, tag, mlen, m, fail_if_invalid, is_valid);
+}
 
-  valid = ! memcmp(buf, tag, taglen); /* constant-time comparison not necessary */
+/* the records on which the lanes pay off depend on the multi-buffer kernel, see sha256cf_mb_kernels[] */
 
-  if (fail_if_invalid) {
-    assert(is_valid == NULL);
-    if (! valid) {
-      return -1;
-    }
-  }
-  else /* if (! fail_if_invalid) */ {
-    assert(is_valid != NULL);
-    *is_valid = valid;
-  }
+int sha256ets_enc_batch(const struct ets_batch *batch) {
+  return ets_batch_run(batch, 0, 16, sha256ets_update_x16, sha256cf_mb_lanes_maxlen()) ? -1 : 0;
+}
 
-  return 0;
+int sha256ets_dec_batch(const struct ets_batch *batch) {
+  return ets_batch_run(batch, 1, 16, sha256ets_update_x16, sha256cf_mb_lanes_maxlen()) ? -1 : 0;
 }
@@ -17,6 +17,8 @@
 #ifndef SHA256ETS_H
 #define SHA256ETS_H
 
+#include <sys/uio.h>
+
 /*
   Note that encrypt-to-self is a one-time primitive, i.e., each key may be used for at most one encryption.
 
@@ -31,11 +33,120 @@
 
   - values mlen and clen have to match for each invocation
 
+  - m and c may be the same buffer (in-place encryption and decryption), otherwise they shall not overlap
+
   - if fail_if_invalid is true and is_valid == NULL: sha256ets_dec flags invalid ciphertexts by returning -1;
     if fail_if_invalid is false and is_valid != NULL: sha256ets_dec stores validity indicator in *is_valid and returns 0.
+
+  - sha256ets_verify checks the tag as sha256ets_dec does, without writing the plaintext anywhere (the memory it needs
+    is fixed and small): it returns 0 for a valid and -1 for an invalid ciphertext (or inadmissible parameters)
 */
 
 int sha256ets_enc(size_t klen, const void *k, size_t adlen, const void *ad, size_t mlen, const void *m, size_t clen, void *c, size_t taglen, void *tag);
 int sha256ets_dec(size_t klen, const void *k, size_t adlen, const void *ad, size_t clen, const void *c, size_t taglen, const void *tag, size_t mlen, void *m, int fail_if_invalid, int *is_valid);
+int sha256ets_verify(size_t klen, const void *k, size_t adlen, const void *ad, size_t clen, const void *c, size_t taglen, const void *tag);
+
+/*
+  Re-encryption under a new key in a single pass: the record (ad, c_in, tag_in) under k_old is decrypted and
+  encrypted under k_new to (ad, c_out, tag_new), block by block, so that no more than one block of plaintext exists
+  at a time, in a buffer on the stack. The verdict on tag_in is reported like for sha256ets_dec; as it is known only
+  at the end of the pass, c_out and tag_new are zeroed if tag_in is invalid. c_out may equal c_in and tag_new
+  may equal tag_in; in place, tag_in is checked in a pass of its own first, and an invalid record, or one under
+  another key than k_old, is left untouched. k_new must be a fresh key.
+*/
+
+int sha256ets_reencrypt(size_t klen_old, const void *k_old, size_t klen_new, const void *k_new, size_t adlen, const void *ad, size_t clen, const void *c_in, size_t taglen_in, const void *tag_in, void *c_out, size_t taglen_new, void *tag_new, int fail_if_invalid, int *is_valid);
+
+/*
+  Scatter-gather variants: the AD, the message and the ciphertext are given as arrays of fragments (adcnt, mcnt,
+  ccnt entries), which are read and written in place, without flattening copies; the fragments of m and c may be
+  split differently, and may be the same for in-place operation. A negative count is an inadmissible parameter.
+  Otherwise as sha256ets_enc/sha256ets_dec.
+*/
+
+int sha256ets_encv(size_t klen, const void *k, const struct iovec *ad, int adcnt, const struct iovec *m, int mcnt, const struct iovec *c, int ccnt, size_t taglen, void *tag);
+int sha256ets_decv(size_t klen, const void *k, const struct iovec *ad, int adcnt, const struct iovec *c, int ccnt, size_t taglen, const void *tag, const struct iovec *m, int mcnt, int fail_if_invalid, int *is_valid);
+
+/*
+  Incremental encryption and decryption, for messages that are not in memory as a whole: a context is created by
+  sha256ets_enc_init resp. sha256ets_dec_init (NULL for inadmissible klen/taglen or if out of memory), takes the AD
+  in any number of sha256ets_update_ad calls and then the message (resp. ciphertext) in any number of
+  sha256ets_update_msg calls, which write the ciphertext (resp. plaintext) of the bytes given right away; in == out
+  is allowed. sha256ets_enc_final writes the tag, sha256ets_dec_final checks it like sha256ets_dec does, and both
+  free the context; sha256ets_ctx_free abandons it. The result is that of sha256ets_enc/sha256ets_dec for any
+  chunking of the input.
+
+  - the context (struct ets_ctx, see ets.h) may only be passed to the sha256ets_ functions
+
+  - the message is processed as it arrives, only a partial block is kept; the AD, however, enters the mode next to
+    the message and is kept in the context until it is absorbed (it has to be given before the message)
+
+  - the plaintext from sha256ets_update_msg is unverified until sha256ets_dec_final has accepted the tag
+
+  - sha256ets_update_ad returns -1 once the message has begun or if out of memory, 0 otherwise
+*/
+
+struct ets_ctx;
+
+struct ets_ctx *sha256ets_enc_init(size_t klen, const void *k, size_t taglen);
+struct ets_ctx *sha256ets_dec_init(size_t klen, const void *k, size_t taglen);
+int sha256ets_update_ad(struct ets_ctx *ctx, const void *ad, size_t adlen);
+int sha256ets_update_msg(struct ets_ctx *ctx, const void *in, void *out, size_t len);
+int sha256ets_enc_final(struct ets_ctx *ctx, void *tag);
+int sha256ets_dec_final(struct ets_ctx *ctx, const void *tag, int fail_if_invalid, int *is_valid);
+void sha256ets_ctx_free(struct ets_ctx *ctx);
+
+/*
+  Snapshots, for resuming an interrupted incremental encryption or decryption, or for appending to a message that
+  has not been finalized: sha256ets_snapshot writes the state of ctx to buf, which has to hold
+  sha256ets_snapshot_size(ctx) bytes, and leaves ctx unchanged; it returns -1 unless the message given so far is a
+  multiple of SHA256CF_STATESIZE bytes (a block boundary), 0 otherwise. sha256ets_resume creates a context from a
+  snapshot and the key (which is not part of it), or returns NULL for a malformed snapshot, one of another
+  algorithm or version, or a key of another length.
+
+  - a snapshot holds the chaining value, the next block to compress and the AD not absorbed yet, but not the key;
+    it is versioned and portable between machines of the same byte order
+
+  - the next block contains the last SHA256CF_STATESIZE bytes of plaintext (of encryption and decryption alike)
+    in the clear, as does the AD: a snapshot has to be protected like the plaintext itself, and must not be
+    stored or sent anywhere the plaintext may not go
+*/
+
+size_t sha256ets_snapshot_size(const struct ets_ctx *ctx);
+int sha256ets_snapshot(const struct ets_ctx *ctx, void *buf);
+struct ets_ctx *sha256ets_resume(const void *buf, size_t len, size_t klen, const void *k);
+
+/*
+  Multi-buffer variants for 8 resp. 16 independent records: record j is given by the j-th entries of the parameter
+  arrays and gives the same result as sha256ets_enc/sha256ets_dec on these. The records are processed side by side,
+  one per 32-bit lane of AVX2 resp. AVX-512 registers (lane by lane with SHA-NI where that is faster, and on CPUs
+  without either); they may differ in all lengths, but the aggregate speed-up is best for records of similar size.
+
+  - if any record fails the parameter checks, -1 is returned and no record is processed
+
+  - if fail_if_invalid is true and is_valid == NULL: sha256ets_dec_x8/_x16 return -1 unless all tags are valid;
+    if fail_if_invalid is false and is_valid != NULL: the validity indicator of record j is stored in is_valid[j] and 0 is returned.
+*/
+
+int sha256ets_enc_x8(const size_t klen[8], const void *const k[8], const size_t adlen[8], const void *const ad[8], const size_t mlen[8], const void *const m[8], const size_t clen[8], void *const c[8], const size_t taglen[8], void *const tag[8]);
+int sha256ets_dec_x8(const size_t klen[8], const void *const k[8], const size_t adlen[8], const void *const ad[8], const size_t clen[8], const void *const c[8], const size_t taglen[8], const void *const tag[8], const size_t mlen[8], void *const m[8], int fail_if_invalid, int is_valid[8]);
+int sha256ets_enc_x16(const size_t klen[16], const void *const k[16], const size_t adlen[16], const void *const ad[16], const size_t mlen[16], const void *const m[16], const size_t clen[16], void *const c[16], const size_t taglen[16], void *const tag[16]);
+int sha256ets_dec_x16(const size_t klen[16], const void *const k[16], const size_t adlen[16], const void *const ad[16], const size_t clen[16], const void *const c[16], const size_t taglen[16], const void *const tag[16], const size_t mlen[16], void *const m[16], int fail_if_invalid, int is_valid[16]);
+
+/*
+  Batches of independent records (struct ets_batch, see ets.h), e.g. for bulk import: record i gives the same result
+  as sha256ets_enc/sha256ets_dec on it. Where the 16-lane kernel is vectorized (AVX2, AVX-512), the records share
+  the 16 lanes of sha256ets_enc_x16, a lane taking the next record as soon as its record is done; with SHA-NI, only
+  records of up to 8 KiB (AD and message) do so. All other records, where the single-record code is as fast or
+  faster, are processed one by one.
+
+  - status[i] is ETS_BATCH_OK, ETS_BATCH_EPARAM or (decryption) ETS_BATCH_INVALID; the return value is 0 if all
+    records are OK, -1 otherwise
+*/
+
+struct ets_batch;
+
+int sha256ets_enc_batch(const struct ets_batch *batch);
+int sha256ets_dec_batch(const struct ets_batch *batch);
 
 #endif /* SHA256ETS_H */
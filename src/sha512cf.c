@@ -16,34 +16,13 @@
 
 #define _DEFAULT_SOURCE /* activates  htobe64  and  be64toh  from endian.h */
 #include <stdint.h>
+#include <string.h>
 #include <endian.h>
 #include "sha512cf.h"
+#include "sha512cf_impl.h"
 
 _Static_assert(sizeof(uint64_t[8]) == SHA512CF_MEMSTATESIZE, "SHA512CF_MEMSTATESIZE has wrong value!");
 
-static const uint64_t k[80] = {
-  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
-  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
-  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
-  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
-  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
-  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
-  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
-  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
-  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
-  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
-  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
-  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
-  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
-  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
-  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
-  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
-  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
-  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
-  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
-  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
-};
-
 static const uint64_t iv[8] = {
   0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
   0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
@@ -82,9 +61,8 @@ void sha512cf_export(const void * _st, void * _out) {
 #define Ch(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
 #define Maj(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
 
-void sha512cf_update(void * _st, const void * _block) {
-  uint64_t *st = _st;
-  const uint64_t *block = _block;
+/* the compression proper, on words st[0..7] = a..h and message words m (host byte order) */
+static inline void sha512cf_compress(uint64_t *st, const uint64_t m[16]) {
   uint64_t a, b, c, d, e, f, g, h;
   uint64_t w[16];
   uint64_t s0, s1, temp1, temp2;
@@ -100,8 +78,8 @@ void sha512cf_update(void * _st, const void * _block) {
   h = st[7];
 
   for (i = 0; i < 16; i++) {
-    w[i] = be64toh(*block++);
-    temp1 = h + Sigma1(e) + Ch(e, f, g) + k[i] + w[i];
+    w[i] = m[i];
+    temp1 = h + Sigma1(e) + Ch(e, f, g) + sha512cf_k[i] + w[i];
     temp2 = Sigma0(a) + Maj(a, b, c);
     h = g;
     g = f;
@@ -119,7 +97,7 @@ void sha512cf_update(void * _st, const void * _block) {
     s1 = w[(i - 2 + 16) & 0x0f];
     s1 = sigma1(s1);
     w[i & 0x0f] += s0 + w[(i - 7 + 16) & 0x0f] + s1;
-    temp1 = h + Sigma1(e) + Ch(e, f, g) + k[i] + w[i & 0x0f];
+    temp1 = h + Sigma1(e) + Ch(e, f, g) + sha512cf_k[i] + w[i & 0x0f];
     temp2 = Sigma0(a) + Maj(a, b, c);
     h = g;
     g = f;
@@ -141,6 +119,226 @@ void sha512cf_update(void * _st, const void * _block) {
   st[7] += h;
 }
 
+static void sha512cf_update_ref(void *st, const void * _block) {
+  const uint8_t *block = _block;
+  uint64_t m[16], x;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    memcpy(&x, block + 8 * i, 8); /* the block may be unaligned */
+    m[i] = be64toh(x);
+  }
+
+  sha512cf_compress(st, m);
+}
+
+static void sha512cf_update_xor_ref(void * _st, const void *block, void * _out, const void * _in, size_t len) {
+  const uint64_t *st = _st;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t w;
+  int i;
+
+  sha512cf_update_ref(_st, block);
+
+  if (len == SHA512CF_STATESIZE) {
+    for (i = 0; i < 8; i++) {
+      memcpy(&w, in + 8 * i, 8);
+      w ^= htobe64(st[i]);
+      memcpy(out + 8 * i, &w, 8);
+    }
+  }
+  else {
+    sha512cf_xor_state(st, out, in, len);
+  }
+}
+
+static void sha512cf_update_split_ref(void * _st, const void * _ad, const void * _key, const void * _msg, void * _out, const void * _in) {
+  uint64_t *st = _st;
+  const uint8_t *ad = _ad;
+  const uint8_t *key = _key;
+  const uint8_t *msg = _msg;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t m[16];
+  uint64_t x, y;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    memcpy(&x, ad + 8 * i, 8);
+    memcpy(&y, key + 8 * i, 8);
+    m[i] = be64toh(x ^ y);
+    memcpy(&x, msg + 8 * i, 8);
+    m[8 + i] = be64toh(x);
+  }
+
+  sha512cf_compress(st, m);
+
+  for (i = 0; i < 8; i++) {
+    memcpy(&x, in + 8 * i, 8);
+    x ^= htobe64(st[i]);
+    memcpy(out + 8 * i, &x, 8);
+  }
+}
+
+static void sha512cf_ets_bulk_ref(void * _st, void * _block, void * _out, const void * _in, size_t nblocks, int decrypt) {
+  uint64_t *st = _st;
+  uint8_t *block = _block;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t s[8], m[16];
+  uint64_t x, y;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    s[i] = st[i];
+  }
+  for (i = 0; i < 16; i++) {
+    memcpy(&x, block + 8 * i, 8);
+    m[i] = be64toh(x);
+  }
+
+  for ( ; nblocks > 0; nblocks--) {
+    sha512cf_compress(s, m);
+    for (i = 0; i < 8; i++) {
+      memcpy(&x, in + 8 * i, 8);
+      y = x ^ htobe64(s[i]);
+      memcpy(out + 8 * i, &y, 8);
+      m[8 + i] = be64toh(decrypt ? y : x); /* the plaintext, read before (encryption) or after (decryption) the store */
+    }
+    in += SHA512CF_STATESIZE, out += SHA512CF_STATESIZE;
+  }
+
+  for (i = 0; i < 8; i++) {
+    st[i] = s[i];
+    x = htobe64(m[8 + i]);
+    memcpy(block + 64 + 8 * i, &x, 8);
+  }
+}
+
+static void sha512cf_update_x4_ref(void *const st[4], const void *const block[4]) {
+  int j;
+
+  for (j = 0; j < 4; j++) {
+    sha512cf_update_ref(st[j], block[j]);
+  }
+}
+
+static void sha512cf_update_x8_ref(void *const st[8], const void *const block[8]) {
+  int j;
+
+  for (j = 0; j < 8; j++) {
+    sha512cf_update_ref(st[j], block[j]);
+  }
+}
+
+const struct sha512cf_kernel sha512cf_kernels[] = {
+#if HAVE_X86_SIMD
+  /* single blocks as with AVX2, only the multi-buffer kernels use the 512-bit registers; the vector lanes are ahead at all record lengths */
+  { "avx512", CPU_AVX512, sha512cf_update_avx2, sha512cf_update_xor_avx2, sha512cf_update_split_avx2, sha512cf_ets_bulk_avx2, sha512cf_update_x4_avx512, sha512cf_update_x8_avx512, SIZE_MAX },
+  { "avx2", CPU_AVX2, sha512cf_update_avx2, sha512cf_update_xor_avx2, sha512cf_update_split_avx2, sha512cf_ets_bulk_avx2, sha512cf_update_x4_avx2, sha512cf_update_x8_avx2, SIZE_MAX },
+#endif
+  /* the reference lanes run one after the other, and lose to the single-record code at all lengths */
+  { "ref", 0, sha512cf_update_ref, sha512cf_update_xor_ref, sha512cf_update_split_ref, sha512cf_ets_bulk_ref, sha512cf_update_x4_ref, sha512cf_update_x8_ref, 0 },
+};
+
+static const struct sha512cf_kernel *sha512cf_select(void) {
+  const struct sha512cf_kernel *kernel = sha512cf_kernels;
+  unsigned int features = cpu_features();
+
+  while ((kernel->features & features) != kernel->features) {
+    kernel++;
+  }
+  return kernel;
+}
+
+static void sha512cf_update_bind(void *st, const void *block);
+static void sha512cf_update_xor_bind(void *st, const void *block, void *out, const void *in, size_t len);
+static void sha512cf_update_split_bind(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in);
+static void sha512cf_ets_bulk_bind(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
+static void sha512cf_update_x4_bind(void *const st[4], const void *const block[4]);
+static void sha512cf_update_x8_bind(void *const st[8], const void *const block[8]);
+
+static sha512cf_update_fn sha512cf_update_impl = sha512cf_update_bind;
+static sha512cf_update_xor_fn sha512cf_update_xor_impl = sha512cf_update_xor_bind;
+static sha512cf_update_split_fn sha512cf_update_split_impl = sha512cf_update_split_bind;
+static sha512cf_ets_bulk_fn sha512cf_ets_bulk_impl = sha512cf_ets_bulk_bind;
+static sha512cf_update_xn_fn sha512cf_update_x4_impl = sha512cf_update_x4_bind;
+static sha512cf_update_xn_fn sha512cf_update_x8_impl = sha512cf_update_x8_bind;
+
+static void sha512cf_bind(void) {
+  const struct sha512cf_kernel *kernel = sha512cf_select();
+  ATOMIC_STORE_RELEASE(&sha512cf_update_impl, kernel->update);
+  ATOMIC_STORE_RELEASE(&sha512cf_update_xor_impl, kernel->update_xor);
+  ATOMIC_STORE_RELEASE(&sha512cf_update_split_impl, kernel->update_split);
+  ATOMIC_STORE_RELEASE(&sha512cf_ets_bulk_impl, kernel->ets_bulk);
+  ATOMIC_STORE_RELEASE(&sha512cf_update_x4_impl, kernel->update_x4);
+  ATOMIC_STORE_RELEASE(&sha512cf_update_x8_impl, kernel->update_x8);
+}
+
+/* first call only: bind sha512cf_update(_xor/_split/_x4/_x8) and sha512cf_ets_bulk to the best kernel, then forward */
+static void sha512cf_update_bind(void *st, const void *block) {
+  sha512cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_impl))(st, block);
+}
+
+static void sha512cf_update_xor_bind(void *st, const void *block, void *out, const void *in, size_t len) {
+  sha512cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_xor_impl))(st, block, out, in, len);
+}
+
+static void sha512cf_update_split_bind(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in) {
+  sha512cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_split_impl))(st, ad, key, msg, out, in);
+}
+
+static void sha512cf_ets_bulk_bind(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt) {
+  sha512cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_ets_bulk_impl))(st, block, out, in, nblocks, decrypt);
+}
+
+static void sha512cf_update_x4_bind(void *const st[4], const void *const block[4]) {
+  sha512cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_x4_impl))(st, block);
+}
+
+static void sha512cf_update_x8_bind(void *const st[8], const void *const block[8]) {
+  sha512cf_bind();
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_x8_impl))(st, block);
+}
+
+void sha512cf_update(void *st, const void *block) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_impl))(st, block);
+}
+
+void sha512cf_update_xor(void *st, const void *block, void *out, const void *in, size_t len) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_xor_impl))(st, block, out, in, len);
+}
+
+void sha512cf_update_split(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_split_impl))(st, ad, key, msg, out, in);
+}
+
+void sha512cf_ets_bulk(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_ets_bulk_impl))(st, block, out, in, nblocks, decrypt);
+}
+
+void sha512cf_update_x4(void *const st[4], const void *const block[4]) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_x4_impl))(st, block);
+}
+
+void sha512cf_update_x8(void *const st[8], const void *const block[8]) {
+  (*ATOMIC_LOAD_ACQUIRE(&sha512cf_update_x8_impl))(st, block);
+}
+
+const char *sha512cf_backend(void) {
+  return sha512cf_select()->name;
+}
+
+size_t sha512cf_lanes_maxlen(void) {
+  return sha512cf_select()->lanes_maxlen;
+}
+
 void sha512cf_flip(void * _st) {
   uint64_t *st = _st;
   int i;
@@ -17,6 +17,8 @@
 #ifndef SHA512CF_H
 #define SHA512CF_H
 
+#include <stddef.h>
+
 #define SHA512CF_BLOCKSIZE 128
 #define SHA512CF_STATESIZE 64
 
@@ -26,6 +28,28 @@ void sha512cf_init(void *st);
 void sha512cf_clear(void *st);
 void sha512cf_export(const void *st, void *out);
 void sha512cf_update(void *st, const void *block);
+
+/* sha512cf_update, then out = in XOR (first len <= SHA512CF_STATESIZE bytes of the exported state); out == in is allowed */
+void sha512cf_update_xor(void *st, const void *block, void *out, const void *in, size_t len);
+
+/*
+  Compress the block (ad XOR key) || msg, with SHA512CF_BLOCKSIZE - SHA512CF_STATESIZE bytes of ad and key and
+  SHA512CF_STATESIZE bytes of msg, without staging it in a buffer; then out = in XOR (exported state),
+  over SHA512CF_STATESIZE bytes; out == in is allowed.
+*/
+void sha512cf_update_split(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in);
+
+/*
+  Steady-state bulk phase of the encrypt-to-self mode, with the chaining value kept in registers throughout:
+  for each of the nblocks blocks, compress block, XOR the exported state into the next SHA512CF_STATESIZE bytes
+  of in to give out, and replace the last SHA512CF_STATESIZE bytes of block by the plaintext of this step
+  (in if decrypt == 0, out otherwise). The first bytes of block are the same for all blocks.
+*/
+void sha512cf_ets_bulk(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
 void sha512cf_flip(void *st);
 
+/* four, resp. eight, independent sha512cf_update calls, lane j on st[j] with block[j], computed side by side in SIMD lanes */
+void sha512cf_update_x4(void *const st[4], const void *const block[4]);
+void sha512cf_update_x8(void *const st[8], const void *const block[8]);
+
 #endif /* SHA512CF_H */
@@ -0,0 +1,376 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _DEFAULT_SOURCE /* activates  htobe64  from endian.h */
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include "sha512cf.h"
+#include "sha512cf_impl.h"
+
+#if HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+  SHA-512 compression with the message schedule expanded in AVX2 registers, four words at a time, and
+  stored together with the round constants as w[i] + k[i]; the 80 rounds themselves run on the scalar ALUs.
+*/
+
+#define ROR64(a, n) (((uint64_t)(a) << (64 - n)) | (((uint64_t)(a) >> n)))
+#define Sigma0(x) (ROR64((x), 28) ^ ROR64((x), 34) ^ ROR64((x), 39))
+#define Sigma1(x) (ROR64((x), 14) ^ ROR64((x), 18) ^ ROR64((x), 41))
+#define Ch(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define Maj(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+#define VROR64(x, n) _mm256_or_si256(_mm256_srli_epi64((x), (n)), _mm256_slli_epi64((x), 64 - (n)))
+#define vsigma0(x) _mm256_xor_si256(_mm256_xor_si256(VROR64((x), 1), VROR64((x), 8)), _mm256_srli_epi64((x), 7))
+#define vsigma1(x) _mm256_xor_si256(_mm256_xor_si256(VROR64((x), 19), VROR64((x), 61)), _mm256_srli_epi64((x), 6))
+
+/* (a1, a2, a3, b0) from (a0, a1, a2, a3) and (b0, b1, b2, b3) */
+#define SHIFT1(a, b) _mm256_alignr_epi8(_mm256_permute2x128_si256((a), (b), 0x21), (a), 8)
+
+/* x0..x3 hold w[i-16..i-1]; computes w[i..i+3] into x0 and rotates the register names via the caller */
+#define SCHEDULE(x0, x1, x2, x3) do {                                   \
+    __m256i s1;                                                         \
+    x0 = _mm256_add_epi64(x0, _mm256_add_epi64(SHIFT1(x2, x3), vsigma0(SHIFT1(x0, x1)))); \
+    s1 = vsigma1(_mm256_permute4x64_epi64(x3, _MM_SHUFFLE(1, 0, 3, 2))); \
+    x0 = _mm256_add_epi64(x0, _mm256_blend_epi32(s1, zero, 0xf0));      \
+    s1 = vsigma1(_mm256_permute4x64_epi64(x0, _MM_SHUFFLE(1, 0, 1, 0))); \
+    x0 = _mm256_add_epi64(x0, _mm256_blend_epi32(zero, s1, 0xf0));      \
+  } while (0)
+
+#define STORE_WK(i, x) _mm256_storeu_si256((__m256i *)(wk + (i)), \
+                                           _mm256_add_epi64((x), _mm256_loadu_si256((const __m256i *)(sha512cf_k + (i)))))
+
+#define ROUND(a, b, c, d, e, f, g, h, i) do {                           \
+    uint64_t temp1, temp2;                                              \
+    temp1 = h + Sigma1(e) + Ch(e, f, g) + wk[(i) * stride];             \
+    temp2 = Sigma0(a) + Maj(a, b, c);                                   \
+    d += temp1;                                                         \
+    h = temp1 + temp2;                                                  \
+  } while (0)
+
+#define LOAD_MSG(p, i) _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(p) + (i)), bswap)
+
+/* the 80 rounds on st, reading w[i] + k[i] from wk[i * stride] */
+static inline void sha512cf_rounds(uint64_t *st, const uint64_t *wk, size_t stride) {
+  uint64_t a, b, c, d, e, f, g, h;
+  int i;
+
+  a = st[0];
+  b = st[1];
+  c = st[2];
+  d = st[3];
+  e = st[4];
+  f = st[5];
+  g = st[6];
+  h = st[7];
+
+  for (i = 0; i < 80; i += 8) {
+    ROUND(a, b, c, d, e, f, g, h, i + 0);
+    ROUND(h, a, b, c, d, e, f, g, i + 1);
+    ROUND(g, h, a, b, c, d, e, f, i + 2);
+    ROUND(f, g, h, a, b, c, d, e, i + 3);
+    ROUND(e, f, g, h, a, b, c, d, i + 4);
+    ROUND(d, e, f, g, h, a, b, c, i + 5);
+    ROUND(c, d, e, f, g, h, a, b, i + 6);
+    ROUND(b, c, d, e, f, g, h, a, i + 7);
+  }
+
+  st[0] += a;
+  st[1] += b;
+  st[2] += c;
+  st[3] += d;
+  st[4] += e;
+  st[5] += f;
+  st[6] += g;
+  st[7] += h;
+}
+
+/* compresses the message words x0..x3 (host byte order) into st */
+TARGET("avx2")
+static inline void sha512cf_compress(uint64_t *st, __m256i x0, __m256i x1, __m256i x2, __m256i x3) {
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t wk[80];
+  int i;
+
+  STORE_WK(0, x0);
+  STORE_WK(4, x1);
+  STORE_WK(8, x2);
+  STORE_WK(12, x3);
+
+  for (i = 16; i < 80; i += 16) {
+    SCHEDULE(x0, x1, x2, x3);
+    STORE_WK(i + 0, x0);
+    SCHEDULE(x1, x2, x3, x0);
+    STORE_WK(i + 4, x1);
+    SCHEDULE(x2, x3, x0, x1);
+    STORE_WK(i + 8, x2);
+    SCHEDULE(x3, x0, x1, x2);
+    STORE_WK(i + 12, x3);
+  }
+
+  sha512cf_rounds(st, wk, 1);
+}
+
+/*
+  Encryption side of the bulk phase: all blocks of the next LANES steps are known in advance (constant first half,
+  previous plaintext chunk as second half), so their schedules are expanded side by side, one block per 64-bit lane,
+  into wk[i][lane] = w[i] + k[i]; only the rounds are left for the serial chain.
+*/
+#define LANES 4
+
+/* r0..r3 = rows of a 4x4 matrix of 64-bit words; transposed in place */
+#define TRANSPOSE4(r0, r1, r2, r3) do {                                 \
+    __m256i t0 = _mm256_unpacklo_epi64(r0, r1);                         \
+    __m256i t1 = _mm256_unpackhi_epi64(r0, r1);                         \
+    __m256i t2 = _mm256_unpacklo_epi64(r2, r3);                         \
+    __m256i t3 = _mm256_unpackhi_epi64(r2, r3);                         \
+    r0 = _mm256_permute2x128_si256(t0, t2, 0x20);                       \
+    r1 = _mm256_permute2x128_si256(t1, t3, 0x20);                       \
+    r2 = _mm256_permute2x128_si256(t0, t2, 0x31);                       \
+    r3 = _mm256_permute2x128_si256(t1, t3, 0x31);                       \
+  } while (0)
+
+/* the second half of the block of lane j is chunk[j]; head[] holds the first half (host byte order) */
+TARGET("avx2")
+static inline void sha512cf_schedule_lanes(uint64_t wk[80][LANES], const uint64_t *head, const uint8_t *chunk[LANES]) {
+  const __m256i bswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  __m256i w[16], x;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    w[i] = _mm256_set1_epi64x((long long int)head[i]);
+  }
+  for (i = 0; i < 2; i++) {
+    w[8 + 4 * i + 0] = LOAD_MSG(chunk[0], i);
+    w[8 + 4 * i + 1] = LOAD_MSG(chunk[1], i);
+    w[8 + 4 * i + 2] = LOAD_MSG(chunk[2], i);
+    w[8 + 4 * i + 3] = LOAD_MSG(chunk[3], i);
+    TRANSPOSE4(w[8 + 4 * i + 0], w[8 + 4 * i + 1], w[8 + 4 * i + 2], w[8 + 4 * i + 3]);
+  }
+
+  for (i = 0; i < 80; i++) {
+    if (i >= 16) {
+      x = _mm256_add_epi64(vsigma1(w[(i - 2) & 15]), w[(i - 7) & 15]);
+      w[i & 15] = _mm256_add_epi64(_mm256_add_epi64(x, vsigma0(w[(i - 15) & 15])), w[i & 15]);
+    }
+    _mm256_storeu_si256((__m256i *)wk[i], _mm256_add_epi64(w[i & 15], _mm256_set1_epi64x((long long int)sha512cf_k[i])));
+  }
+}
+
+TARGET("avx2")
+void sha512cf_update_avx2(void *st, const void *block) {
+  const __m256i bswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+  sha512cf_compress(st, LOAD_MSG(block, 0), LOAD_MSG(block, 1), LOAD_MSG(block, 2), LOAD_MSG(block, 3));
+}
+
+TARGET("avx2")
+void sha512cf_update_xor_avx2(void * _st, const void *block, void * _out, const void * _in, size_t len) {
+  uint64_t *st = _st;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t w;
+  int i;
+
+  sha512cf_update_avx2(st, block);
+  if (len == SHA512CF_STATESIZE) {
+    /* the rounds ran on scalar registers, so stay there: word-sized accesses forward from the state stores */
+    for (i = 0; i < 8; i++) {
+      memcpy(&w, in + 8 * i, 8);
+      w ^= htobe64(st[i]);
+      memcpy(out + 8 * i, &w, 8);
+    }
+  }
+  else {
+    sha512cf_xor_state(st, out, in, len);
+  }
+}
+
+TARGET("avx2")
+void sha512cf_update_split_avx2(void * _st, const void *ad, const void *key, const void *msg, void * _out, const void * _in) {
+  const __m256i bswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  uint64_t *st = _st;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t w;
+  __m256i x0, x1;
+  int i;
+
+  x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)ad + 0), _mm256_loadu_si256((const __m256i *)key + 0));
+  x1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)ad + 1), _mm256_loadu_si256((const __m256i *)key + 1));
+  sha512cf_compress(st, _mm256_shuffle_epi8(x0, bswap), _mm256_shuffle_epi8(x1, bswap), LOAD_MSG(msg, 0), LOAD_MSG(msg, 1));
+
+  for (i = 0; i < 8; i++) {
+    memcpy(&w, in + 8 * i, 8);
+    w ^= htobe64(st[i]);
+    memcpy(out + 8 * i, &w, 8);
+  }
+}
+
+TARGET("avx2")
+void sha512cf_ets_bulk_avx2(void *st, void * _block, void * _out, const void * _in, size_t nblocks, int decrypt) {
+  const __m256i bswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  uint8_t *block = _block;
+  uint8_t *out = _out;
+  const uint8_t *in = _in;
+  uint64_t s[8], p[8];
+  uint64_t x, y;
+  __m256i x0, x1;
+  uint64_t head[8];
+  uint64_t wk[80][LANES];
+  const uint8_t *chunk[LANES];
+  size_t n, j;
+  int i;
+
+  memcpy(s, st, sizeof(s));
+  memcpy(p, block + SHA512CF_BLOCKSIZE - SHA512CF_STATESIZE, sizeof(p));
+  x0 = LOAD_MSG(block, 0);
+  x1 = LOAD_MSG(block, 1);
+
+  if (! decrypt) {
+    _mm256_storeu_si256((__m256i *)head + 0, x0);
+    _mm256_storeu_si256((__m256i *)head + 1, x1);
+  }
+
+  /* encryption: LANES blocks at a time, the block of step j ends with the plaintext of step j - 1 */
+  for ( ; ! decrypt && nblocks > 0; nblocks -= n) {
+    n = nblocks < LANES ? nblocks : LANES;
+    for (j = 0; j < LANES; j++) {
+      chunk[j] = j == 0 || j >= n ? (const uint8_t *)p : in + (j - 1) * SHA512CF_STATESIZE;
+    }
+    sha512cf_schedule_lanes(wk, head, chunk);
+
+    for (j = 0; j < n; j++) {
+      sha512cf_rounds(s, &wk[0][j], LANES);
+      for (i = 0; i < 8; i++) {
+        memcpy(&x, in + 8 * i, 8);
+        y = x ^ htobe64(s[i]);
+        memcpy(out + 8 * i, &y, 8);
+        p[i] = x;
+      }
+      in += SHA512CF_STATESIZE, out += SHA512CF_STATESIZE;
+    }
+  }
+
+  for ( ; nblocks > 0; nblocks--) {
+    sha512cf_compress(s, x0, x1, LOAD_MSG(p, 0), LOAD_MSG(p, 1));
+    for (i = 0; i < 8; i++) {
+      memcpy(&x, in + 8 * i, 8);
+      y = x ^ htobe64(s[i]);
+      memcpy(out + 8 * i, &y, 8);
+      p[i] = decrypt ? y : x;
+    }
+    in += SHA512CF_STATESIZE, out += SHA512CF_STATESIZE;
+  }
+
+  memcpy(st, s, sizeof(s));
+  memcpy(block + SHA512CF_BLOCKSIZE - SHA512CF_STATESIZE, p, sizeof(p));
+}
+
+/*
+  Multi-buffer compression of four independent blocks, one per 64-bit lane: state words, message schedule
+  and rounds all run on whole registers, with 4x4 transposes to get the state and the message into this layout.
+*/
+
+#define VSigma0(x) _mm256_xor_si256(_mm256_xor_si256(VROR64((x), 28), VROR64((x), 34)), VROR64((x), 39))
+#define VSigma1(x) _mm256_xor_si256(_mm256_xor_si256(VROR64((x), 14), VROR64((x), 18)), VROR64((x), 41))
+#define VCh(x, y, z) _mm256_xor_si256(_mm256_and_si256((x), (y)), _mm256_andnot_si256((x), (z)))
+#define VMaj(x, y, z) _mm256_or_si256(_mm256_and_si256((x), (y)), _mm256_and_si256((z), _mm256_or_si256((x), (y))))
+
+#define VROUND(a, b, c, d, e, f, g, h, i) do {                          \
+    __m256i temp1, temp2;                                               \
+    if ((i) >= 16) {                                                    \
+      temp1 = _mm256_add_epi64(vsigma1(w[((i) - 2) & 15]), w[((i) - 7) & 15]); \
+      w[(i) & 15] = _mm256_add_epi64(_mm256_add_epi64(temp1, vsigma0(w[((i) - 15) & 15])), w[(i) & 15]); \
+    }                                                                   \
+    temp1 = _mm256_add_epi64(_mm256_add_epi64(h, VSigma1(e)), _mm256_add_epi64(VCh(e, f, g), \
+                             _mm256_add_epi64(w[(i) & 15], _mm256_set1_epi64x((long long int)sha512cf_k[i])))); \
+    temp2 = _mm256_add_epi64(VSigma0(a), VMaj(a, b, c));                \
+    d = _mm256_add_epi64(d, temp1);                                     \
+    h = _mm256_add_epi64(temp1, temp2);                                 \
+  } while (0)
+
+TARGET("avx2")
+void sha512cf_update_x4_avx2(void *const st[4], const void *const block[4]) {
+  const __m256i bswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  __m256i s[8], w[16], a, b, c, d, e, f, g, h;
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < 4; j++) {
+      w[4 * i + j] = LOAD_MSG(block[j], i);
+    }
+    TRANSPOSE4(w[4 * i + 0], w[4 * i + 1], w[4 * i + 2], w[4 * i + 3]);
+  }
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < 4; j++) {
+      s[4 * i + j] = _mm256_loadu_si256((const __m256i *)st[j] + i);
+    }
+    TRANSPOSE4(s[4 * i + 0], s[4 * i + 1], s[4 * i + 2], s[4 * i + 3]);
+  }
+
+  a = s[0];
+  b = s[1];
+  c = s[2];
+  d = s[3];
+  e = s[4];
+  f = s[5];
+  g = s[6];
+  h = s[7];
+
+  for (i = 0; i < 80; i += 8) {
+    VROUND(a, b, c, d, e, f, g, h, i + 0);
+    VROUND(h, a, b, c, d, e, f, g, i + 1);
+    VROUND(g, h, a, b, c, d, e, f, i + 2);
+    VROUND(f, g, h, a, b, c, d, e, i + 3);
+    VROUND(e, f, g, h, a, b, c, d, i + 4);
+    VROUND(d, e, f, g, h, a, b, c, i + 5);
+    VROUND(c, d, e, f, g, h, a, b, i + 6);
+    VROUND(b, c, d, e, f, g, h, a, i + 7);
+  }
+
+  s[0] = _mm256_add_epi64(s[0], a);
+  s[1] = _mm256_add_epi64(s[1], b);
+  s[2] = _mm256_add_epi64(s[2], c);
+  s[3] = _mm256_add_epi64(s[3], d);
+  s[4] = _mm256_add_epi64(s[4], e);
+  s[5] = _mm256_add_epi64(s[5], f);
+  s[6] = _mm256_add_epi64(s[6], g);
+  s[7] = _mm256_add_epi64(s[7], h);
+  for (i = 0; i < 2; i++) {
+    TRANSPOSE4(s[4 * i + 0], s[4 * i + 1], s[4 * i + 2], s[4 * i + 3]);
+    for (j = 0; j < 4; j++) {
+      _mm256_storeu_si256((__m256i *)st[j] + i, s[4 * i + j]);
+    }
+  }
+}
+
+/* eight lanes as two halves of four */
+TARGET("avx2")
+void sha512cf_update_x8_avx2(void *const st[8], const void *const block[8]) {
+  sha512cf_update_x4_avx2(st + 0, block + 0);
+  sha512cf_update_x4_avx2(st + 4, block + 4);
+}
+
+#endif /* HAVE_X86_SIMD */
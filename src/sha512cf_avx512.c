@@ -0,0 +1,151 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "sha512cf.h"
+#include "sha512cf_impl.h"
+
+#if HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+  Multi-buffer compression of eight independent blocks, one per 64-bit lane of the 512-bit registers
+  (see sha512cf_update_x4_avx2); AVX-512 adds native rotations (vprorq) and three-input logic (vpternlogq)
+  for Ch, Maj and the three-way XORs of the Sigma functions.
+*/
+
+#define ROR(x, n) _mm512_ror_epi64((x), (n))
+#define XOR3(x, y, z) _mm512_ternarylogic_epi64((x), (y), (z), 0x96)
+#define Sigma0(x) XOR3(ROR((x), 28), ROR((x), 34), ROR((x), 39))
+#define Sigma1(x) XOR3(ROR((x), 14), ROR((x), 18), ROR((x), 41))
+#define sigma0(x) XOR3(ROR((x), 1), ROR((x), 8), _mm512_srli_epi64((x), 7))
+#define sigma1(x) XOR3(ROR((x), 19), ROR((x), 61), _mm512_srli_epi64((x), 6))
+#define Ch(x, y, z) _mm512_ternarylogic_epi64((x), (y), (z), 0xca)
+#define Maj(x, y, z) _mm512_ternarylogic_epi64((x), (y), (z), 0xe8)
+
+/* byte swap of each 64-bit word without vpshufb (AVX-512BW) */
+#define BSWAP32(x) _mm512_ternarylogic_epi32(_mm512_set1_epi32(0x00ff00ff), _mm512_ror_epi32((x), 24), _mm512_ror_epi32((x), 8), 0xca)
+#define BSWAP64(x) ROR(BSWAP32(x), 32)
+
+#define ROUND(a, b, c, d, e, f, g, h, i) do {                           \
+    __m512i temp1, temp2;                                               \
+    if ((i) >= 16) {                                                    \
+      temp1 = _mm512_add_epi64(sigma1(w[((i) - 2) & 15]), w[((i) - 7) & 15]); \
+      w[(i) & 15] = _mm512_add_epi64(_mm512_add_epi64(temp1, sigma0(w[((i) - 15) & 15])), w[(i) & 15]); \
+    }                                                                   \
+    temp1 = _mm512_add_epi64(_mm512_add_epi64(h, Sigma1(e)), _mm512_add_epi64(Ch(e, f, g), \
+                             _mm512_add_epi64(w[(i) & 15], _mm512_set1_epi64((long long int)sha512cf_k[i])))); \
+    temp2 = _mm512_add_epi64(Sigma0(a), Maj(a, b, c));                  \
+    d = _mm512_add_epi64(d, temp1);                                     \
+    h = _mm512_add_epi64(temp1, temp2);                                 \
+  } while (0)
+
+#define TRANSPOSE8(r0, r1, r2, r3, r4, r5, r6, r7) do {                 \
+    __m512i t0 = _mm512_unpacklo_epi64(r0, r1);                         \
+    __m512i t1 = _mm512_unpackhi_epi64(r0, r1);                         \
+    __m512i t2 = _mm512_unpacklo_epi64(r2, r3);                         \
+    __m512i t3 = _mm512_unpackhi_epi64(r2, r3);                         \
+    __m512i t4 = _mm512_unpacklo_epi64(r4, r5);                         \
+    __m512i t5 = _mm512_unpackhi_epi64(r4, r5);                         \
+    __m512i t6 = _mm512_unpacklo_epi64(r6, r7);                         \
+    __m512i t7 = _mm512_unpackhi_epi64(r6, r7);                         \
+    __m512i u0 = _mm512_shuffle_i64x2(t0, t2, 0x88);                    \
+    __m512i u1 = _mm512_shuffle_i64x2(t0, t2, 0xdd);                    \
+    __m512i u2 = _mm512_shuffle_i64x2(t1, t3, 0x88);                    \
+    __m512i u3 = _mm512_shuffle_i64x2(t1, t3, 0xdd);                    \
+    __m512i u4 = _mm512_shuffle_i64x2(t4, t6, 0x88);                    \
+    __m512i u5 = _mm512_shuffle_i64x2(t4, t6, 0xdd);                    \
+    __m512i u6 = _mm512_shuffle_i64x2(t5, t7, 0x88);                    \
+    __m512i u7 = _mm512_shuffle_i64x2(t5, t7, 0xdd);                    \
+    r0 = _mm512_shuffle_i64x2(u0, u4, 0x88);                            \
+    r4 = _mm512_shuffle_i64x2(u0, u4, 0xdd);                            \
+    r2 = _mm512_shuffle_i64x2(u1, u5, 0x88);                            \
+    r6 = _mm512_shuffle_i64x2(u1, u5, 0xdd);                            \
+    r1 = _mm512_shuffle_i64x2(u2, u6, 0x88);                            \
+    r5 = _mm512_shuffle_i64x2(u2, u6, 0xdd);                            \
+    r3 = _mm512_shuffle_i64x2(u3, u7, 0x88);                            \
+    r7 = _mm512_shuffle_i64x2(u3, u7, 0xdd);                            \
+  } while (0)
+
+TARGET("avx2,avx512f,avx512vl")
+void sha512cf_update_x8_avx512(void *const st[8], const void *const block[8]) {
+  __m512i s[8], w[16], a, b, c, d, e, f, g, h;
+  int i, j;
+
+  for (i = 0; i < 16; i += 8) {
+    for (j = 0; j < 8; j++) {
+      w[i + j] = BSWAP64(_mm512_loadu_si512((const uint64_t *)block[j] + i));
+    }
+    TRANSPOSE8(w[i + 0], w[i + 1], w[i + 2], w[i + 3], w[i + 4], w[i + 5], w[i + 6], w[i + 7]);
+  }
+  for (j = 0; j < 8; j++) {
+    s[j] = _mm512_loadu_si512(st[j]);
+  }
+  TRANSPOSE8(s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7]);
+
+  a = s[0];
+  b = s[1];
+  c = s[2];
+  d = s[3];
+  e = s[4];
+  f = s[5];
+  g = s[6];
+  h = s[7];
+
+  for (i = 0; i < 80; i += 8) {
+    ROUND(a, b, c, d, e, f, g, h, i + 0);
+    ROUND(h, a, b, c, d, e, f, g, i + 1);
+    ROUND(g, h, a, b, c, d, e, f, i + 2);
+    ROUND(f, g, h, a, b, c, d, e, i + 3);
+    ROUND(e, f, g, h, a, b, c, d, i + 4);
+    ROUND(d, e, f, g, h, a, b, c, i + 5);
+    ROUND(c, d, e, f, g, h, a, b, i + 6);
+    ROUND(b, c, d, e, f, g, h, a, i + 7);
+  }
+
+  s[0] = _mm512_add_epi64(s[0], a);
+  s[1] = _mm512_add_epi64(s[1], b);
+  s[2] = _mm512_add_epi64(s[2], c);
+  s[3] = _mm512_add_epi64(s[3], d);
+  s[4] = _mm512_add_epi64(s[4], e);
+  s[5] = _mm512_add_epi64(s[5], f);
+  s[6] = _mm512_add_epi64(s[6], g);
+  s[7] = _mm512_add_epi64(s[7], h);
+  TRANSPOSE8(s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7]);
+  for (j = 0; j < 8; j++) {
+    _mm512_storeu_si512(st[j], s[j]);
+  }
+}
+
+/* four lanes through the eight-lane kernel: even with half of it idle, this beats the AVX2 kernel */
+TARGET("avx2,avx512f,avx512vl")
+void sha512cf_update_x4_avx512(void *const st[4], const void *const block[4]) {
+  uint64_t idle_st[8] = { 0 };
+  uint64_t idle_block[16] = { 0 };
+  void *st8[8];
+  const void *block8[8];
+  int j;
+
+  for (j = 0; j < 4; j++) {
+    st8[j] = st[j], block8[j] = block[j];
+    st8[4 + j] = idle_st, block8[4 + j] = idle_block;
+  }
+  sha512cf_update_x8_avx512(st8, block8);
+}
+
+#endif /* HAVE_X86_SIMD */
@@ -0,0 +1,96 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef SHA512CF_IMPL_H
+#define SHA512CF_IMPL_H
+
+/* internal header, shared by the scalar, the AVX2 and the AVX-512 implementations of sha512cf_update */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+static const uint64_t sha512cf_k[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+typedef void (*sha512cf_update_fn)(void *st, const void *block);
+typedef void (*sha512cf_update_xor_fn)(void *st, const void *block, void *out, const void *in, size_t len);
+typedef void (*sha512cf_update_split_fn)(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in);
+typedef void (*sha512cf_ets_bulk_fn)(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
+typedef void (*sha512cf_update_xn_fn)(void *const *st, const void *const *block);
+
+struct sha512cf_kernel {
+  const char *name;
+  unsigned int features; /* required CPU features, see cpu.h */
+  sha512cf_update_fn update;
+  sha512cf_update_xor_fn update_xor;
+  sha512cf_update_split_fn update_split;
+  sha512cf_ets_bulk_fn ets_bulk;
+  sha512cf_update_xn_fn update_x4;
+  sha512cf_update_xn_fn update_x8;
+  size_t lanes_maxlen; /* longest ETS record (AD and message) on which the multi-buffer kernels beat the single-record code, SIZE_MAX: all, 0: none */
+};
+
+/* best kernel first, terminated by the portable reference code (features == 0) */
+extern const struct sha512cf_kernel sha512cf_kernels[];
+
+/* name of the kernel sha512cf_update is bound to, for display only */
+const char *sha512cf_backend(void);
+
+/* lanes_maxlen of that kernel, by which the batch functions decide between the lanes and the single-record code */
+size_t sha512cf_lanes_maxlen(void);
+
+/* out = in XOR (first len bytes of the big-endian encoding of st); the partial-block tail of the fused kernels */
+static inline void sha512cf_xor_state(const uint64_t *st, uint8_t *out, const uint8_t *in, size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    out[i] = in[i] ^ (uint8_t)(st[i / 8] >> (56 - 8 * (i % 8)));
+  }
+}
+
+#if HAVE_X86_SIMD
+/* same contracts as sha512cf_update(_xor/_split/_x4/_x8) and sha512cf_ets_bulk; callers have to make sure the CPU supports AVX2, resp. AVX-512 */
+void sha512cf_update_avx2(void *st, const void *block);
+void sha512cf_update_xor_avx2(void *st, const void *block, void *out, const void *in, size_t len);
+void sha512cf_update_split_avx2(void *st, const void *ad, const void *key, const void *msg, void *out, const void *in);
+void sha512cf_ets_bulk_avx2(void *st, void *block, void *out, const void *in, size_t nblocks, int decrypt);
+void sha512cf_update_x4_avx2(void *const st[4], const void *const block[4]);
+void sha512cf_update_x8_avx2(void *const st[8], const void *const block[8]);
+void sha512cf_update_x4_avx512(void *const st[4], const void *const block[4]);
+void sha512cf_update_x8_avx512(void *const st[8], const void *const block[8]);
+#endif
+
+#endif /* SHA512CF_IMPL_H */
@@ -20,6 +20,8 @@
 #include <string.h>
 
 #include "../src/blake2cf.h"
+#include "../src/blake2cf_impl.h"
+#include "../src/cpu.h"
 
 /* known-answer test */
 static void kat(int klen, const uint8_t *key, int mdlen, int mlen, const uint8_t *m, const uint8_t *known_answer) {
@@ -147,9 +149,115 @@ static void keyed(void) {
   kat(64, key, 64, 255, in, b2prf_255_512);
 }
 
+/* cross-check all kernels supported by this CPU against the reference code, on random and unaligned inputs */
+static void kernels(void) {
+  const struct blake2cf_kernel *kernel, *ref;
+  uint64_t st[8], st_ref[8];
+  uint8_t block[BLAKE2CF_BLOCKSIZE + 8];
+  uint8_t block_ref[BLAKE2CF_BLOCKSIZE + 8];
+  uint8_t in[4 * BLAKE2CF_STATESIZE], out[4 * BLAKE2CF_STATESIZE], out_ref[4 * BLAKE2CF_STATESIZE];
+  uint64_t st_x[8][8], st_x_ref[8][8];
+  uint8_t block_x[8][BLAKE2CF_BLOCKSIZE + 8];
+  void *st_p[8];
+  const void *block_p[8];
+  unsigned long long t, t_x[8];
+  int final, final_x[8], decrypt;
+  size_t len, nblocks;
+  int i, j, l;
+
+  for (ref = blake2cf_kernels; ref->features != 0; ref++) {
+    ;
+  }
+
+  /* including ref itself, for the interleaved multi-buffer code of the portable kernel */
+  for (kernel = blake2cf_kernels; kernel <= ref; kernel++) {
+    if ((kernel->features & cpu_features()) != kernel->features) {
+      continue;
+    }
+    for (i = 0; i < 1000; i++) {
+      for (j = 0; j < 8; j++) {
+        st[j] = st_ref[j] = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ rand();
+      }
+      for (j = 0; j < (int)sizeof(block); j++) {
+        block[j] = rand() & 0xff;
+      }
+      t = ((unsigned long long)rand() << 32) ^ rand();
+      final = rand() & 1;
+      (*ref->update)(st_ref, block + (i & 7), t, final);
+      (*kernel->update)(st, block + (i & 7), t, final);
+      if (memcmp(st, st_ref, sizeof(st))) {
+        fprintf(stderr, "FATAL: kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      for (j = 0; j < (int)sizeof(in); j++) {
+        in[j] = rand() & 0xff;
+      }
+      len = (i & 1) ? BLAKE2CF_STATESIZE : (size_t)rand() % BLAKE2CF_STATESIZE;
+      (*ref->update_xor)(st_ref, block, t, final, out_ref, in, len);
+      (*kernel->update_xor)(st, block, t, final, out, in, len);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(out, out_ref, len)) {
+        fprintf(stderr, "FATAL: fused kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      (*ref->update_split)(st_ref, in, in + 64, block + (i & 7), t, out_ref, in + 128);
+      (*kernel->update_split)(st, in, in + 64, block + (i & 7), t, out, in + 128);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(out, out_ref, BLAKE2CF_STATESIZE)) {
+        fprintf(stderr, "FATAL: split kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      memcpy(block_ref, block, sizeof(block));
+      nblocks = 1 + (size_t)rand() % 4;
+      decrypt = i & 2;
+      (*ref->ets_bulk)(st_ref, block_ref + (i & 7), t, out_ref, in, nblocks, decrypt);
+      (*kernel->ets_bulk)(st, block + (i & 7), t, out, in, nblocks, decrypt);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(block, block_ref, sizeof(block)) || memcmp(out, out_ref, nblocks * BLAKE2CF_STATESIZE)) {
+        fprintf(stderr, "FATAL: bulk kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      /* lane l of the multi-buffer kernels has to agree with a single-lane call */
+      for (l = 0; l < 8; l++) {
+        for (j = 0; j < 8; j++) {
+          st_x[l][j] = st_x_ref[l][j] = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ rand();
+        }
+        for (j = 0; j < (int)sizeof(block_x[l]); j++) {
+          block_x[l][j] = rand() & 0xff;
+        }
+        st_p[l] = st_x[l];
+        block_p[l] = block_x[l] + ((i + l) & 7);
+        t_x[l] = ((unsigned long long)rand() << 32) ^ rand();
+        final_x[l] = rand() & 1;
+        (*ref->update)(st_x_ref[l], block_p[l], t_x[l], final_x[l]);
+      }
+      switch (i & 3) {
+      case 0:
+        (*kernel->update_x8)(st_p, block_p, t_x, final_x);
+        break;
+      case 1:
+        (*kernel->update_x4)(st_p, block_p, t_x, final_x);
+        (*kernel->update_x4)(st_p + 4, block_p + 4, t_x + 4, final_x + 4);
+        break;
+      default:
+        (*kernel->update_x3)(st_p, block_p, t_x, final_x);
+        (*kernel->update_x3)(st_p + 3, block_p + 3, t_x + 3, final_x + 3);
+        (*kernel->update_x2)(st_p + 6, block_p + 6, t_x + 6, final_x + 6);
+        break;
+      }
+      if (memcmp(st_x, st_x_ref, sizeof(st_x))) {
+        fprintf(stderr, "FATAL: multi-buffer kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+    }
+  }
+}
+
 int main(void) {
   unkeyed();
   keyed();
+  kernels();
 
   printf("All tests passed successfully.\n");
   exit(0);
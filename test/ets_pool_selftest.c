@@ -0,0 +1,236 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/ets.h"
+#include "../src/ets_pool.h"
+#include "../src/sha256ets.h"
+#include "../src/sha512ets.h"
+#include "../src/blake2ets.h"
+
+#define KEYLEN 16
+#define TAGLEN 16
+#define RECORDS 600
+#define LARGE_MAX ((size_t)3 << 20)
+
+static uint8_t key[KEYLEN], ad[4096];
+static uint8_t *m;
+
+/* a batch of mostly small records, some medium-sized and a few large ones; the last record is invalid */
+static size_t klen[RECORDS], adlen[RECORDS], len[RECORDS], taglen[RECORDS];
+static const void *k[RECORDS], *adp[RECORDS], *in[RECORDS];
+static void *out[RECORDS], *tag[RECORDS];
+static uint8_t *cbuf[RECORDS], *Mbuf[RECORDS], tbuf[RECORDS][TAGLEN];
+static int status[RECORDS];
+
+static void setup(void) {
+  int i;
+
+  for (i = 0; i < RECORDS; i++) {
+    klen[i] = KEYLEN;
+    k[i] = key;
+    adlen[i] = (size_t)rand() % ((i % 5) ? 100 : sizeof(ad));
+    adp[i] = ad;
+    len[i] = (i % 150 == 7) ? LARGE_MAX - (size_t)rand() % (LARGE_MAX / 2) : (size_t)rand() % ((i % 10) ? 200 : 65536);
+    taglen[i] = TAGLEN;
+    tag[i] = tbuf[i];
+    cbuf[i] = malloc(len[i] + 1);
+    Mbuf[i] = malloc(len[i] + 1);
+    if (cbuf[i] == NULL || Mbuf[i] == NULL) {
+      fprintf(stderr, "FATAL: out of memory\n");
+      exit(1);
+    }
+  }
+  taglen[RECORDS - 1] = 5; /* invalid */
+}
+
+/* encrypts, then decrypts (some tags tampered with) the batch through the pool; each record has to agree with ee */
+static void test_run(struct ets_pool *pool, ets_enc ee, ets_enc_batch eb, ets_dec_batch db) {
+  struct ets_batch b = { RECORDS, klen, k, adlen, adp, len, in, out, taglen, tag, status };
+  uint8_t tag_ref[TAGLEN], *c_ref;
+  int i, expected;
+
+  c_ref = malloc(LARGE_MAX);
+  if (c_ref == NULL) {
+    fprintf(stderr, "FATAL: out of memory\n");
+    exit(1);
+  }
+
+  for (i = 0; i < RECORDS; i++) {
+    in[i] = m;
+    out[i] = cbuf[i];
+    status[i] = 1;
+  }
+  if (ets_pool_run(pool, eb, &b) != -1) {
+    fprintf(stderr, "FATAL: pool did not report the invalid record\n");
+    exit(1);
+  }
+  for (i = 0; i < RECORDS - 1; i++) {
+    (*ee)(klen[i], k[i], adlen[i], adp[i], len[i], in[i], len[i], c_ref, taglen[i], tag_ref);
+    if (status[i] != ETS_BATCH_OK || memcmp(out[i], c_ref, len[i]) || memcmp(tag[i], tag_ref, taglen[i])) {
+      fprintf(stderr, "FATAL: pool record %d disagrees with single-record encryption\n", i);
+      exit(1);
+    }
+  }
+  if (status[RECORDS - 1] != ETS_BATCH_EPARAM) {
+    fprintf(stderr, "FATAL: wrong status of invalid pool record\n");
+    exit(1);
+  }
+
+  for (i = 0; i < RECORDS; i++) {
+    in[i] = cbuf[i];
+    out[i] = Mbuf[i];
+    status[i] = 1;
+    if (i % 4 == 1) {
+      tbuf[i][0] ^= 0xff;
+    }
+  }
+  if (ets_pool_run(pool, db, &b) != -1) {
+    fprintf(stderr, "FATAL: pool did not report the invalid records\n");
+    exit(1);
+  }
+  for (i = 0; i < RECORDS; i++) {
+    expected = (i == RECORDS - 1) ? ETS_BATCH_EPARAM : (i % 4 == 1) ? ETS_BATCH_INVALID : ETS_BATCH_OK;
+    if (status[i] != expected) {
+      fprintf(stderr, "FATAL: wrong status of pool record %d\n", i);
+      exit(1);
+    }
+    if (expected != ETS_BATCH_EPARAM && memcmp(out[i], m, len[i])) {
+      fprintf(stderr, "FATAL: wrong message recovered by pool record %d\n", i);
+      exit(1);
+    }
+  }
+
+  free(c_ref);
+}
+
+/* every record is counted exactly once per run; no worker is busy for longer than the runs took */
+static void test_stats(struct ets_pool *pool, int nthreads, int runs) {
+  struct ets_pool_stats stats;
+  unsigned long long int records = 0, tasks = 0;
+  int i;
+
+  for (i = 0; i < nthreads; i++) {
+    if (ets_pool_stats(pool, i, &stats) != 0) {
+      fprintf(stderr, "FATAL: no counters for worker %d\n", i);
+      exit(1);
+    }
+    if (stats.busy_ns > stats.run_ns || stats.steals > stats.tasks) {
+      fprintf(stderr, "FATAL: inconsistent counters of worker %d\n", i);
+      exit(1);
+    }
+    records += stats.records;
+    tasks += stats.tasks;
+  }
+  if (records != (unsigned long long int)runs * RECORDS || tasks < (unsigned long long int)runs * (RECORDS / 150)) {
+    fprintf(stderr, "FATAL: records or tasks not counted correctly\n");
+    exit(1);
+  }
+  if (ets_pool_stats(pool, nthreads, &stats) != -1 || ets_pool_stats(pool, -1, &stats) != -1) {
+    fprintf(stderr, "FATAL: counters for a nonexistent worker\n");
+    exit(1);
+  }
+}
+
+#define INFO_THREADS 4
+
+static void *backend_info(void *arg) {
+  (void)arg;
+  return (void *)ets_backend_info();
+}
+
+/* racing first calls of ets_backend_info all get the complete string */
+static void test_backend_info(void) {
+  pthread_t thread[INFO_THREADS];
+  void *info[INFO_THREADS];
+  int i;
+
+  for (i = 0; i < INFO_THREADS; i++) {
+    if (pthread_create(&thread[i], NULL, backend_info, NULL) != 0) {
+      fprintf(stderr, "FATAL: cannot start thread\n");
+      exit(1);
+    }
+  }
+  for (i = 0; i < INFO_THREADS; i++) {
+    pthread_join(thread[i], &info[i]);
+    if (strncmp(info[i], "blake2cf:", 9) || strstr(info[i], " memxor:") == NULL) {
+      fprintf(stderr, "FATAL: incomplete backend info \"%s\"\n", (const char *)info[i]);
+      exit(1);
+    }
+  }
+}
+
+int main(void) {
+  /* the widest pool first: the first calls into the library (kernel binding, stream threshold) happen in its workers */
+  static const int nthreads[] = { 8, 3, 1 };
+  struct ets_pool *pool;
+  struct ets_batch empty;
+  size_t i;
+  int j;
+
+  srand(time(NULL));
+  for (i = 0; i < KEYLEN; i++) {
+    key[i] = rand() & 0xff;
+  }
+  for (i = 0; i < sizeof(ad); i++) {
+    ad[i] = rand() & 0xff;
+  }
+  m = malloc(LARGE_MAX);
+  if (m == NULL) {
+    fprintf(stderr, "FATAL: out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < LARGE_MAX; i++) {
+    m[i] = rand() & 0xff;
+  }
+  setup();
+  test_backend_info();
+
+  if (ets_pool_create(0, 0) != NULL) {
+    fprintf(stderr, "FATAL: pool without workers\n");
+    exit(1);
+  }
+
+  for (j = 0; j < 3; j++) {
+    pool = ets_pool_create(nthreads[j], j == 1);
+    if (pool == NULL) {
+      fprintf(stderr, "FATAL: cannot create pool of %d workers\n", nthreads[j]);
+      exit(1);
+    }
+
+    test_run(pool, sha256ets_enc, sha256ets_enc_batch, sha256ets_dec_batch);
+    test_run(pool, sha512ets_enc, sha512ets_enc_batch, sha512ets_dec_batch);
+    test_run(pool, blake2ets_enc, blake2ets_enc_batch, blake2ets_dec_batch);
+
+    memset(&empty, 0, sizeof(empty));
+    if (ets_pool_run(pool, blake2ets_enc_batch, &empty) != 0) {
+      fprintf(stderr, "FATAL: empty batch failed\n");
+      exit(1);
+    }
+
+    test_stats(pool, nthreads[j], 6);
+    ets_pool_destroy(pool);
+  }
+
+  printf("All tests passed successfully.\n");
+  exit(0);
+}
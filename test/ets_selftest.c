@@ -33,7 +33,7 @@
 
 uint8_t *key, *ad, *m;
 
-static void test_adlen_mlen(ets_enc ee, ets_dec ed, int adlen, int mlen) {
+static void test_adlen_mlen(ets_enc ee, ets_dec ed, ets_verify ev, int adlen, int mlen) {
   uint8_t tag[TAGLEN];
   uint8_t *c, *M;
   int clen = mlen;
@@ -48,6 +48,12 @@ static void test_adlen_mlen(ets_enc ee, ets_dec ed, int adlen, int mlen) {
     exit(1);
   }
 
+  err = (*ev)(KEYLEN, key, adlen, ad, clen, c, TAGLEN, tag);
+  if (err) {
+    fprintf(stderr, "FATAL: verification failed\n");
+    exit(1);
+  }
+
   memset(M, 0, mlen);
   err = (*ed)(KEYLEN, key, adlen, ad, clen, c, TAGLEN, tag, mlen, M, 1, NULL);
   if (err) {
@@ -76,6 +82,12 @@ static void test_adlen_mlen(ets_enc ee, ets_dec ed, int adlen, int mlen) {
 
   tag[0] ^= 0xff;
 
+  err = (*ev)(KEYLEN, key, adlen, ad, clen, c, TAGLEN, tag);
+  if (! err) {
+    fprintf(stderr, "FATAL: verification did not fail\n");
+    exit(1);
+  }
+
   err = (*ed)(KEYLEN, key, adlen, ad, clen, c, TAGLEN, tag, mlen, M, 1, NULL);
   if (! err) {
     fprintf(stderr, "FATAL: decryption did not fail\n");
@@ -93,41 +105,667 @@ static void test_adlen_mlen(ets_enc ee, ets_dec ed, int adlen, int mlen) {
   }
 }
 
-static void test(ets_enc ee, ets_dec ed, int state_size, int block_size) {
+static void test(ets_enc ee, ets_dec ed, ets_verify ev, int state_size, int block_size) {
   int adlen, mlen;
 
   /* adlen zero */
   for (mlen = 0 * state_size; mlen < 3 * state_size; mlen++) {
-    test_adlen_mlen(ee, ed, 0, mlen);
+    test_adlen_mlen(ee, ed, ev, 0, mlen);
   }
 
   /* mlen zero */
   for (adlen = 0 * block_size; adlen < 3 * block_size; adlen++) {
-    test_adlen_mlen(ee, ed, adlen, 0);
+    test_adlen_mlen(ee, ed, ev, adlen, 0);
   }
 
   /* adlen small, mlen large */
   for (adlen = 0 * block_size; adlen < 3 * block_size; adlen++) {
     for (mlen = 10 * state_size; mlen < 13 * state_size; mlen++) {
-      test_adlen_mlen(ee, ed, adlen, mlen);
+      test_adlen_mlen(ee, ed, ev, adlen, mlen);
     }
   }
 
   /* adlen large, mlen small */
   for (adlen = 10 * block_size; adlen < 13 * block_size; adlen++) {
     for (mlen = 0 * state_size; mlen < 3 * state_size; mlen++) {
-      test_adlen_mlen(ee, ed, adlen, mlen);
+      test_adlen_mlen(ee, ed, ev, adlen, mlen);
     }
   }
 
   /* adlen and mlen roughly same */
   for (adlen = 0 * block_size; adlen < 7 * block_size; adlen++) {
     for (mlen = 0 * state_size; mlen < 7 * state_size; mlen++) {
-      test_adlen_mlen(ee, ed, adlen, mlen);
+      test_adlen_mlen(ee, ed, ev, adlen, mlen);
+    }
+  }
+}
+
+/* each lane of the multi-buffer variants has to agree with the single-record functions */
+static void test_mb(ets_enc ee, ets_enc_mb eem, ets_dec_mb edm, int lanes, int state_size, int block_size) {
+  size_t klen[16], adlen[16], mlen[16], taglen[16];
+  const void *k[16], *a[16], *mp[16], *cp[16], *tp[16];
+  void *c[16], *tag[16], *M[16];
+  uint8_t cbuf[16][16 * 64], tbuf[16][64], Mbuf[16][16 * 64];
+  uint8_t c_ref[16 * 64], tag_ref[64];
+  int is_valid[16];
+  int i, j, l, err;
+
+  for (i = 0; i < 2000; i++) {
+    for (j = 0; j < lanes; j++) {
+      klen[j] = KEYLEN;
+      k[j] = key;
+      /* mostly similar sizes, sometimes a lane far off */
+      adlen[j] = (size_t)rand() % ((i & 3) ? 2 * block_size : 12 * block_size);
+      mlen[j] = (size_t)rand() % ((i & 4) ? 4 * state_size : 16 * state_size);
+      taglen[j] = TAGLEN + (size_t)rand() % (state_size - TAGLEN + 1);
+      a[j] = ad + j;
+      mp[j] = m + 64 * j;
+      c[j] = cbuf[j], cp[j] = cbuf[j];
+      tag[j] = tbuf[j], tp[j] = tbuf[j];
+      M[j] = Mbuf[j];
+    }
+
+    err = (*eem)(klen, k, adlen, a, mlen, mp, mlen, c, taglen, tag);
+    if (err) {
+      fprintf(stderr, "FATAL: multi-buffer encryption failed\n");
+      exit(1);
+    }
+    for (j = 0; j < lanes; j++) {
+      (*ee)(klen[j], k[j], adlen[j], a[j], mlen[j], mp[j], mlen[j], c_ref, taglen[j], tag_ref);
+      if (memcmp(c[j], c_ref, mlen[j]) || memcmp(tag[j], tag_ref, taglen[j])) {
+        fprintf(stderr, "FATAL: multi-buffer encryption disagrees in lane %d\n", j);
+        exit(1);
+      }
+    }
+
+    err = (*edm)(klen, k, adlen, a, mlen, cp, taglen, tp, mlen, M, 1, NULL);
+    if (err) {
+      fprintf(stderr, "FATAL: multi-buffer decryption failed\n");
+      exit(1);
+    }
+    for (j = 0; j < lanes; j++) {
+      if (memcmp(M[j], mp[j], mlen[j])) {
+        fprintf(stderr, "FATAL: wrong message recovered in lane %d\n", j);
+        exit(1);
+      }
+    }
+
+    j = rand() % lanes;
+    tbuf[j][0] ^= 0xff;
+    if (! (*edm)(klen, k, adlen, a, mlen, cp, taglen, tp, mlen, M, 1, NULL)) {
+      fprintf(stderr, "FATAL: multi-buffer decryption did not fail\n");
+      exit(1);
+    }
+    err = (*edm)(klen, k, adlen, a, mlen, cp, taglen, tp, mlen, M, 0, is_valid);
+    if (err) {
+      fprintf(stderr, "FATAL: multi-buffer decryption failed\n");
+      exit(1);
+    }
+    for (l = 0; l < lanes; l++) {
+      if (is_valid[l] != (l != j)) {
+        fprintf(stderr, "FATAL: wrong validity indicator in lane %d\n", l);
+        exit(1);
+      }
+    }
+  }
+}
+
+/* the streaming mode for large messages has to give the same result as the regular bulk code */
+static void test_stream(ets_enc ee, ets_dec ed) {
+  static uint8_t c_ref[MLEN_MAX], c[MLEN_MAX], M[MLEN_MAX];
+  uint8_t tag_ref[TAGLEN], tag[TAGLEN];
+  size_t threshold = ets_stream_threshold();
+  int i, adlen, mlen, err;
+
+  for (i = 0; i < 50; i++) {
+    adlen = rand() % 1000;
+    mlen = rand() % MLEN_MAX;
+
+    ets_set_stream_threshold((size_t)-1);
+    (*ee)(KEYLEN, key, adlen, ad, mlen, m, mlen, c_ref, TAGLEN, tag_ref);
+
+    ets_set_stream_threshold(0);
+    (*ee)(KEYLEN, key, adlen, ad, mlen, m, mlen, c, TAGLEN, tag);
+    if (memcmp(c, c_ref, mlen) || memcmp(tag, tag_ref, TAGLEN)) {
+      fprintf(stderr, "FATAL: streaming encryption disagrees\n");
+      exit(1);
+    }
+    err = (*ed)(KEYLEN, key, adlen, ad, mlen, c, TAGLEN, tag, mlen, M, 1, NULL);
+    if (err || memcmp(M, m, mlen)) {
+      fprintf(stderr, "FATAL: streaming decryption failed\n");
+      exit(1);
+    }
+  }
+
+  ets_set_stream_threshold(threshold);
+}
+
+/* encryption and decryption in place (c == m) have to give the same result as with separate buffers */
+static void test_inplace_adlen_mlen(ets_enc ee, ets_dec ed, int adlen, int mlen) {
+  static uint8_t c_ref[MLEN_MAX], buf[MLEN_MAX];
+  uint8_t tag_ref[TAGLEN], tag[TAGLEN];
+  int err;
+
+  (*ee)(KEYLEN, key, adlen, ad, mlen, m, mlen, c_ref, TAGLEN, tag_ref);
+
+  memcpy(buf, m, mlen);
+  err = (*ee)(KEYLEN, key, adlen, ad, mlen, buf, mlen, buf, TAGLEN, tag);
+  if (err || memcmp(buf, c_ref, mlen) || memcmp(tag, tag_ref, TAGLEN)) {
+    fprintf(stderr, "FATAL: in-place encryption disagrees\n");
+    exit(1);
+  }
+
+  err = (*ed)(KEYLEN, key, adlen, ad, mlen, buf, TAGLEN, tag, mlen, buf, 1, NULL);
+  if (err || memcmp(buf, m, mlen)) {
+    fprintf(stderr, "FATAL: in-place decryption failed\n");
+    exit(1);
+  }
+}
+
+static void test_inplace(ets_enc ee, ets_dec ed, int state_size, int block_size) {
+  size_t threshold = ets_stream_threshold();
+  int i, adlen, mlen;
+
+  /* AD blocks before, with and after the message blocks, message blocks before and in the steady state */
+  for (adlen = 0 * block_size; adlen < 4 * block_size; adlen += 5) {
+    for (mlen = 0 * state_size; mlen < 8 * state_size; mlen += 3) {
+      test_inplace_adlen_mlen(ee, ed, adlen, mlen);
+    }
+  }
+
+  /* large messages, regular bulk code and streaming mode */
+  for (i = 0; i < 20; i++) {
+    ets_set_stream_threshold((i & 1) ? 0 : (size_t)-1);
+    test_inplace_adlen_mlen(ee, ed, rand() % 1000, rand() % MLEN_MAX);
+  }
+
+  ets_set_stream_threshold(threshold);
+}
+
+/* re-encryption has to agree with decryption followed by encryption under the new key, also in place */
+static void test_reencrypt(ets_enc ee, ets_reencrypt er) {
+  static uint8_t c[MLEN_MAX], c_ref[MLEN_MAX], c_new[MLEN_MAX];
+  uint8_t k_new[33], tag[TAGLEN], tag_ref[16], tag_new[16];
+  int i, adlen, mlen, err, res;
+
+  for (i = 0; i < 33; i++) {
+    k_new[i] = rand() & 0xff;
+  }
+
+  for (i = 0; i < 300; i++) {
+    adlen = (i < 200) ? rand() % 400 : rand() % 1000;
+    mlen = (i < 200) ? rand() % 600 : rand() % MLEN_MAX;
+
+    (*ee)(KEYLEN, key, adlen, ad, mlen, m, mlen, c, TAGLEN, tag);
+    (*ee)(32, k_new, adlen, ad, mlen, m, mlen, c_ref, 16, tag_ref);
+
+    err = (*er)(KEYLEN, key, 32, k_new, adlen, ad, mlen, c, TAGLEN, tag, c_new, 16, tag_new, 1, NULL);
+    if (err || memcmp(c_new, c_ref, mlen) || memcmp(tag_new, tag_ref, 16)) {
+      fprintf(stderr, "FATAL: re-encryption disagrees\n");
+      exit(1);
+    }
+
+    err = (*er)(KEYLEN, key, 32, k_new, adlen, ad, mlen, c, TAGLEN, tag, c, 16, tag_new, 0, &res);
+    if (err || ! res || memcmp(c, c_ref, mlen) || memcmp(tag_new, tag_ref, 16)) {
+      fprintf(stderr, "FATAL: in-place re-encryption disagrees\n");
+      exit(1);
+    }
+
+    tag_ref[0] ^= 0xff;
+    err = (*er)(32, k_new, KEYLEN, key, adlen, ad, mlen, c, 16, tag_ref, c_new, TAGLEN, tag, 1, NULL);
+    if (! err) {
+      fprintf(stderr, "FATAL: re-encryption did not fail\n");
+      exit(1);
+    }
+    memset(c_new, 0xff, mlen);
+    memset(tag, 0xff, TAGLEN);
+    err = (*er)(32, k_new, KEYLEN, key, adlen, ad, mlen, c, 16, tag_ref, c_new, TAGLEN, tag, 0, &res);
+    if (err || res) {
+      fprintf(stderr, "FATAL: re-encryption did not fail\n");
+      exit(1);
+    }
+    /* nothing that authenticates is left behind */
+    memset(c_ref, 0, (mlen > TAGLEN) ? mlen : TAGLEN);
+    if (memcmp(c_new, c_ref, mlen) || memcmp(tag, c_ref, TAGLEN)) {
+      fprintf(stderr, "FATAL: failed re-encryption left output behind\n");
+      exit(1);
+    }
+
+    /* in place under a wrong k_old, the record survives (with its tag in place, too) */
+    memcpy(c_new, c, mlen);
+    memcpy(tag_ref, tag_new, 16);
+    err = (*er)(KEYLEN, key, KEYLEN, k_new, adlen, ad, mlen, c, 16, tag_new, c, 16, tag_new, 0, &res);
+    if (err || res || memcmp(c, c_new, mlen) || memcmp(tag_new, tag_ref, 16)) {
+      fprintf(stderr, "FATAL: failed in-place re-encryption destroyed the record\n");
+      exit(1);
+    }
+
+    /* in place with tag_new == tag_in */
+    err = (*er)(32, k_new, 32, k_new + 1, adlen, ad, mlen, c, 16, tag_new, c, 16, tag_new, 1, NULL);
+    (*ee)(32, k_new + 1, adlen, ad, mlen, m, mlen, c_ref, 16, tag_ref);
+    if (err || memcmp(c, c_ref, mlen) || memcmp(tag_new, tag_ref, 16)) {
+      fprintf(stderr, "FATAL: in-place re-encryption of the tag disagrees\n");
+      exit(1);
+    }
+  }
+}
+
+/* the incremental interface of a mode, with its snapshots */
+struct ctx_ops {
+  ets_enc enc;
+  ets_enc_init enc_init;
+  ets_dec_init dec_init;
+  ets_update_ad update_ad;
+  ets_update_msg update_msg;
+  ets_enc_final enc_final;
+  ets_dec_final dec_final;
+  ets_ctx_free ctx_free;
+  ets_snapshot_size snapshot_size;
+  ets_snapshot snapshot;
+  ets_resume resume;
+  int state_size;
+};
+
+static const struct ctx_ops sha256ets_ops = {
+  sha256ets_enc, sha256ets_enc_init, sha256ets_dec_init, sha256ets_update_ad, sha256ets_update_msg, sha256ets_enc_final,
+  sha256ets_dec_final, sha256ets_ctx_free, sha256ets_snapshot_size, sha256ets_snapshot, sha256ets_resume, 32 /* SHA256CF_STATESIZE */
+};
+
+static const struct ctx_ops sha512ets_ops = {
+  sha512ets_enc, sha512ets_enc_init, sha512ets_dec_init, sha512ets_update_ad, sha512ets_update_msg, sha512ets_enc_final,
+  sha512ets_dec_final, sha512ets_ctx_free, sha512ets_snapshot_size, sha512ets_snapshot, sha512ets_resume, 64 /* SHA512CF_STATESIZE */
+};
+
+static const struct ctx_ops blake2ets_ops = {
+  blake2ets_enc, blake2ets_enc_init, blake2ets_dec_init, blake2ets_update_ad, blake2ets_update_msg, blake2ets_enc_final,
+  blake2ets_dec_final, blake2ets_ctx_free, blake2ets_snapshot_size, blake2ets_snapshot, blake2ets_resume, 64 /* BLAKE2CF_STATESIZE */
+};
+
+static struct ets_ctx *check_ctx(struct ets_ctx *ctx) {
+  if (ctx == NULL) {
+    fprintf(stderr, "FATAL: no context\n");
+    exit(1);
+  }
+  return ctx;
+}
+
+/* the incremental interface has to agree with the one-shot functions for any chunking of AD and message */
+static void test_ctx(const struct ctx_ops *ops) {
+  static uint8_t c_ref[MLEN_MAX], c[MLEN_MAX], M[MLEN_MAX];
+  uint8_t tag_ref[TAGLEN], tag[TAGLEN];
+  struct ets_ctx *ctx;
+  int i, adlen, mlen, pos, n, err, res;
+
+  for (i = 0; i < 400; i++) {
+    adlen = (i < 300) ? rand() % 600 : rand() % 3000;
+    mlen = (i < 300) ? rand() % 600 : rand() % MLEN_MAX;
+    (*ops->enc)(KEYLEN, key, adlen, ad, mlen, m, mlen, c_ref, TAGLEN, tag_ref);
+
+    ctx = check_ctx((*ops->enc_init)(KEYLEN, key, TAGLEN));
+    for (pos = 0; pos < adlen; pos += n) {
+      n = rand() % ((i & 1) ? 7 : 300);
+      n = (n < adlen - pos) ? n : adlen - pos;
+      (*ops->update_ad)(ctx, ad + pos, n);
+    }
+    for (pos = 0; pos < mlen; pos += n) {
+      n = rand() % ((i & 2) ? 9 : 5000);
+      n = (n < mlen - pos) ? n : mlen - pos;
+      (*ops->update_msg)(ctx, m + pos, c + pos, n);
+    }
+    (*ops->enc_final)(ctx, tag);
+    if (memcmp(c, c_ref, mlen) || memcmp(tag, tag_ref, TAGLEN)) {
+      fprintf(stderr, "FATAL: incremental encryption disagrees\n");
+      exit(1);
+    }
+
+    ctx = check_ctx((*ops->dec_init)(KEYLEN, key, TAGLEN));
+    (*ops->update_ad)(ctx, ad, adlen);
+    memcpy(M, c, mlen);
+    for (pos = 0; pos < mlen; pos += n) {
+      n = rand() % ((i & 2) ? 9 : 5000);
+      n = (n < mlen - pos) ? n : mlen - pos;
+      (*ops->update_msg)(ctx, M + pos, M + pos, n);
+    }
+    err = (*ops->dec_final)(ctx, tag, 0, &res);
+    if (err || ! res || memcmp(M, m, mlen)) {
+      fprintf(stderr, "FATAL: incremental decryption failed\n");
+      exit(1);
     }
+
+    tag[0] ^= 0xff;
+    ctx = check_ctx((*ops->dec_init)(KEYLEN, key, TAGLEN));
+    (*ops->update_ad)(ctx, ad, adlen);
+    (*ops->update_msg)(ctx, c, M, mlen);
+    if (! (*ops->dec_final)(ctx, tag, 1, NULL)) {
+      fprintf(stderr, "FATAL: incremental decryption did not fail\n");
+      exit(1);
+    }
+  }
+}
+
+/* interrupting an incremental encryption by a snapshot and resuming from it must not change the result */
+static void test_snapshot(const struct ctx_ops *ops) {
+  static uint8_t c_ref[MLEN_MAX], c[MLEN_MAX], snap[ADLEN_MAX + 1024];
+  uint8_t tag_ref[TAGLEN], tag[TAGLEN];
+  struct ets_ctx *ctx;
+  int i, adlen, mlen, pos, n, err;
+  size_t len;
+
+  for (i = 0; i < 200; i++) {
+    adlen = rand() % 2000;
+    mlen = rand() % 20000;
+    (*ops->enc)(KEYLEN, key, adlen, ad, mlen, m, mlen, c_ref, TAGLEN, tag_ref);
+
+    /* snapshots after the AD, and at block boundaries of the message */
+    ctx = check_ctx((*ops->enc_init)(KEYLEN, key, TAGLEN));
+    (*ops->update_ad)(ctx, ad, adlen);
+    for (pos = 0; pos < mlen; pos += n) {
+      n = ops->state_size * (rand() % 40 + 1);
+      n = (n < mlen - pos) ? n : mlen - pos;
+      len = (*ops->snapshot_size)(ctx);
+      if ((*ops->snapshot)(ctx, snap)) {
+        fprintf(stderr, "FATAL: snapshot failed\n");
+        exit(1);
+      }
+      (*ops->ctx_free)(ctx);
+      ctx = (*ops->resume)(snap, len, KEYLEN, key);
+      if (ctx == NULL) {
+        fprintf(stderr, "FATAL: resume failed\n");
+        exit(1);
+      }
+      (*ops->update_msg)(ctx, m + pos, c + pos, n);
+    }
+    len = (*ops->snapshot_size)(ctx);
+    err = (*ops->snapshot)(ctx, snap);
+    if ((mlen % ops->state_size == 0) != (err == 0)) {
+      fprintf(stderr, "FATAL: snapshot off a block boundary\n");
+      exit(1);
+    }
+    if (! err && ((*ops->resume)(snap, len, KEYLEN + 8, key) != NULL || (*ops->resume)(snap, len - 1, KEYLEN, key) != NULL)) {
+      fprintf(stderr, "FATAL: bad snapshot accepted\n");
+      exit(1);
+    }
+    (*ops->enc_final)(ctx, tag);
+    if (memcmp(c, c_ref, mlen) || memcmp(tag, tag_ref, TAGLEN)) {
+      fprintf(stderr, "FATAL: resumed encryption disagrees\n");
+      exit(1);
+    }
+  }
+}
+
+/* split buf[0..len-1] into up to IOV_MAX_FRAGS random fragments (also empty ones), returns their number */
+#define IOV_MAX_FRAGS 8
+
+static int split_iov(struct iovec *v, uint8_t *buf, int len) {
+  int cnt = rand() % IOV_MAX_FRAGS + 1, i, n;
+
+  for (i = 0; i < cnt - 1; i++) {
+    n = (rand() % 4 == 0) ? 0 : rand() % (len + 1);
+    v[i].iov_base = buf, v[i].iov_len = n;
+    buf += n, len -= n;
+  }
+  v[i].iov_base = buf, v[i].iov_len = len;
+
+  return cnt;
+}
+
+/* the scatter-gather variants have to agree with the contiguous functions for any split into fragments */
+static void test_iov(ets_enc ee, ets_encv eev, ets_decv edv) {
+  static uint8_t c_ref[MLEN_MAX], c[MLEN_MAX], M[MLEN_MAX];
+  uint8_t tag_ref[TAGLEN], tag[TAGLEN];
+  struct iovec adv[IOV_MAX_FRAGS], mv[IOV_MAX_FRAGS], cv[IOV_MAX_FRAGS];
+  int i, adlen, mlen, adcnt, mcnt, ccnt, err, res;
+
+  for (i = 0; i < 500; i++) {
+    adlen = (i < 400) ? rand() % 600 : rand() % 3000;
+    mlen = (i < 400) ? rand() % 600 : rand() % MLEN_MAX;
+    (*ee)(KEYLEN, key, adlen, ad, mlen, m, mlen, c_ref, TAGLEN, tag_ref);
+
+    adcnt = split_iov(adv, ad, adlen);
+    mcnt = split_iov(mv, m, mlen);
+    ccnt = split_iov(cv, c, mlen);
+    err = (*eev)(KEYLEN, key, adv, adcnt, mv, mcnt, cv, ccnt, TAGLEN, tag);
+    if (err || memcmp(c, c_ref, mlen) || memcmp(tag, tag_ref, TAGLEN)) {
+      fprintf(stderr, "FATAL: scatter-gather encryption disagrees\n");
+      exit(1);
+    }
+
+    memcpy(M, c, mlen);
+    mcnt = split_iov(mv, M, mlen);
+    err = (*edv)(KEYLEN, key, adv, adcnt, mv, mcnt, TAGLEN, tag, mv, mcnt, 0, &res);
+    if (err || ! res || memcmp(M, m, mlen)) {
+      fprintf(stderr, "FATAL: scatter-gather decryption failed\n");
+      exit(1);
+    }
+
+    tag[0] ^= 0xff;
+    err = (*edv)(KEYLEN, key, adv, adcnt, cv, ccnt, TAGLEN, tag, mv, mcnt, 1, NULL);
+    if (! err) {
+      fprintf(stderr, "FATAL: scatter-gather decryption did not fail\n");
+      exit(1);
+    }
+  }
+
+  /* negative fragment counts are rejected before any fragment is touched */
+  if ((*eev)(KEYLEN, key, NULL, -1, mv, 1, cv, 1, TAGLEN, tag) != -1
+      || (*eev)(KEYLEN, key, adv, 1, NULL, -1, NULL, -1, TAGLEN, tag) != -1
+      || (*edv)(KEYLEN, key, adv, 1, NULL, -1, TAGLEN, tag, mv, 1, 0, &res) != -1
+      || (*edv)(KEYLEN, key, adv, 1, cv, 1, TAGLEN, tag, NULL, -2, 0, &res) != -1) {
+    fprintf(stderr, "FATAL: scatter-gather accepted a negative fragment count\n");
+    exit(1);
+  }
+}
+
+/*
+  Mixed workloads for the multi-buffer manager and the batch functions: record i has its AD at ad + i and its message
+  at m + i, with lengths drawn by mixed_record (mostly small records, now and then a large one).
+*/
+static void mixed_record(int i, int state_size, size_t *adlen, size_t *len, size_t *taglen) {
+  *adlen = (size_t)rand() % ((i % 5) ? 300 : 3000);
+  *len = (size_t)rand() % ((i % 7) ? 400 : MLEN_MAX / 4);
+  *taglen = TAGLEN + (size_t)rand() % (state_size - TAGLEN + 1);
+}
+
+/* the encryption (out, tag) of record i has to agree with ee */
+static void check_mixed_record(ets_enc ee, const char *what, int i, size_t adlen, size_t len, const void *out, size_t taglen, const void *tag) {
+  uint8_t c_ref[MLEN_MAX], tag_ref[64];
+
+  (*ee)(KEYLEN, key, adlen, ad + i, len, m + i, len, c_ref, taglen, tag_ref);
+  if (memcmp(out, c_ref, len) || memcmp(tag, tag_ref, taglen)) {
+    fprintf(stderr, "FATAL: %s %d disagrees with single-record encryption\n", what, i);
+    exit(1);
   }
 }
 
+#define MB_JOBS 200
+
+/* submits enc jobs, then dec jobs (some with tampered tags) to the multi-buffer manager; each has to come back exactly once */
+static void test_mb_mgr(int lanes) {
+  struct blake2ets_mb_mgr *mgr;
+  struct ets_mb_job job[MB_JOBS], *done;
+  uint8_t *cbuf, *Mbuf, tbuf[MB_JOBS][64];
+  int returned[MB_JOBS];
+  int i, pass;
+  size_t off;
+
+  mgr = blake2ets_mb_create(lanes);
+  cbuf = malloc(MB_JOBS * (size_t)MLEN_MAX / 4);
+  Mbuf = malloc(MB_JOBS * (size_t)MLEN_MAX / 4);
+  if (mgr == NULL || cbuf == NULL || Mbuf == NULL) {
+    fprintf(stderr, "FATAL: out of memory\n");
+    exit(1);
+  }
+
+  for (pass = 0; pass < 2; pass++) {
+    for (i = 0; i < MB_JOBS; i++) {
+      off = (size_t)i * (MLEN_MAX / 4);
+      if (pass == 0) {
+        job[i].decrypt = 0;
+        job[i].klen = KEYLEN;
+        job[i].k = key;
+        mixed_record(i, 64 /* BLAKE2CF_STATESIZE */, &job[i].adlen, &job[i].len, &job[i].taglen);
+        job[i].ad = ad + i;
+        job[i].in = m + i;
+        job[i].out = cbuf + off;
+        job[i].tag = tbuf[i];
+      }
+      else {
+        job[i].decrypt = 1;
+        job[i].in = cbuf + off;
+        job[i].out = Mbuf + off;
+        if (i % 3 == 0) {
+          tbuf[i][0] ^= 0xff;
+        }
+      }
+      job[i].user_data = &returned[i];
+      returned[i] = 0;
+    }
+    job[MB_JOBS - 1].taglen = 5; /* invalid */
+
+    for (i = 0; i < MB_JOBS; i++) {
+      done = blake2ets_mb_submit(mgr, &job[i]);
+      if (done != NULL) {
+        (*(int *)done->user_data)++;
+      }
+    }
+    while ((done = blake2ets_mb_flush(mgr)) != NULL) {
+      (*(int *)done->user_data)++;
+    }
+
+    for (i = 0; i < MB_JOBS; i++) {
+      if (returned[i] != 1) {
+        fprintf(stderr, "FATAL: multi-buffer job %d returned %d times\n", i, returned[i]);
+        exit(1);
+      }
+      if (i == MB_JOBS - 1) {
+        if (job[i].status != -1) {
+          fprintf(stderr, "FATAL: invalid multi-buffer job did not fail\n");
+          exit(1);
+        }
+        continue;
+      }
+      if (pass == 0) {
+        if (job[i].status != 0) {
+          fprintf(stderr, "FATAL: multi-buffer job %d failed\n", i);
+          exit(1);
+        }
+        check_mixed_record(blake2ets_enc, "multi-buffer job", i, job[i].adlen, job[i].len, job[i].out, job[i].taglen, job[i].tag);
+      }
+      else {
+        if (job[i].status != ((i % 3 == 0) ? -1 : 0)) {
+          fprintf(stderr, "FATAL: wrong status of multi-buffer job %d\n", i);
+          exit(1);
+        }
+        if (memcmp(job[i].out, m + i, job[i].len)) {
+          fprintf(stderr, "FATAL: wrong message recovered by multi-buffer job %d\n", i);
+          exit(1);
+        }
+      }
+    }
+  }
+
+  /* nothing left */
+  if (blake2ets_mb_flush(mgr) != NULL) {
+    fprintf(stderr, "FATAL: multi-buffer manager not empty\n");
+    exit(1);
+  }
+
+  free(cbuf);
+  free(Mbuf);
+  blake2ets_mb_destroy(mgr);
+}
+
+#define BATCH_RECORDS 200
+
+/* encrypts, then decrypts (some tags tampered with) a batch of mixed lengths; each record has to agree with ee */
+static void test_batch(ets_enc ee, ets_enc_batch eb, ets_dec_batch db, int state_size) {
+  struct ets_batch b;
+  size_t klen[BATCH_RECORDS], adlen[BATCH_RECORDS], len[BATCH_RECORDS], taglen[BATCH_RECORDS];
+  const void *k[BATCH_RECORDS], *adp[BATCH_RECORDS], *in[BATCH_RECORDS];
+  void *out[BATCH_RECORDS], *tag[BATCH_RECORDS];
+  int status[BATCH_RECORDS];
+  uint8_t *cbuf, *Mbuf, tbuf[BATCH_RECORDS][64];
+  size_t threshold;
+  int i, pass, expected;
+
+  cbuf = malloc(BATCH_RECORDS * (size_t)MLEN_MAX / 4);
+  Mbuf = malloc(BATCH_RECORDS * (size_t)MLEN_MAX / 4);
+  if (cbuf == NULL || Mbuf == NULL) {
+    fprintf(stderr, "FATAL: out of memory\n");
+    exit(1);
+  }
+
+  b.n = BATCH_RECORDS;
+  b.klen = klen, b.k = k;
+  b.adlen = adlen, b.ad = adp;
+  b.len = len, b.in = in, b.out = out;
+  b.taglen = taglen, b.tag = tag;
+  b.status = status;
+
+  for (i = 0; i < BATCH_RECORDS; i++) {
+    klen[i] = KEYLEN;
+    k[i] = key;
+    mixed_record(i, state_size, &adlen[i], &len[i], &taglen[i]);
+    adp[i] = ad + i;
+    tag[i] = tbuf[i];
+  }
+  taglen[BATCH_RECORDS - 1] = 5; /* invalid */
+
+  /* the second time round, the large records take the single-record path */
+  threshold = ets_stream_threshold();
+  for (pass = 0; pass < 2; pass++) {
+    ets_set_stream_threshold(pass ? 4096 : threshold);
+
+    for (i = 0; i < BATCH_RECORDS; i++) {
+      in[i] = m + i;
+      out[i] = cbuf + (size_t)i * (MLEN_MAX / 4);
+      status[i] = ETS_BATCH_EPARAM; /* left over from elsewhere, must not matter */
+    }
+    if ((*eb)(&b) != -1) {
+      fprintf(stderr, "FATAL: batch encryption did not report the invalid record\n");
+      exit(1);
+    }
+    for (i = 0; i < BATCH_RECORDS - 1; i++) {
+      if (status[i] != ETS_BATCH_OK) {
+        fprintf(stderr, "FATAL: batch record %d failed\n", i);
+        exit(1);
+      }
+      check_mixed_record(ee, "batch record", i, adlen[i], len[i], out[i], taglen[i], tag[i]);
+    }
+    if (status[BATCH_RECORDS - 1] != ETS_BATCH_EPARAM) {
+      fprintf(stderr, "FATAL: wrong status of invalid batch record\n");
+      exit(1);
+    }
+
+    for (i = 0; i < BATCH_RECORDS; i++) {
+      in[i] = cbuf + (size_t)i * (MLEN_MAX / 4);
+      out[i] = Mbuf + (size_t)i * (MLEN_MAX / 4);
+      if (i % 3 == 0) {
+        tbuf[i][0] ^= 0xff;
+      }
+    }
+    if ((*db)(&b) != -1) {
+      fprintf(stderr, "FATAL: batch decryption did not report the invalid records\n");
+      exit(1);
+    }
+    for (i = 0; i < BATCH_RECORDS; i++) {
+      expected = (i == BATCH_RECORDS - 1) ? ETS_BATCH_EPARAM : (i % 3 == 0) ? ETS_BATCH_INVALID : ETS_BATCH_OK;
+      if (status[i] != expected) {
+        fprintf(stderr, "FATAL: wrong status of batch record %d\n", i);
+        exit(1);
+      }
+      if (expected != ETS_BATCH_EPARAM && memcmp(out[i], m + i, len[i])) {
+        fprintf(stderr, "FATAL: wrong message recovered by batch record %d\n", i);
+        exit(1);
+      }
+    }
+  }
+  ets_set_stream_threshold(threshold);
+
+  free(cbuf);
+  free(Mbuf);
+}
+
 static void kat(ets_enc ee, unsigned int csum) {
   uint8_t key[16], ad[5], m[13], c[13], tag[11];
   unsigned int acc;
@@ -175,9 +813,50 @@ int main(void) {
     m[i] = rand() & 0xff;
   }
 
-  test(sha256ets_enc, sha256ets_dec, 32 /* SHA256CF_STATESIZE */,  64 /* SHA256CF_BLOCKSIZE */);
-  test(sha512ets_enc, sha512ets_dec, 64 /* SHA512CF_STATESIZE */, 128 /* SHA512CF_BLOCKSIZE */);
-  test(blake2ets_enc, blake2ets_dec, 64 /* BLAKE2CF_STATESIZE */, 128 /* BLAKE2CF_BLOCKSIZE */);
+  printf("Kernels: %s\n", ets_backend_info());
+
+  test(sha256ets_enc, sha256ets_dec, sha256ets_verify, 32 /* SHA256CF_STATESIZE */,  64 /* SHA256CF_BLOCKSIZE */);
+  test(sha512ets_enc, sha512ets_dec, sha512ets_verify, 64 /* SHA512CF_STATESIZE */, 128 /* SHA512CF_BLOCKSIZE */);
+  test(blake2ets_enc, blake2ets_dec, blake2ets_verify, 64 /* BLAKE2CF_STATESIZE */, 128 /* BLAKE2CF_BLOCKSIZE */);
+
+  test_stream(sha256ets_enc, sha256ets_dec);
+  test_stream(sha512ets_enc, sha512ets_dec);
+  test_stream(blake2ets_enc, blake2ets_dec);
+
+  test_inplace(sha256ets_enc, sha256ets_dec, 32 /* SHA256CF_STATESIZE */,  64 /* SHA256CF_BLOCKSIZE */);
+  test_inplace(sha512ets_enc, sha512ets_dec, 64 /* SHA512CF_STATESIZE */, 128 /* SHA512CF_BLOCKSIZE */);
+  test_inplace(blake2ets_enc, blake2ets_dec, 64 /* BLAKE2CF_STATESIZE */, 128 /* BLAKE2CF_BLOCKSIZE */);
+
+  test_reencrypt(sha256ets_enc, sha256ets_reencrypt);
+  test_reencrypt(sha512ets_enc, sha512ets_reencrypt);
+  test_reencrypt(blake2ets_enc, blake2ets_reencrypt);
+
+  test_ctx(&sha256ets_ops);
+  test_ctx(&sha512ets_ops);
+  test_ctx(&blake2ets_ops);
+
+  test_snapshot(&sha256ets_ops);
+  test_snapshot(&sha512ets_ops);
+  test_snapshot(&blake2ets_ops);
+
+  test_iov(sha256ets_enc, sha256ets_encv, sha256ets_decv);
+  test_iov(sha512ets_enc, sha512ets_encv, sha512ets_decv);
+  test_iov(blake2ets_enc, blake2ets_encv, blake2ets_decv);
+
+  test_mb(sha256ets_enc, sha256ets_enc_x8, sha256ets_dec_x8, 8, 32 /* SHA256CF_STATESIZE */,  64 /* SHA256CF_BLOCKSIZE */);
+  test_mb(sha256ets_enc, sha256ets_enc_x16, sha256ets_dec_x16, 16, 32 /* SHA256CF_STATESIZE */,  64 /* SHA256CF_BLOCKSIZE */);
+  test_mb(sha512ets_enc, sha512ets_enc_x4, sha512ets_dec_x4, 4, 64 /* SHA512CF_STATESIZE */, 128 /* SHA512CF_BLOCKSIZE */);
+  test_mb(sha512ets_enc, sha512ets_enc_x8, sha512ets_dec_x8, 8, 64 /* SHA512CF_STATESIZE */, 128 /* SHA512CF_BLOCKSIZE */);
+  test_mb(blake2ets_enc, blake2ets_enc_x2, blake2ets_dec_x2, 2, 64 /* BLAKE2CF_STATESIZE */, 128 /* BLAKE2CF_BLOCKSIZE */);
+  test_mb(blake2ets_enc, blake2ets_enc_x3, blake2ets_dec_x3, 3, 64 /* BLAKE2CF_STATESIZE */, 128 /* BLAKE2CF_BLOCKSIZE */);
+  test_mb(blake2ets_enc, blake2ets_enc_x4, blake2ets_dec_x4, 4, 64 /* BLAKE2CF_STATESIZE */, 128 /* BLAKE2CF_BLOCKSIZE */);
+  test_mb(blake2ets_enc, blake2ets_enc_x8, blake2ets_dec_x8, 8, 64 /* BLAKE2CF_STATESIZE */, 128 /* BLAKE2CF_BLOCKSIZE */);
+  test_mb_mgr(4);
+  test_mb_mgr(8);
+
+  test_batch(sha256ets_enc, sha256ets_enc_batch, sha256ets_dec_batch, 32 /* SHA256CF_STATESIZE */);
+  test_batch(sha512ets_enc, sha512ets_enc_batch, sha512ets_dec_batch, 64 /* SHA512CF_STATESIZE */);
+  test_batch(blake2ets_enc, blake2ets_enc_batch, blake2ets_dec_batch, 64 /* BLAKE2CF_STATESIZE */);
 
   kat(sha256ets_enc, 3184);
   kat(sha512ets_enc, 3388);
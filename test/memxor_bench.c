@@ -0,0 +1,83 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Microbenchmark for the memxor kernels: throughput of dst = srcA XOR srcB for a range of lengths,
+  once with all pointers 64-byte aligned and once with each pointer at a different odd offset.
+*/
+
+#define _POSIX_C_SOURCE 199309L /* activates  clock_gettime  from time.h */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/memxor.h"
+#include "../src/cpu.h"
+
+#define MAXLEN 65536
+#define TOTAL (64UL << 20) /* bytes per measurement */
+
+static uint8_t bufA[MAXLEN + 64] __attribute__((aligned(64)));
+static uint8_t bufB[MAXLEN + 64] __attribute__((aligned(64)));
+static uint8_t bufD[MAXLEN + 64] __attribute__((aligned(64)));
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double measure(memxor3_fn xor3, size_t num, int od, int oa, int ob) {
+  uint8_t *dst = bufD + od, *srcA = bufA + oa, *srcB = bufB + ob;
+  unsigned long reps = TOTAL / num, r;
+  double t;
+
+  t = now();
+  for (r = 0; r < reps; r++) {
+    (*xor3)(dst, srcA, srcB, num);
+    __asm__ __volatile__ ("" : : "r" (dst) : "memory"); /* keep the calls */
+  }
+  t = now() - t;
+
+  return (double)reps * num / t / 1e9;
+}
+
+int main(void) {
+  static const size_t lens[] = { 16, 32, 64, 100, 256, 1500, 4096, MAXLEN };
+  const struct memxor_kernel *kernel;
+  size_t i;
+
+  memset(bufA, 0x11, sizeof(bufA));
+  memset(bufB, 0x22, sizeof(bufB));
+
+  printf("%-8s %8s %14s %14s\n", "kernel", "bytes", "aligned GB/s", "misaligned GB/s");
+  for (kernel = memxor_kernels; ; kernel++) {
+    if ((kernel->features & cpu_features()) == kernel->features) {
+      for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        printf("%-8s %8lu %14.2f %14.2f\n", kernel->name, (unsigned long)lens[i],
+               measure(kernel->xor3, lens[i], 0, 0, 0),
+               measure(kernel->xor3, lens[i], 1, 3, 5));
+      }
+    }
+    if (kernel->features == 0) {
+      break;
+    }
+  }
+
+  exit(0);
+}
@@ -0,0 +1,99 @@
+/*
+  Copyright 2020 IBM Corp.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/memxor.h"
+#include "../src/cpu.h"
+
+#define MAXLEN 300
+#define GUARD 0x5a
+
+/* every kernel supported by this CPU, at all relative alignments and all short lengths, against a byte loop resp. the source */
+static void kernels(void) {
+  const struct memxor_kernel *kernel;
+  uint8_t a[MAXLEN + 16], b[MAXLEN + 16], dst[MAXLEN + 32], res[MAXLEN];
+  size_t num, i;
+  int oa, ob, od;
+
+  for (i = 0; i < sizeof(a); i++) {
+    a[i] = rand() & 0xff;
+    b[i] = rand() & 0xff;
+  }
+
+  for (kernel = memxor_kernels; ; kernel++) {
+    if ((kernel->features & cpu_features()) != kernel->features) {
+      continue;
+    }
+    for (oa = 0; oa < 8; oa++) {
+      for (ob = 0; ob < 8; ob++) {
+        for (od = 0; od < 8; od++) {
+          for (num = 0; num <= MAXLEN; num++) {
+            for (i = 0; i < num; i++) {
+              res[i] = a[oa + i] ^ b[ob + i];
+            }
+            memset(dst, GUARD, sizeof(dst));
+            (*kernel->xor3)(dst + 8 + od, a + oa, b + ob, num);
+            if (memcmp(dst + 8 + od, res, num)) {
+              fprintf(stderr, "FATAL: memxor kernel %s computes wrong result\n", kernel->name);
+              exit(1);
+            }
+            for (i = 0; i < sizeof(dst); i++) {
+              if ((i < 8 + (size_t)od || i >= 8 + od + num) && dst[i] != GUARD) {
+                fprintf(stderr, "FATAL: memxor kernel %s writes out of bounds\n", kernel->name);
+                exit(1);
+              }
+            }
+
+            memset(dst, GUARD, sizeof(dst));
+            (*kernel->copy_stream)(dst + 8 + od, a + oa, num);
+            if (memcmp(dst + 8 + od, a + oa, num)) {
+              fprintf(stderr, "FATAL: streaming copy %s computes wrong result\n", kernel->name);
+              exit(1);
+            }
+            for (i = 0; i < sizeof(dst); i++) {
+              if ((i < 8 + (size_t)od || i >= 8 + od + num) && dst[i] != GUARD) {
+                fprintf(stderr, "FATAL: streaming copy %s writes out of bounds\n", kernel->name);
+                exit(1);
+              }
+            }
+
+            /* dst == srcA, as used by memxor2 */
+            memcpy(dst + od, a + oa, num);
+            (*kernel->xor3)(dst + od, dst + od, b + ob, num);
+            if (memcmp(dst + od, res, num)) {
+              fprintf(stderr, "FATAL: memxor kernel %s computes wrong in-place result\n", kernel->name);
+              exit(1);
+            }
+          }
+        }
+      }
+    }
+    if (kernel->features == 0) {
+      break;
+    }
+  }
+}
+
+int main(void) {
+  kernels();
+
+  printf("All tests passed successfully.\n");
+  exit(0);
+}
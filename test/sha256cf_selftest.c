@@ -27,6 +27,8 @@
 #include <string.h>
 
 #include "../src/sha256cf.h"
+#include "../src/sha256cf_impl.h"
+#include "../src/cpu.h"
 
 #define LENGTH_PADDING(L) do {                                    \
     block[64 - 8] = ((unsigned long)(L) >> (56 - 3)) & 0xff;      \
@@ -219,6 +221,118 @@ static void check_strHUGE(void) {
   }
 }
 
+/* cross-check all kernels supported by this CPU against the reference code, on random and unaligned inputs */
+static void kernels(void) {
+  const struct sha256cf_kernel *kernel, *ref;
+  uint32_t st[8], st_ref[8];
+  uint8_t block[SHA256CF_BLOCKSIZE + 8];
+  uint8_t block_ref[SHA256CF_BLOCKSIZE + 8];
+  uint8_t in[10 * SHA256CF_STATESIZE], out[10 * SHA256CF_STATESIZE], out_ref[10 * SHA256CF_STATESIZE];
+  int decrypt;
+  size_t len, nblocks;
+  int i, j;
+
+  for (ref = sha256cf_kernels; ref->features != 0; ref++) {
+    ;
+  }
+
+  for (kernel = sha256cf_kernels; kernel != ref; kernel++) {
+    if ((kernel->features & cpu_features()) != kernel->features) {
+      continue;
+    }
+    for (i = 0; i < 1000; i++) {
+      for (j = 0; j < 8; j++) {
+        st[j] = st_ref[j] = (uint32_t)(((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ rand());
+      }
+      for (j = 0; j < (int)sizeof(block); j++) {
+        block[j] = rand() & 0xff;
+      }
+      (*ref->update)(st_ref, block + (i & 7));
+      (*kernel->update)(st, block + (i & 7));
+      if (memcmp(st, st_ref, sizeof(st))) {
+        fprintf(stderr, "FATAL: kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      for (j = 0; j < (int)sizeof(in); j++) {
+        in[j] = rand() & 0xff;
+      }
+      len = (i & 1) ? SHA256CF_STATESIZE : (size_t)rand() % SHA256CF_STATESIZE;
+      (*ref->update_xor)(st_ref, block, out_ref, in, len);
+      (*kernel->update_xor)(st, block, out, in, len);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(out, out_ref, len)) {
+        fprintf(stderr, "FATAL: fused kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      (*ref->update_split)(st_ref, in, in + 32, block + (i & 7), out_ref, in + 64);
+      (*kernel->update_split)(st, in, in + 32, block + (i & 7), out, in + 64);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(out, out_ref, SHA256CF_STATESIZE)) {
+        fprintf(stderr, "FATAL: split kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      memcpy(block_ref, block, sizeof(block));
+      nblocks = 1 + (size_t)rand() % 10;
+      decrypt = i & 2;
+      (*ref->ets_bulk)(st_ref, block_ref + (i & 7), out_ref, in, nblocks, decrypt);
+      (*kernel->ets_bulk)(st, block + (i & 7), out, in, nblocks, decrypt);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(block, block_ref, sizeof(block)) || memcmp(out, out_ref, nblocks * SHA256CF_STATESIZE)) {
+        fprintf(stderr, "FATAL: bulk kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+    }
+  }
+}
+
+/* lane l of the multi-buffer kernels has to agree with a single-lane call of the reference code */
+static void mb_kernels(void) {
+  const struct sha256cf_mb_kernel *kernel;
+  const struct sha256cf_kernel *ref;
+  uint32_t st[16][8], st_ref[16][8];
+  uint8_t block[16][SHA256CF_BLOCKSIZE + 8];
+  void *st_p[16];
+  const void *block_p[16];
+  int i, j, l;
+
+  for (ref = sha256cf_kernels; ref->features != 0; ref++) {
+    ;
+  }
+
+  for (kernel = sha256cf_mb_kernels; ; kernel++) {
+    if ((kernel->features & cpu_features()) != kernel->features) {
+      continue;
+    }
+    for (i = 0; i < 1000; i++) {
+      for (l = 0; l < 16; l++) {
+        for (j = 0; j < 8; j++) {
+          st[l][j] = st_ref[l][j] = (uint32_t)(((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ rand());
+        }
+        for (j = 0; j < (int)sizeof(block[l]); j++) {
+          block[l][j] = rand() & 0xff;
+        }
+        st_p[l] = st[l];
+        block_p[l] = block[l] + ((i + l) & 7);
+        (*ref->update)(st_ref[l], block_p[l]);
+      }
+      if (i & 1) {
+        (*kernel->update_x16)(st_p, block_p);
+      }
+      else {
+        (*kernel->update_x8)(st_p, block_p);
+        (*kernel->update_x8)(st_p + 8, block_p + 8);
+      }
+      if (memcmp(st, st_ref, sizeof(st))) {
+        fprintf(stderr, "FATAL: multi-buffer kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+    }
+    if (kernel->features == 0) {
+      break;
+    }
+  }
+}
+
 int main(void) {
   check_str0();
   check_str3();
@@ -226,6 +340,8 @@ int main(void) {
   check_str112();
   check_str1000000();
   check_strHUGE();
+  kernels();
+  mb_kernels();
 
   printf("All tests passed successfully.\n");
   exit(0);
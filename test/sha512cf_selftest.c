@@ -27,6 +27,8 @@
 #include <string.h>
 
 #include "../src/sha512cf.h"
+#include "../src/sha512cf_impl.h"
+#include "../src/cpu.h"
 
 /* note that this considers only 64 of 128 bits */
 #define LENGTH_PADDING(L) do {                                    \
@@ -242,6 +244,98 @@ static void check_strHUGE(void) {
   }
 }
 
+/* cross-check all kernels supported by this CPU against the reference code, on random and unaligned inputs */
+static void kernels(void) {
+  const struct sha512cf_kernel *kernel, *ref;
+  uint64_t st[8], st_ref[8];
+  uint8_t block[SHA512CF_BLOCKSIZE + 8];
+  uint8_t block_ref[SHA512CF_BLOCKSIZE + 8];
+  uint8_t in[10 * SHA512CF_STATESIZE], out[10 * SHA512CF_STATESIZE], out_ref[10 * SHA512CF_STATESIZE];
+  uint64_t st_x[8][8], st_x_ref[8][8];
+  uint8_t block_x[8][SHA512CF_BLOCKSIZE + 8];
+  void *st_p[8];
+  const void *block_p[8];
+  int decrypt;
+  size_t len, nblocks;
+  int i, j, l;
+
+  for (ref = sha512cf_kernels; ref->features != 0; ref++) {
+    ;
+  }
+
+  for (kernel = sha512cf_kernels; kernel != ref; kernel++) {
+    if ((kernel->features & cpu_features()) != kernel->features) {
+      continue;
+    }
+    for (i = 0; i < 1000; i++) {
+      for (j = 0; j < 8; j++) {
+        st[j] = st_ref[j] = (uint64_t)(((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ rand());
+      }
+      for (j = 0; j < (int)sizeof(block); j++) {
+        block[j] = rand() & 0xff;
+      }
+      (*ref->update)(st_ref, block + (i & 7));
+      (*kernel->update)(st, block + (i & 7));
+      if (memcmp(st, st_ref, sizeof(st))) {
+        fprintf(stderr, "FATAL: kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      for (j = 0; j < (int)sizeof(in); j++) {
+        in[j] = rand() & 0xff;
+      }
+      len = (i & 1) ? SHA512CF_STATESIZE : (size_t)rand() % SHA512CF_STATESIZE;
+      (*ref->update_xor)(st_ref, block, out_ref, in, len);
+      (*kernel->update_xor)(st, block, out, in, len);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(out, out_ref, len)) {
+        fprintf(stderr, "FATAL: fused kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      (*ref->update_split)(st_ref, in, in + 64, block + (i & 7), out_ref, in + 128);
+      (*kernel->update_split)(st, in, in + 64, block + (i & 7), out, in + 128);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(out, out_ref, SHA512CF_STATESIZE)) {
+        fprintf(stderr, "FATAL: split kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      memcpy(block_ref, block, sizeof(block));
+      nblocks = 1 + (size_t)rand() % 10;
+      decrypt = i & 2;
+      (*ref->ets_bulk)(st_ref, block_ref + (i & 7), out_ref, in, nblocks, decrypt);
+      (*kernel->ets_bulk)(st, block + (i & 7), out, in, nblocks, decrypt);
+      if (memcmp(st, st_ref, sizeof(st)) || memcmp(block, block_ref, sizeof(block)) || memcmp(out, out_ref, nblocks * SHA512CF_STATESIZE)) {
+        fprintf(stderr, "FATAL: bulk kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+
+      /* lane l of the multi-buffer kernels has to agree with a single-lane call */
+      for (l = 0; l < 8; l++) {
+        for (j = 0; j < 8; j++) {
+          st_x[l][j] = st_x_ref[l][j] = (uint64_t)(((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ rand());
+        }
+        for (j = 0; j < (int)sizeof(block_x[l]); j++) {
+          block_x[l][j] = rand() & 0xff;
+        }
+        st_p[l] = st_x[l];
+        block_p[l] = block_x[l] + ((i + l) & 7);
+        (*ref->update)(st_x_ref[l], block_p[l]);
+      }
+      if (i & 1) {
+        (*kernel->update_x8)(st_p, block_p);
+      }
+      else {
+        (*kernel->update_x4)(st_p, block_p);
+        (*kernel->update_x4)(st_p + 4, block_p + 4);
+      }
+      if (memcmp(st_x, st_x_ref, sizeof(st_x))) {
+        fprintf(stderr, "FATAL: multi-buffer kernel %s disagrees with %s\n", kernel->name, ref->name);
+        exit(1);
+      }
+    }
+  }
+}
+
 int main(void) {
   check_str0();
   check_str3();
@@ -249,6 +343,7 @@ int main(void) {
   check_str112();
   check_str1000000();
   check_strHUGE();
+  kernels();
 
   printf("All tests passed successfully.\n");
   exit(0);